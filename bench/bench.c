@@ -0,0 +1,591 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/* microbenchmarks of emulator hot paths                              */
+/*                                                                    */
+/* pizza-bench [-r reps] [-f filter] [-j out.json]                    */
+/*                                                                    */
+/* every benchmark is calibrated to run batches of ~BENCH_BATCH_NS,   */
+/* then repeated; ns/op is reported as median, min, mean and stddev   */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cartridge.h"
+#include "gameboy.h"
+#include "global.h"
+#include "gpu.h"
+#include "mmu.h"
+#include "snapshot.h"
+#include "sound.h"
+#include "utils.h"
+
+/* target length of a timed batch */
+#define BENCH_BATCH_NS 10000000
+
+/* default repetitions */
+#define BENCH_REPS 11
+
+/* max repetitions */
+#define BENCH_REPS_MAX 101
+
+/* a single benchmark */
+typedef struct bench_s
+{
+    char  *name;
+
+    /* prepare machine state, can be NULL */
+    void (*setup)();
+
+    /* run n operations */
+    void (*run)(uint64_t n);
+
+} bench_t;
+
+/* results of a benchmark */
+typedef struct bench_result_s
+{
+    uint64_t ops;
+    int      reps;
+    double   median;
+    double   min;
+    double   mean;
+    double   stddev;
+
+} bench_result_t;
+
+/* synthetic cartridge - MBC1 + 32 kB RAM + BATTERY, 8 ROM banks */
+#define BENCH_ROM_SZ (8 * 0x4000)
+
+uint8_t bench_rom[BENCH_ROM_SZ];
+char    bench_rom_path[64];
+
+/* address read/written by mmu benchmarks */
+uint16_t bench_addr;
+
+/* value that can't be optimized away */
+volatile uint8_t bench_sink;
+
+/* save state buffer */
+uint8_t *bench_stat;
+size_t   bench_stat_sz;
+
+uint64_t bench_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * synthetic program
+ *
+ * 0x0100 DI, JP 0x0150
+ * 0x0150 dispatcher: jump to (HRAM 0xFF80) << 8
+ * 0x0200 ... instruction mixes, 64 instructions each, then JP 0x0150
+ * 0x0700 RET
+ */
+
+#define BENCH_MIX_INSTR 64
+
+uint8_t bench_mix_alu[] = { 0x80, 0xA9, 0x3C, 0x47, 0x91, 0x0C, 0xB2, 0x57 };
+
+/* HL is set to C000 at every round */
+uint8_t bench_mix_ld[] = { 0x22, 0x7E, 0x2A, 0x77, 0x46, 0x70, 0x23, 0x7E };
+
+/* CALL 0700, JR +0 */
+uint8_t bench_mix_branch[] = { 0xCD, 0x00, 0x07, 0x18, 0x00 };
+
+uint8_t bench_mix_cb[] = { 0xCB, 0x37, 0xCB, 0x40, 0xCB, 0x11, 0xCB, 0xC7,
+                           0xCB, 0x87, 0xCB, 0x3F, 0xCB, 0x19, 0xCB, 0x27 };
+
+uint8_t bench_mix_16[] = { 0x09, 0x03, 0x1B, 0xC5, 0xD1, 0x29, 0x13, 0x23 };
+
+/* write a mix made of a repeated pattern of n instructions */
+void bench_rom_mix(uint16_t a, uint8_t *pat, size_t sz, int instr, 
+                   char set_hl)
+{
+    int i;
+
+    if (set_hl)
+    {
+        /* LD HL, C000 */
+        bench_rom[a++] = 0x21;
+        bench_rom[a++] = 0x00;
+        bench_rom[a++] = 0xC0;
+    }
+
+    for (i = 0; i < BENCH_MIX_INSTR / instr; i++)
+    {
+        memcpy(&bench_rom[a], pat, sz);
+        a += sz;
+    }
+
+    /* JP 0150 */
+    bench_rom[a++] = 0xC3;
+    bench_rom[a++] = 0x50;
+    bench_rom[a++] = 0x01;
+}
+
+char bench_rom_build()
+{
+    FILE *fp;
+    int i;
+
+    /* filled with NOPs */
+    memset(bench_rom, 0, sizeof(bench_rom));
+
+    /* DI, JP 0150 */
+    memcpy(&bench_rom[0x100], "\xF3\xC3\x50\x01", 4);
+
+    /* header */
+    memcpy(&bench_rom[0x134], "BENCH", 5);
+    bench_rom[0x147] = 0x03;
+    bench_rom[0x148] = 0x02;
+    bench_rom[0x149] = 0x03;
+
+    /* LDH A,(80), LD H,A, LD L,00, JP (HL) */
+    memcpy(&bench_rom[0x150], "\xF0\x80\x67\x2E\x00\xE9", 6);
+
+    bench_rom_mix(0x0200, bench_mix_alu, sizeof(bench_mix_alu), 8, 0);
+    bench_rom_mix(0x0300, bench_mix_ld, sizeof(bench_mix_ld), 8, 1);
+    bench_rom_mix(0x0400, bench_mix_branch, sizeof(bench_mix_branch), 2, 0);
+    bench_rom_mix(0x0500, bench_mix_cb, sizeof(bench_mix_cb), 8, 0);
+    bench_rom_mix(0x0600, bench_mix_16, sizeof(bench_mix_16), 8, 0);
+
+    /* RET */
+    bench_rom[0x0700] = 0xC9;
+
+    /* every switchable bank tells its number */
+    for (i = 1; i < 8; i++)
+        bench_rom[i * 0x4000] = i;
+
+    snprintf(bench_rom_path, sizeof(bench_rom_path), 
+             "/tmp/pizza-bench-%d.gb", (int) getpid());
+
+    fp = fopen(bench_rom_path, "w");
+
+    if (fp == NULL)
+        return 1;
+
+    fwrite(bench_rom, 1, sizeof(bench_rom), fp);
+    fclose(fp);
+
+    return 0;
+}
+
+/* frame callback */
+void bench_frame_cb() {}
+
+/*
+ * mmu
+ */
+
+void bench_mmu_read(uint64_t n)
+{
+    uint8_t v = 0;
+
+    while (n--)
+        v += mmu_read(bench_addr);
+
+    bench_sink = v;
+}
+
+void bench_mmu_write(uint64_t n)
+{
+    while (n--)
+        mmu_write(bench_addr, (uint8_t) n);
+}
+
+void bench_setup_rom0()  { bench_addr = 0x0150; }
+void bench_setup_romx()  { bench_addr = 0x4000; }
+void bench_setup_vram()  { bench_addr = 0x8800; }
+void bench_setup_wram()  { bench_addr = 0xC100; }
+void bench_setup_wramx() { bench_addr = 0xD100; }
+void bench_setup_hram()  { bench_addr = 0xFF90; }
+void bench_setup_io()    { bench_addr = 0xFF44; }
+
+void bench_setup_eram()
+{
+    /* enable external RAM */
+    mmu_write(0x0000, 0x0A);
+
+    bench_addr = 0xA100;
+}
+
+/*
+ * bank switching
+ */
+
+void bench_rom_bank(uint64_t n)
+{
+    while (n--)
+        mmu_write(0x2000, (n & 1) + 1);
+}
+
+void bench_setup_ram_bank()
+{
+    /* RAM banking mode, RAM on */
+    mmu_write(0x6000, 0x01);
+    mmu_write(0x0000, 0x0A);
+}
+
+void bench_ram_bank(uint64_t n)
+{
+    while (n--)
+        mmu_write(0x4000, n & 3);
+}
+
+/*
+ * CPU
+ */
+
+void bench_cpu(uint64_t n)
+{
+    while (n--)
+        gameboy_step();
+}
+
+void bench_setup_cpu(uint8_t mix)
+{
+    /* next dispatch goes to the new mix */
+    mmu_write_no_cyc(0xFF80, mix);
+
+    /* and let it reach steady state */
+    bench_cpu(1000);
+}
+
+void bench_setup_alu()    { bench_setup_cpu(0x02); }
+void bench_setup_ld()     { bench_setup_cpu(0x03); }
+void bench_setup_branch() { bench_setup_cpu(0x04); }
+void bench_setup_cb()     { bench_setup_cpu(0x05); }
+void bench_setup_16()     { bench_setup_cpu(0x06); }
+
+/*
+ * GPU scenes
+ */
+
+void bench_gpu_line(uint64_t n)
+{
+    uint8_t line = 0;
+
+    while (n--)
+    {
+        gpu_draw_line(line);
+
+        if (++line == 144)
+            line = 0;
+    }
+}
+
+/* random tiles and maps, LCD on with BG */
+void bench_setup_scene_bg()
+{
+    int i;
+
+    srand(1);
+
+    for (i = 0x8000; i < 0xA000; i++)
+        mmu_write_no_cyc(i, rand());
+
+    /* no sprites */
+    for (i = 0xFE00; i < 0xFEA0; i++)
+        mmu_write_no_cyc(i, 0);
+
+    mmu_write_no_cyc(0xFF40, 0x91);
+    mmu_write_no_cyc(0xFF42, 3);
+    mmu_write_no_cyc(0xFF43, 5);
+}
+
+void bench_setup_scene_window()
+{
+    bench_setup_scene_bg();
+
+    /* window on the lower half */
+    mmu_write_no_cyc(0xFF4A, 72);
+    mmu_write_no_cyc(0xFF4B, 7);
+    mmu_write_no_cyc(0xFF40, 0xF1);
+}
+
+void bench_setup_scene_sprites()
+{
+    int i;
+
+    bench_setup_scene_bg();
+
+    /* 40 8x16 sprites, 10 per line on 4 bands */
+    for (i = 0; i < 40; i++)
+    {
+        mmu_write_no_cyc(0xFE00 + i * 4, 16 + (i / 10) * 36);
+        mmu_write_no_cyc(0xFE01 + i * 4, 8 + (i % 10) * 16);
+        mmu_write_no_cyc(0xFE02 + i * 4, i * 2);
+        mmu_write_no_cyc(0xFE03 + i * 4, (i & 3) << 5);
+    }
+
+    mmu_write_no_cyc(0xFF40, 0x97);
+}
+
+/*
+ * sound
+ */
+
+void bench_setup_sound()
+{
+    /* all channels on, both sides */
+    mmu_write(0xFF26, 0x80);
+    mmu_write(0xFF24, 0x77);
+    mmu_write(0xFF25, 0xFF);
+    mmu_write(0xFF12, 0xF0);
+    mmu_write(0xFF14, 0x87);
+    mmu_write(0xFF17, 0xF0);
+    mmu_write(0xFF19, 0x87);
+    mmu_write(0xFF1A, 0x80);
+    mmu_write(0xFF1C, 0x20);
+    mmu_write(0xFF1E, 0x87);
+    mmu_write(0xFF21, 0xF0);
+    mmu_write(0xFF23, 0x80);
+}
+
+void bench_sound_sample(uint64_t n)
+{
+    while (n--)
+        sound_step_sample();
+}
+
+/*
+ * save states
+ */
+
+void bench_setup_stat()
+{
+    bench_stat_sz = gameboy_stat_size();
+    bench_stat = realloc(bench_stat, bench_stat_sz);
+}
+
+void bench_stat_save(uint64_t n)
+{
+    while (n--)
+        gameboy_save_stat_buf(bench_stat, bench_stat_sz);
+}
+
+void bench_stat_roundtrip(uint64_t n)
+{
+    while (n--)
+    {
+        gameboy_save_stat_buf(bench_stat, bench_stat_sz);
+        gameboy_restore_stat_buf(bench_stat, bench_stat_sz);
+    }
+}
+
+void bench_setup_snapshot()
+{
+    snapshot_save(0);
+}
+
+void bench_snapshot_restore(uint64_t n)
+{
+    while (n--)
+        snapshot_restore(0);
+}
+
+bench_t bench_list[] = {
+    { "mmu_read/rom0",          bench_setup_rom0,   bench_mmu_read },
+    { "mmu_read/romx",          bench_setup_romx,   bench_mmu_read },
+    { "mmu_read/vram",          bench_setup_vram,   bench_mmu_read },
+    { "mmu_read/eram",          bench_setup_eram,   bench_mmu_read },
+    { "mmu_read/wram",          bench_setup_wram,   bench_mmu_read },
+    { "mmu_read/wramx",         bench_setup_wramx,  bench_mmu_read },
+    { "mmu_read/hram",          bench_setup_hram,   bench_mmu_read },
+    { "mmu_read/io",            bench_setup_io,     bench_mmu_read },
+    { "mmu_write/vram",         bench_setup_vram,   bench_mmu_write },
+    { "mmu_write/eram",         bench_setup_eram,   bench_mmu_write },
+    { "mmu_write/wram",         bench_setup_wram,   bench_mmu_write },
+    { "mmu_write/wramx",        bench_setup_wramx,  bench_mmu_write },
+    { "mmu_write/hram",         bench_setup_hram,   bench_mmu_write },
+    { "bank/rom",               NULL,               bench_rom_bank },
+    { "bank/ram",               bench_setup_ram_bank, bench_ram_bank },
+    { "z80_execute/alu",        bench_setup_alu,    bench_cpu },
+    { "z80_execute/ld",         bench_setup_ld,     bench_cpu },
+    { "z80_execute/branch",     bench_setup_branch, bench_cpu },
+    { "z80_execute/cb",         bench_setup_cb,     bench_cpu },
+    { "z80_execute/16bit",      bench_setup_16,     bench_cpu },
+    { "gpu_draw_line/bg",       bench_setup_scene_bg,      bench_gpu_line },
+    { "gpu_draw_line/window",   bench_setup_scene_window,  bench_gpu_line },
+    { "gpu_draw_line/sprites",  bench_setup_scene_sprites, bench_gpu_line },
+    { "sound_step_sample",      bench_setup_sound,  bench_sound_sample },
+    { "stat/save",              bench_setup_stat,   bench_stat_save },
+    { "stat/roundtrip",         bench_setup_stat,   bench_stat_roundtrip },
+    { "stat/snapshot",          bench_setup_snapshot, bench_snapshot_restore },
+    { NULL, NULL, NULL }
+};
+
+int bench_cmp(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+void bench_run(bench_t *b, int reps, bench_result_t *r)
+{
+    double ns[BENCH_REPS_MAX];
+    uint64_t n = 1, t;
+    int i;
+
+    if (b->setup)
+        b->setup();
+
+    /* find how many ops fill a batch */
+    while (1)
+    {
+        t = bench_ns();
+        b->run(n);
+        t = bench_ns() - t;
+
+        if (t >= BENCH_BATCH_NS || n >= (1ULL << 40))
+            break;
+
+        n = (t < BENCH_BATCH_NS / 64) ? n * 16 : n * 2;
+    }
+
+    for (i = 0; i < reps; i++)
+    {
+        t = bench_ns();
+        b->run(n);
+        ns[i] = (double) (bench_ns() - t) / n;
+    }
+
+    qsort(ns, reps, sizeof(double), bench_cmp);
+
+    r->ops = n;
+    r->reps = reps;
+    r->median = ns[reps / 2];
+    r->min = ns[0];
+    r->mean = 0;
+    r->stddev = 0;
+
+    for (i = 0; i < reps; i++)
+        r->mean += ns[i];
+
+    r->mean /= reps;
+
+    for (i = 0; i < reps; i++)
+        r->stddev += (ns[i] - r->mean) * (ns[i] - r->mean);
+
+    r->stddev = sqrt(r->stddev / reps);
+}
+
+int main(int argc, char **argv)
+{
+    bench_result_t r;
+    char *filter = NULL;
+    char *json = NULL;
+    FILE *fp = NULL;
+    int reps = BENCH_REPS;
+    int opt, i, first = 1;
+
+    while ((opt = getopt(argc, argv, "r:f:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': reps = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'j': json = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-r reps] [-f filter] "
+                                "[-j out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (reps < 1 || reps > BENCH_REPS_MAX)
+        reps = BENCH_REPS;
+
+    /* quiet, no files around, no pacing */
+    global_init();
+    global_deterministic = 1;
+    global_uncapped = 1;
+
+    if (bench_rom_build() || cartridge_load(bench_rom_path))
+    {
+        fprintf(stderr, "Cannot prepare synthetic cartridge\n");
+        return 1;
+    }
+
+    unlink(bench_rom_path);
+
+    gameboy_init();
+    gpu_init(&bench_frame_cb);
+    sound_set_output_rate(44100);
+
+    if (json)
+    {
+        fp = fopen(json, "w");
+
+        if (fp == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", json);
+            return 1;
+        }
+
+        fprintf(fp, "{\n  \"reps\": %d,\n  \"results\": [", reps);
+    }
+
+    printf("%-24s %10s %10s %10s %8s\n", "benchmark", "median", "min", 
+           "mean", "stddev");
+
+    for (i = 0; bench_list[i].name; i++)
+    {
+        if (filter && !strstr(bench_list[i].name, filter))
+            continue;
+
+        bench_run(&bench_list[i], reps, &r);
+
+        printf("%-24s %10.2f %10.2f %10.2f %7.1f%%  ns/op\n", 
+               bench_list[i].name, r.median, r.min, r.mean,
+               r.mean ? r.stddev * 100 / r.mean : 0);
+
+        if (fp)
+        {
+            fprintf(fp, "%s\n    {\"name\": \"%s\", \"ops\": %lu, "
+                        "\"median_ns\": %.3f, \"min_ns\": %.3f, "
+                        "\"mean_ns\": %.3f, \"stddev_ns\": %.3f}",
+                        first ? "" : ",", bench_list[i].name, 
+                        (unsigned long) r.ops, r.median, r.min, r.mean, 
+                        r.stddev);
+            first = 0;
+        }
+    }
+
+    if (fp)
+    {
+        fprintf(fp, "\n  ]\n}\n");
+        fclose(fp);
+    }
+
+    return 0;
+}
@@ -0,0 +1,662 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/* whole system throughput on generated workloads                     */
+/*                                                                    */
+/* pizza-macro [-n frames] [-r reps] [-f filter] [-j out.json] [-v]   */
+/*             [-I]                                                   */
+/*                                                                    */
+/* every workload is a tiny program assembled here into a cartridge,  */
+/* run headless and uncapped with a scripted joypad sequence; frames  */
+/* and audio samples are hashed to validate the emulation. -I skips   */
+/* busy waits instead of running them instruction by instruction      */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cartridge.h"
+#include "cycles.h"
+#include "gameboy.h"
+#include "global.h"
+#include "gpu.h"
+#include "idle.h"
+#include "input.h"
+#include "sound.h"
+#include "utils.h"
+
+/* frames per run, expected hashes are valid for this qty only */
+#define MACRO_FRAMES 1000
+
+/* default and max repetitions */
+#define MACRO_REPS     3
+#define MACRO_REPS_MAX 25
+
+/* the joypad changes every MACRO_INPUT_HOLD frames */
+#define MACRO_INPUT_HOLD 16
+
+/* largest generated cartridge */
+#define MACRO_ROM_SZ (16 * 0x4000)
+
+/* a workload */
+typedef struct macro_s
+{
+    char    *name;
+
+    /* cartridge header */
+    uint8_t  cgb;
+    uint8_t  type;
+    uint8_t  rom_size;
+
+    /* LCDC value once initialized */
+    uint8_t  lcdc;
+
+    /* emit init code and per frame code */
+    void   (*init)();
+    void   (*frame)();
+
+    /* hash of MACRO_FRAMES frames, 0 if unknown */
+    uint64_t expect;
+
+} macro_t;
+
+/* results of a workload */
+typedef struct macro_result_s
+{
+    uint64_t hash;
+    uint64_t cycles;
+    double   fps;
+    double   cps;
+    char     stable;
+
+} macro_result_t;
+
+uint8_t  macro_rom[MACRO_ROM_SZ];
+char     macro_rom_path[64];
+
+/* assembler output position */
+uint16_t macro_pc;
+
+/* print per frame hashes */
+char     macro_verbose = 0;
+
+/* write bytes at current position */
+#define EMIT(s) macro_emit(s, sizeof(s) - 1)
+
+void macro_emit(const char *b, size_t sz)
+{
+    memcpy(&macro_rom[macro_pc], b, sz);
+    macro_pc += sz;
+}
+
+/* relative jump (op is JR, JR NZ...) back to label */
+void macro_jr(uint8_t op, uint16_t label)
+{
+    macro_rom[macro_pc] = op;
+    macro_rom[macro_pc + 1] = (uint8_t) (label - (macro_pc + 2));
+    macro_pc += 2;
+}
+
+/* absolute jump */
+void macro_jp(uint16_t label)
+{
+    macro_rom[macro_pc] = 0xC3;
+    macro_rom[macro_pc + 1] = label & 0xFF;
+    macro_rom[macro_pc + 2] = label >> 8;
+    macro_pc += 3;
+}
+
+/* CGB palettes, colors depend on HRAM frame counter at 0xFF90 */
+void macro_emit_palettes()
+{
+    uint16_t l;
+
+    /* LD A,(FF90), LD C,A, BCPS and OCPS auto increment from 0 */
+    EMIT("\xF0\x90\x4F\x3E\x80\xE0\x68\xE0\x6A");
+
+    /* LD B,64 */
+    EMIT("\x06\x40");
+
+    l = macro_pc;
+
+    /* A = B * 5 + C, BCPD = A, OCPD = ~A, DEC B */
+    EMIT("\x78\x87\x87\x80\x81\xE0\x69\x2F\xE0\x6B\x05");
+    macro_jr(0x20, l);
+}
+
+/*
+ * bank switch heavy: 200 MBC1 ROM switches and reads per frame
+ */
+
+void macro_bank_init() {}
+
+void macro_bank_frame()
+{
+    uint16_t l;
+
+    /* LD C,200 */
+    EMIT("\x0E\xC8");
+
+    l = macro_pc;
+
+    /* bank = C & 0x0F, A = (0x40 << 8 | C), D += A, DEC C */
+    EMIT("\x79\xE6\x0F\xEA\x00\x20\x69\x26\x40\x7E\x82\x57\x0D");
+    macro_jr(0x20, l);
+
+    /* SCY = D */
+    EMIT("\x7A\xE0\x42");
+}
+
+/*
+ * sprite heavy: 40 8x16 sprites moved and DMA'd every frame
+ */
+
+void macro_sprites_init()
+{
+    uint16_t l;
+
+    /* copy the OAM DMA routine in HRAM (it's after the JR) */
+    EMIT("\x21\x80\xFF\x11");
+    macro_rom[macro_pc] = (macro_pc + 0x0C) & 0xFF;
+    macro_rom[macro_pc + 1] = (macro_pc + 0x0C) >> 8;
+    macro_pc += 2;
+
+    /* LD B,8 */
+    EMIT("\x06\x08");
+
+    l = macro_pc;
+
+    /* LD A,(DE), INC DE, LD (HL+),A, DEC B */
+    EMIT("\x1A\x13\x22\x05");
+    macro_jr(0x20, l);
+
+    /* JR over the routine */
+    EMIT("\x18\x08");
+
+    /* LDH (46),A, LD A,28, DEC A, JR NZ,-3, RET */
+    EMIT("\xE0\x46\x3E\x28\x3D\x20\xFD\xC9");
+
+    /* shadow OAM in C000, byte = L * 3 */
+    EMIT("\x21\x00\xC0");
+
+    l = macro_pc;
+
+    EMIT("\x7D\x87\x85\x22\x7D\xFE\xA0");
+    macro_jr(0x20, l);
+
+    if (macro_rom[0x143])
+        macro_emit_palettes();
+}
+
+void macro_sprites_frame()
+{
+    uint16_t l;
+
+    /* LD HL,C000, LD B,40 */
+    EMIT("\x21\x00\xC0\x06\x28");
+
+    l = macro_pc;
+
+    /* Y++, X += (B & 3) + 1, skip tile and attributes, DEC B */
+    EMIT("\x7E\x3C\x22\x78\xE6\x03\x3C\x86\x22\x23\x23\x05");
+    macro_jr(0x20, l);
+
+    /* OAM DMA from C000 */
+    EMIT("\x3E\xC0\xCD\x80\xFF");
+}
+
+/*
+ * HDMA heavy: 2 kB general purpose and 1152 bytes HBlank transfers, 
+ * switching ROM and VRAM banks, with CGB palettes updates
+ */
+
+void macro_hdma_init()
+{
+    macro_emit_palettes();
+}
+
+void macro_hdma_frame()
+{
+    /* frame counter in FF90, ROM bank = f & 0x0F, VRAM bank = f & 1 */
+    EMIT("\xF0\x90\x3C\xE0\x90\xE6\x0F\xEA\x00\x20\xE6\x01\xE0\x4F");
+
+    /* general purpose 4000 -> 8800, 128 blocks */
+    EMIT("\x3E\x40\xE0\x51\xAF\xE0\x52\x3E\x88\xE0\x53\xAF\xE0\x54");
+    EMIT("\x3E\x7F\xE0\x55");
+
+    /* HBlank 4800 -> 9000, 72 blocks */
+    EMIT("\x3E\x48\xE0\x51\xAF\xE0\x52\x3E\x90\xE0\x53\xAF\xE0\x54");
+    EMIT("\x3E\xC7\xE0\x55");
+
+    macro_emit_palettes();
+}
+
+/*
+ * audio heavy: all channels retriggered every frame
+ */
+
+void macro_audio_init()
+{
+    uint16_t l;
+
+    /* power, volume, panning, sweep, duty, envelopes, wave DAC */
+    EMIT("\x3E\x80\xE0\x26\x3E\x77\xE0\x24\x3E\xFF\xE0\x25"
+         "\x3E\x1D\xE0\x10\x3E\x80\xE0\x11\x3E\xF3\xE0\x12"
+         "\x3E\x40\xE0\x16\x3E\xF3\xE0\x17\x3E\x80\xE0\x1A"
+         "\x3E\x20\xE0\x1C\x3E\xF2\xE0\x21");
+
+    /* wave RAM, byte = rlc3(L) ^ L */
+    EMIT("\x21\x30\xFF");
+
+    l = macro_pc;
+
+    EMIT("\x7D\x07\x07\x07\xAD\x22\x7D\xFE\x40");
+    macro_jr(0x20, l);
+}
+
+void macro_audio_frame()
+{
+    /* frame counter, ch1 frequency = f and trigger */
+    EMIT("\xF0\x90\x3C\xE0\x90\xE0\x13\x3E\x87\xE0\x14");
+
+    /* ch2 frequency = 2f */
+    EMIT("\xF0\x90\x87\xE0\x18\x3E\x86\xE0\x19");
+
+    /* ch3 frequency = ~f */
+    EMIT("\xF0\x90\x2F\xE0\x1D\x3E\x87\xE0\x1E");
+
+    /* ch4 polynomial = f & 0x77 */
+    EMIT("\xF0\x90\xE6\x77\xE0\x22\x3E\x80\xE0\x23");
+}
+
+/*
+ * busy waits: polling LY, an HRAM counter and a WRAM byte through HL
+ * bumped by the timer interrupt, instead of halting
+ */
+
+void macro_busy_init()
+{
+    /* timer handler: PUSH AF, (FF91)++, (C000) = (FF91), POP AF, RETI */
+    memcpy(&macro_rom[0x50], "\xF5\xF0\x91\x3C\xE0\x91\xEA\x00\xC0"
+                             "\xF1\xD9", 11);
+
+    /* counters, TIMA and TMA = 0, timer on at 262144 Hz */
+    EMIT("\xAF\xE0\x91\xEA\x00\xC0\xE0\x05\xE0\x06\x3E\x05\xE0\x07");
+}
+
+void macro_busy_frame()
+{
+    uint16_t l;
+
+    /* IE = VBlank + timer */
+    EMIT("\x3E\x05\xE0\xFF");
+
+    /* LDH A,(44), CP 48, JR NZ */
+    l = macro_pc;
+    EMIT("\xF0\x44\xFE\x48");
+    macro_jr(0x20, l);
+
+    /* B = (FF91) + 4, LDH A,(91), CP B, JR NZ */
+    EMIT("\xF0\x91\xC6\x04\x47");
+    l = macro_pc;
+    EMIT("\xF0\x91\xB8");
+    macro_jr(0x20, l);
+
+    /* LD HL,C000, BIT 0,(HL), JR Z */
+    EMIT("\x21\x00\xC0");
+    l = macro_pc;
+    EMIT("\xCB\x46");
+    macro_jr(0x28, l);
+
+    /* SCY = (FF91) */
+    EMIT("\xF0\x91\xE0\x42");
+}
+
+/*
+ * JR NZ on itself, left when the timer interrupt sets Z. the period 
+ * changes every frame so the interrupt gets raised by the branch at
+ * every point of it, DIV read by the handler tells if it was late
+ */
+
+void macro_irq_init()
+{
+    /* handler: (C001) += DIV, (FF91)++, CP B */
+    memcpy(&macro_rom[0x50], "\xE5\x21\x01\xC0\xF0\x04\x86\x77"
+                             "\xF0\x91\x3C\xE0\x91\xB8\xE1\xD9", 16);
+
+    /* counters, DIV, TIMA and TMA = 0, timer on at 262144 Hz */
+    EMIT("\xAF\xE0\x91\xEA\x01\xC0\xE0\x04\xE0\x05\xE0\x06"
+         "\x3E\x05\xE0\x07");
+}
+
+void macro_irq_frame()
+{
+    uint16_t l;
+
+    /* IE = VBlank + timer, TMA = (FF91) | F0, periods near the handler */
+    EMIT("\x3E\x05\xE0\xFF\xF0\x91\xF6\xF0\xE0\x06");
+
+    /* B = (FF91) + 32, OR A, JR NZ on itself */
+    EMIT("\xF0\x91\xC6\x20\x47\xB7");
+    l = macro_pc;
+    macro_jr(0x20, l);
+
+    /* SCY = (C001) */
+    EMIT("\xFA\x01\xC0\xE0\x42");
+}
+
+macro_t macro_list[] = {
+    { "dmg-bank",    0x00, 0x01, 0x03, 0x91,
+      macro_bank_init,    macro_bank_frame,    0x5dc29a7803441514ULL },
+    { "dmg-sprites", 0x00, 0x01, 0x01, 0x97,
+      macro_sprites_init, macro_sprites_frame, 0x2973d81abc6dc7f6ULL },
+    { "cgb-sprites", 0x80, 0x01, 0x01, 0x97,
+      macro_sprites_init, macro_sprites_frame, 0x2398e5bd819be8c0ULL },
+    { "cgb-hdma",    0x80, 0x19, 0x03, 0x91,
+      macro_hdma_init,    macro_hdma_frame,    0x0cbbcaf698bb11c9ULL },
+    { "dmg-audio",   0x00, 0x01, 0x01, 0x91,
+      macro_audio_init,   macro_audio_frame,   0x4fa42c050c3f71e4ULL },
+    { "dmg-busywait", 0x00, 0x01, 0x01, 0x91,
+      macro_busy_init,    macro_busy_frame,    0x76bdc0c4b6290d2cULL },
+    { "dmg-busyirq",  0x00, 0x01, 0x01, 0x91,
+      macro_irq_init,     macro_irq_frame,     0x8b368b27268e95a3ULL },
+    { NULL }
+};
+
+/* assemble workload into a cartridge file */
+char macro_rom_build(macro_t *m)
+{
+    uint16_t l;
+    FILE *fp;
+    size_t sz = 0x8000 << m->rom_size;
+    size_t i;
+
+    /* every switchable bank got different data */
+    for (i = 0; i < sz; i++)
+        macro_rom[i] = (i * 7) ^ (i >> 14) * 31;
+
+    /* NOP the low area, RETI on VBlank */
+    memset(macro_rom, 0, 0x4000);
+    macro_rom[0x40] = 0xD9;
+
+    /* NOP, JP 0150 */
+    memcpy(&macro_rom[0x100], "\x00\xC3\x50\x01", 4);
+
+    /* header */
+    snprintf((char *) &macro_rom[0x134], 12, "%s", "MACRO");
+    macro_rom[0x143] = m->cgb;
+    macro_rom[0x147] = m->type;
+    macro_rom[0x148] = m->rom_size;
+
+    macro_pc = 0x150;
+
+    /* DI, LD SP,FFFE, LCD off, frame counter = 0 */
+    EMIT("\xF3\x31\xFE\xFF\xAF\xE0\x40\xE0\x90");
+
+    /* VRAM pattern, byte = L ^ H */
+    EMIT("\x21\x00\x80");
+
+    l = macro_pc;
+
+    EMIT("\x7D\xAC\x22\x7C\xFE\xA0");
+    macro_jr(0x20, l);
+
+    m->init();
+
+    /* IE = VBlank, IF = 0, LCD on */
+    EMIT("\x3E\x01\xE0\xFF\xAF\xE0\x0F\x3E");
+    macro_rom[macro_pc++] = m->lcdc;
+    EMIT("\xE0\x40");
+
+    l = macro_pc;
+
+    /* EI, HALT */
+    EMIT("\xFB\x76");
+
+    /* read directions and XOR them into SCX */
+    EMIT("\x3E\x20\xE0\x00\xF0\x00\x2F\xE6\x0F\x4F\xF0\x43\xA9\xE0\x43");
+
+    m->frame();
+
+    macro_jp(l);
+
+    snprintf(macro_rom_path, sizeof(macro_rom_path),
+             "/tmp/pizza-macro-%d.gb", (int) getpid());
+
+    fp = fopen(macro_rom_path, "w");
+
+    if (fp == NULL)
+        return 1;
+
+    fwrite(macro_rom, 1, sz, fp);
+    fclose(fp);
+
+    return 0;
+}
+
+uint64_t macro_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* frame callback */
+void macro_frame_cb() {}
+
+/* run a workload once */
+char macro_run(macro_t *m, int frames, macro_result_t *r)
+{
+    uint_fast16_t wr;
+    uint32_t keys = 0x2545F491;
+    uint64_t h, t;
+    int i;
+
+    if (macro_rom_build(m) || cartridge_load(macro_rom_path))
+    {
+        unlink(macro_rom_path);
+        return 1;
+    }
+
+    unlink(macro_rom_path);
+
+    gameboy_init();
+    gpu_init(&macro_frame_cb);
+    sound_set_output_rate(44100);
+
+    cycles.cnt = 0;
+    wr = sound.buf_wr;
+    h = UTILS_HASH64_INIT;
+
+    t = macro_ns();
+
+    for (i = 0; i < frames; i++)
+    {
+        /* scripted joypad, same sequence on every run */
+        if (i % MACRO_INPUT_HOLD == 0)
+        {
+            keys ^= keys << 13;
+            keys ^= keys >> 17;
+            keys ^= keys << 5;
+
+            input_set_state(keys & 0xFF);
+        }
+
+        gameboy_run_frame();
+
+        /* video and the audio produced during the frame */
+        h = utils_hash64(gpu_get_frame_buffer(), 160 * 144 * 2, h);
+
+        while (wr != sound.buf_wr)
+        {
+            h = utils_hash64(&sound.buf[wr], sizeof(int16_t), h);
+
+            if (++wr == SOUND_BUF_SZ)
+                wr = 0;
+        }
+
+        if (macro_verbose)
+            printf("%s %d %016llx\n", m->name, i, (unsigned long long) h);
+    }
+
+    t = macro_ns() - t;
+
+    r->hash = h;
+    r->cycles = cycles.cnt;
+    r->fps = frames * 1e9 / t;
+    r->cps = cycles.cnt * 1e9 / t;
+
+    return 0;
+}
+
+int macro_cmp(const void *a, const void *b)
+{
+    const macro_result_t *x = a;
+    const macro_result_t *y = b;
+
+    return (x->fps > y->fps) - (x->fps < y->fps);
+}
+
+int main(int argc, char **argv)
+{
+    macro_result_t runs[MACRO_REPS_MAX];
+    macro_result_t *r;
+    macro_t *m;
+    char *filter = NULL;
+    char *json = NULL;
+    char *check;
+    FILE *fp = NULL;
+    int frames = MACRO_FRAMES;
+    int reps = MACRO_REPS;
+    int opt, i, first = 1, fail = 0;
+
+    while ((opt = getopt(argc, argv, "n:r:f:j:vI")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': frames = atoi(optarg); break;
+            case 'r': reps = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'j': json = optarg; break;
+            case 'v': macro_verbose = 1; break;
+            case 'I': idle_on = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames] [-r reps] "
+                                "[-f filter] [-j out.json] [-v] [-I]\n",
+                                argv[0]);
+                return 1;
+        }
+    }
+
+    if (reps < 1 || reps > MACRO_REPS_MAX)
+        reps = MACRO_REPS;
+
+    if (frames < 1)
+        frames = MACRO_FRAMES;
+
+    /* no files around, no pacing */
+    global_init();
+    global_deterministic = 1;
+    global_uncapped = 1;
+
+    if (json)
+    {
+        fp = fopen(json, "w");
+
+        if (fp == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", json);
+            return 1;
+        }
+
+        fprintf(fp, "{\n  \"frames\": %d,\n  \"reps\": %d,\n"
+                    "  \"results\": [", frames, reps);
+    }
+
+    printf("%-12s %10s %10s %12s  %-16s %s\n", "workload", "fps", "min fps",
+           "Mcycles/s", "hash", "check");
+
+    for (m = macro_list; m->name; m++)
+    {
+        if (filter && !strstr(m->name, filter))
+            continue;
+
+        for (i = 0; i < reps; i++)
+        {
+            if (macro_run(m, frames, &runs[i]))
+            {
+                fprintf(stderr, "Cannot prepare %s\n", m->name);
+                return 1;
+            }
+        }
+
+        /* every repetition must give the same output */
+        runs[0].stable = 1;
+
+        for (i = 1; i < reps; i++)
+            if (runs[i].hash != runs[0].hash)
+                runs[0].stable = 0;
+
+        if (!runs[0].stable)
+            check = "UNSTABLE";
+        else if (frames != MACRO_FRAMES || m->expect == 0)
+            check = "-";
+        else if (runs[0].hash == m->expect)
+            check = "ok";
+        else
+            check = "MISMATCH";
+
+        if (check[0] == 'U' || check[0] == 'M')
+            fail = 1;
+
+        qsort(runs, reps, sizeof(macro_result_t), macro_cmp);
+
+        /* median */
+        r = &runs[reps / 2];
+
+        printf("%-12s %10.1f %10.1f %12.2f  %016llx %s\n", m->name, r->fps,
+               runs[0].fps, r->cps / 1e6, (unsigned long long) r->hash, 
+               check);
+
+        if (fp)
+        {
+            fprintf(fp, "%s\n    {\"name\": \"%s\", \"fps\": %.2f, "
+                        "\"min_fps\": %.2f, \"cycles_per_sec\": %.0f, "
+                        "\"cycles\": %llu, \"hash\": \"%016llx\", "
+                        "\"check\": \"%s\"}",
+                        first ? "" : ",", m->name, r->fps, runs[0].fps, 
+                        r->cps, (unsigned long long) r->cycles, 
+                        (unsigned long long) r->hash, check);
+            first = 0;
+        }
+    }
+
+    if (fp)
+    {
+        fprintf(fp, "\n  ]\n}\n");
+        fclose(fp);
+    }
+
+    return fail;
+}
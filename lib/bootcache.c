@@ -0,0 +1,187 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bootcache.h"
+#include "cartridge.h"
+#include "cycles.h"
+#include "gameboy.h"
+#include "global.h"
+#include "gpu.h"
+#include "movie.h"
+#include "utils.h"
+
+/* content of a file into a hash chain, 0 if it cannot be read */
+uint64_t bootcache_hash_file(char *fn, uint64_t h)
+{
+    uint8_t buf[4096];
+    size_t n;
+    FILE *fp;
+
+    fp = fopen(fn, "r");
+
+    if (fp == NULL)
+        return 0;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        h = utils_hash64(buf, n, h);
+
+    fclose(fp);
+
+    return h;
+}
+
+/* state file of the checkpoint "frames run with movie" of this ROM */
+char bootcache_path(char *path, size_t sz, char *movie, uint32_t frames)
+{
+    uint64_t key = cartridge_hash();
+
+    key = utils_hash64(&frames, sizeof(frames), key);
+
+    /* power on RAM and the like depend on them */
+    key = utils_hash64(&global_deterministic, 
+                       sizeof(global_deterministic), key);
+    key = utils_hash64(&global_seed, sizeof(global_seed), key);
+
+    /* keyed by movie content, an edited movie is another checkpoint */
+    if (movie)
+    {
+        key = bootcache_hash_file(movie, key);
+
+        if (key == 0)
+        {
+            utils_log_error("Cannot open movie %s\n", movie);
+            return 1;
+        }
+    }
+
+    snprintf(path, sz, "%s/%s.%016llx.boot", global_save_folder, 
+                       global_rom_name, (unsigned long long) key);
+
+    return 0;
+}
+
+/* restore a cached state, it must fit the current stat layout */
+char bootcache_load(char *path)
+{
+    uint8_t *buf;
+    size_t sz;
+    FILE *fp;
+    char ret = 1;
+
+    fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return 1;
+
+    sz = gameboy_stat_size();
+    buf = malloc(sz + 1);
+
+    /* one more byte to detect a longer file (older layout) */
+    if (buf && fread(buf, 1, sz + 1, fp) == sz)
+        ret = gameboy_restore_stat_buf(buf, sz);
+
+    free(buf);
+    fclose(fp);
+
+    return ret;
+}
+
+/* write the state aside and rename it, parallel runs of the same */
+/* checkpoint never see half a file                               */
+char bootcache_store(char *path)
+{
+    char tmp[1024];
+    uint8_t *buf;
+    size_t sz;
+    FILE *fp;
+    char ret = 1;
+
+    sz = gameboy_stat_size();
+    buf = malloc(sz);
+
+    if (buf == NULL || gameboy_save_stat_buf(buf, sz))
+    {
+        free(buf);
+        return 1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+    fp = fopen(tmp, "w");
+
+    if (fp)
+    {
+        ret = (fwrite(buf, 1, sz, fp) != sz);
+        ret |= (fclose(fp) != 0);
+
+        if (ret == 0)
+            ret = (rename(tmp, path) != 0);
+
+        if (ret)
+            unlink(tmp);
+    }
+
+    free(buf);
+
+    return ret;
+}
+
+/* bring the machine just powered on to the point reached after frames */
+/* played with movie (NULL = no input). the state is cached under the  */
+/* save folder, so only the first run of a checkpoint emulates it.     */
+/* an open movie goes on playing from there                            */
+char bootcache_reach(char *movie, uint32_t frames)
+{
+    char path[1024];
+    uint32_t i;
+
+    if (bootcache_path(path, sizeof(path), movie, frames))
+        return 1;
+
+    if (movie && movie_play(movie))
+        return 1;
+
+    if (bootcache_load(path) == 0)
+    {
+        utils_log("Boot cache hit, %u frames restored from %s\n", 
+                  frames, path);
+
+        /* joypad and next event as they were at that point */
+        movie_sync();
+
+        return 0;
+    }
+
+    for (i = 0; i < frames; i++)
+        gameboy_run_frame();
+
+    if (bootcache_store(path))
+        utils_log_error("Cannot write boot cache %s\n", path);
+    else
+        utils_log("Boot cache of %u frames stored into %s\n", frames, path);
+
+    return 0;
+}
@@ -25,12 +25,17 @@
 #include <sys/stat.h>
 
 #include "global.h"
+#include "gpu.h"
+#include "idle.h"
 #include "mmu.h"
 #include "utils.h"
 
 /* buffer big enough to contain the largest possible ROM */
 uint8_t rom[2 << 24];
 
+/* bytes of the loaded ROM */
+size_t rom_sz = 0;
+
 /* battery backed RAM & RTC*/
 char file_sav[1024];
 char file_rtc[1024];
@@ -61,6 +66,8 @@ char cartridge_load(char *file_gb)
     if (sz < 1) 
         return 1;
 
+    rom_sz = sz;
+
     /* close */
     fclose(fp);
  
@@ -76,6 +83,10 @@ char cartridge_load(char *file_gb)
         global_cgb = 0;
     }
 
+    /* hot paths without the branches of the other model */
+    mmu_set_model(global_cgb);
+    gpu_set_model(global_cgb);
+
     /* get cartridge infos */
     uint8_t mbc = rom[0x147];
 
@@ -106,7 +117,7 @@ char cartridge_load(char *file_gb)
                    utils_log("MBC5 + RUMBLE + RAM + BATTERY\n"); 
                    break;
 
-        default: utils_log("Unknown cartridge type: %02x\n", mbc);
+        default: utils_log_error("Unknown cartridge type: %02x\n", mbc);
                  return 2;
     }
 
@@ -180,21 +191,43 @@ char cartridge_load(char *file_gb)
     snprintf(file_rtc, sizeof(file_rtc), "%s/%s.rtc", 
                                          global_save_folder, global_rom_name);
 
-    /* restore saved RAM if it's the case */
-    mmu_restore_ram(file_sav);
+    /* deterministic runs always start with a blank battery */
+    if (!global_deterministic)
+    {
+        /* restore saved RAM if it's the case */
+        mmu_restore_ram(file_sav);
 
-    /* restore saved RTC if it's the case */
-    mmu_restore_rtc(file_rtc);
+        /* restore saved RTC if it's the case */
+        mmu_restore_rtc(file_rtc);
+    }
 
     /* load FULL ROM at 0x0000 address of system memory */
     mmu_load_cartridge(rom, sz);
 
+    /* busy waits the CPU can skip */
+    idle_analyze(rom, sz);
+
     return 0; 
 }
 
-void cartridge_term()
+/* save persistent data (battery backed RAM and RTC clock) */
+void cartridge_save()
 {
-    /* save persistent data (battery backed RAM and RTC clock) */
+    /* don't let deterministic runs overwrite real saves */
+    if (global_deterministic)
+        return;
+
     mmu_save_ram(file_sav);
     mmu_save_rtc(file_rtc);
 }
+
+/* identity of the loaded ROM content, whatever its file name */
+uint64_t cartridge_hash()
+{
+    return utils_hash64(rom, rom_sz, UTILS_HASH64_INIT);
+}
+
+void cartridge_term()
+{
+    cartridge_save();
+}
@@ -23,7 +23,9 @@
 #include <stdint.h>
 
 /* prototypes */
+uint64_t cartridge_hash();
 char cartridge_load(char *file_nm);
+void cartridge_save();
 void cartridge_term();
 
 #endif
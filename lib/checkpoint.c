@@ -0,0 +1,160 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "utils.h"
+
+/* hashing output */
+char              checkpoint_on = 0;
+
+/* comparing against a reference instead of recording */
+char              checkpoint_compare = 0;
+
+/* log being written or reference being read */
+FILE             *checkpoint_fp = NULL;
+
+/* hashes of the running frame */
+checkpoint_rec_t  checkpoint_cur;
+
+/* frames checked so far and first diverging one (-1 if none) */
+int64_t           checkpoint_frames = 0;
+int64_t           checkpoint_diverged = -1;
+
+/* hash all the output of a drawn frame */
+void checkpoint_video(uint16_t *fb)
+{
+    checkpoint_cur.video = utils_hash64(fb, 160 * 144 * sizeof(uint16_t),
+                                        UTILS_HASH64_INIT);
+}
+
+/* chain a stereo sample into the hash of the frame */
+void checkpoint_audio(int16_t l, int16_t r)
+{
+    int16_t s[2] = { l, r };
+
+    checkpoint_cur.audio = utils_hash64(s, sizeof(s), checkpoint_cur.audio);
+}
+
+/* frame completed, write or check its hashes */
+void checkpoint_frame()
+{
+    checkpoint_rec_t ref;
+
+    if (!checkpoint_compare)
+        fwrite(&checkpoint_cur, sizeof(checkpoint_rec_t), 1, checkpoint_fp);
+    else if (checkpoint_diverged == -1)
+    {
+        /* reference is over, nothing more to compare */
+        if (fread(&ref, sizeof(checkpoint_rec_t), 1, checkpoint_fp) != 1)
+        {
+            checkpoint_on = 0;
+            return;
+        }
+
+        if (ref.video != checkpoint_cur.video || 
+            ref.audio != checkpoint_cur.audio)
+        {
+            checkpoint_diverged = checkpoint_frames;
+
+            utils_log_error("Checkpoint: frame %lld diverges (%s%s%s)\n",
+                            (long long) checkpoint_frames, 
+                            ref.video != checkpoint_cur.video ? "video" : "",
+                            ref.video != checkpoint_cur.video &&
+                            ref.audio != checkpoint_cur.audio ? ", " : "",
+                            ref.audio != checkpoint_cur.audio ? "audio" : "");
+        }
+    }
+
+    checkpoint_frames++;
+
+    checkpoint_cur.video = 0;
+    checkpoint_cur.audio = UTILS_HASH64_INIT;
+}
+
+/* record hashes into fn, or compare them with fn contents */
+char checkpoint_start(char *fn, char compare)
+{
+    char magic[8];
+
+    checkpoint_fp = fopen(fn, compare ? "r" : "w");
+
+    if (checkpoint_fp == NULL)
+    {
+        utils_log_error("Cannot open checkpoint file %s\n", fn);
+        return 1;
+    }
+
+    if (compare)
+    {
+        if (fread(magic, 1, sizeof(magic), checkpoint_fp) != sizeof(magic) ||
+            memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)))
+        {
+            utils_log_error("%s is not a checkpoint file\n", fn);
+            fclose(checkpoint_fp);
+            checkpoint_fp = NULL;
+            return 1;
+        }
+    }
+    else
+        fwrite(CHECKPOINT_MAGIC, 1, 8, checkpoint_fp);
+
+    checkpoint_compare = compare;
+    checkpoint_frames = 0;
+    checkpoint_diverged = -1;
+    checkpoint_cur.video = 0;
+    checkpoint_cur.audio = UTILS_HASH64_INIT;
+
+    checkpoint_on = 1;
+
+    return 0;
+}
+
+/* the run goes on from frame n of the reference (resumed state), */
+/* compare mode only                                              */
+char checkpoint_seek(int64_t n)
+{
+    if (!checkpoint_compare || checkpoint_fp == NULL)
+        return 1;
+
+    if (fseek(checkpoint_fp, sizeof(checkpoint_rec_t) * n, SEEK_CUR))
+        return 1;
+
+    checkpoint_frames = n;
+
+    return 0;
+}
+
+void checkpoint_stop()
+{
+    if (checkpoint_fp == NULL)
+        return;
+
+    checkpoint_on = 0;
+
+    if (checkpoint_compare && checkpoint_diverged == -1)
+        utils_log("Checkpoint: %lld frames identical\n", 
+                  (long long) checkpoint_frames);
+
+    fclose(checkpoint_fp);
+    checkpoint_fp = NULL;
+}
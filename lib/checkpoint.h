@@ -0,0 +1,50 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __CHECKPOINT_HDR__
+#define __CHECKPOINT_HDR__
+
+#include <stdint.h>
+
+/* file layout: magic, then one record per frame */
+#define CHECKPOINT_MAGIC "PIZZACK1"
+
+typedef struct checkpoint_rec_s
+{
+    /* hash of the frame lines before LCD blending, 0 if not drawn */
+    uint64_t video;
+
+    /* hash of the samples pushed during the frame */
+    uint64_t audio;
+
+} checkpoint_rec_t;
+
+/* hashing output - checked at every frame and sample */
+extern char checkpoint_on;
+
+/* prototypes */
+void checkpoint_audio(int16_t l, int16_t r);
+void checkpoint_frame();
+char checkpoint_seek(int64_t n);
+char checkpoint_start(char *fn, char compare);
+void checkpoint_stop();
+void checkpoint_video(uint16_t *fb);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cputrace.h"
+#include "utils.h"
+
+/* trace is open */
+char               cputrace_on = 0;
+
+/* mapped file */
+cputrace_header_t *cputrace_hdr = NULL;
+cputrace_record_t *cputrace_ring = NULL;
+size_t             cputrace_sz = 0;
+
+/* open (or create) a trace file of given records qty, 0 = default */
+char cputrace_start(char *fn, uint32_t records)
+{
+    void *p;
+    int fd;
+
+    if (cputrace_on)
+        return 1;
+
+    if (records == 0)
+        records = CPUTRACE_RECORDS;
+
+    /* ring index is masked, round down to a power of 2 */
+    while (records & (records - 1))
+        records &= records - 1;
+
+    cputrace_sz = sizeof(cputrace_header_t) + 
+                  (size_t) records * sizeof(cputrace_record_t);
+
+    fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1)
+    {
+        utils_log_error("Cannot open CPU trace %s\n", fn);
+        return 1;
+    }
+
+    if (ftruncate(fd, cputrace_sz))
+    {
+        utils_log_error("Cannot size CPU trace %s\n", fn);
+        close(fd);
+        return 1;
+    }
+
+    p = mmap(NULL, cputrace_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    /* mapping keeps the file alive */
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+        utils_log_error("Cannot map CPU trace %s\n", fn);
+        return 1;
+    }
+
+    cputrace_hdr = p;
+    cputrace_ring = (cputrace_record_t *) (cputrace_hdr + 1);
+
+    memcpy(cputrace_hdr->magic, CPUTRACE_MAGIC, 8);
+    cputrace_hdr->record_sz = sizeof(cputrace_record_t);
+    cputrace_hdr->records = records;
+    cputrace_hdr->head = 0;
+
+    cputrace_on = 1;
+
+    return 0;
+}
+
+/* unmap, kernel writes back what's left */
+void cputrace_stop()
+{
+    if (!cputrace_on)
+        return;
+
+    cputrace_on = 0;
+
+    munmap(cputrace_hdr, cputrace_sz);
+
+    cputrace_hdr = NULL;
+    cputrace_ring = NULL;
+}
@@ -0,0 +1,98 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __CPUTRACE_HDR__
+#define __CPUTRACE_HDR__
+
+#include <stdint.h>
+
+/* binary CPU trace, a memory mapped file made of a header and a ring  */
+/* of fixed size records. once full, oldest records get overwritten    */
+
+#define CPUTRACE_MAGIC "PIZZACT1"
+
+/* default ring size (records), must be a power of 2 */
+#define CPUTRACE_RECORDS (1 << 20)
+
+typedef struct cputrace_header_s
+{
+    char     magic[8];
+    uint32_t record_sz;
+    uint32_t records;
+
+    /* records written so far, next one goes at head % records */
+    uint64_t head;
+
+    uint8_t  spare[40];
+
+} cputrace_header_t;
+
+/* CPU state before executing the instruction at pc */
+typedef struct cputrace_record_s
+{
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t  a;
+    uint8_t  f;
+    uint8_t  b;
+    uint8_t  c;
+    uint8_t  d;
+    uint8_t  e;
+    uint8_t  h;
+    uint8_t  l;
+
+    /* opcode and the 3 bytes after it */
+    uint8_t  mem[4];
+
+    /* interrupts master enable, IE and IF registers */
+    uint8_t  ime;
+    uint8_t  ie;
+    uint8_t  iflag;
+
+    /* ROM bank mapped at 4000-7FFF */
+    uint8_t  bank;
+
+    uint8_t  spare[4];
+
+} cputrace_record_t;
+
+/* trace is open - checked every instruction */
+extern char cputrace_on;
+
+extern cputrace_header_t *cputrace_hdr;
+extern cputrace_record_t *cputrace_ring;
+
+/* slot for next record, fill it then call cputrace_commit() */
+static inline cputrace_record_t *cputrace_next()
+{
+    return &cputrace_ring[cputrace_hdr->head & (cputrace_hdr->records - 1)];
+}
+
+static inline void cputrace_commit()
+{
+    cputrace_hdr->head++;
+}
+
+/* prototypes */
+char cputrace_start(char *fn, uint32_t records);
+void cputrace_stop();
+
+#endif
@@ -28,6 +28,8 @@
 #include "mmu.h"
 #include "serial.h"
 #include "sound.h"
+#include "stats.h"
+#include "trace.h"
 #include "timer.h"
 #include "interrupt.h"
 #include "utils.h"
@@ -146,6 +148,8 @@ void cycles_closest_next()
 /* this function is gonna be called every M-cycle = 4 ticks of CPU */
 void cycles_step()
 {
+    STATS_SCOPE(STATS_SCOPE_CYCLES_STEP);
+
     cycles.cnt += 4;
 
 /*
@@ -191,15 +195,24 @@ void cycles_step()
     /* 65536 == cpu clock / CYCLES_PAUSES pauses every second */
     if (cycles.cnt == cycles.next) 
     {
-        deadline.tv_nsec += 1000000000 / CYCLES_PAUSES;
-
-        if (deadline.tv_nsec > 1000000000)
+        /* run as fast as possible (run-ahead hidden frames)? */
+        if (!global_uncapped)
         {
-            deadline.tv_sec += 1;
-            deadline.tv_nsec -= 1000000000;
-        }
+            deadline.tv_nsec += 1000000000 / CYCLES_PAUSES;
+
+            if (deadline.tv_nsec > 1000000000)
+            {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            uint64_t slept = trace_on ? trace_ns() : 0;
 
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+            if (trace_on)
+                trace_span(TRACE_SLEEP, slept, 0);
+        }
         
         cycles.next += cycles.step;
 
@@ -346,6 +359,9 @@ void cycles_hdma()
                 /* decrease bytes to transfer */
                 mmu.hdma_to_transfer -= 0x10;
 
+                STATS_ADD(STATS_CNT_HDMA_BYTES, 0x10);
+                TRACE(TRACE_HDMA, TRACE_HDMA_HBLANK | 0x10);
+
                 /* increase pointers */
                 mmu.hdma_dst_address += 0x10;
                 mmu.hdma_src_address += 0x10;
@@ -394,16 +410,16 @@ void cycles_term()
 {
 }
 
-void cycles_save_stat(FILE *fp)
+void cycles_serialize_stat(utils_stat_t *s)
 {
-    fwrite(&cycles, 1, sizeof(cycles_t), fp);
-}
-
-void cycles_restore_stat(FILE *fp)
-{
-    fread(&cycles, 1, sizeof(cycles_t), fp);
+    UTILS_STAT64(s, cycles.cnt);
+    UTILS_STAT64(s, cycles.clock);
+    UTILS_STAT64(s, cycles.next);
+    UTILS_STAT64(s, cycles.seconds);
+    UTILS_STAT64(s, cycles.hs_next);
 
     /* recalc speed stuff */
-    cycles_change_emulation_speed();
+    if (s->restore)
+        cycles_change_emulation_speed();
 }
 
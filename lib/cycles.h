@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "utils.h"
+
 typedef struct cycles_s
 {
     /* am i init'ed? */
@@ -53,6 +55,9 @@ typedef struct cycles_s
 
 extern cycles_t cycles;
 
+/* hard sync mode with a remote peer */
+extern uint8_t  cycles_hs_mode;
+
 // extern uint8_t  cycles_hs_local_cnt;
 // extern uint8_t  cycles_hs_peer_cnt;
 
@@ -63,8 +68,7 @@ typedef void (*cycles_send_cb_t) (uint32_t v);
 void cycles_change_emulation_speed();
 void cycles_hdma();
 char cycles_init();
-void cycles_restore_stat(FILE *fp);
-void cycles_save_stat(FILE *fp);
+void cycles_serialize_stat(utils_stat_t *s);
 void cycles_set_speed(char dbl);
 void cycles_start_hs();
 char cycles_start_timer();
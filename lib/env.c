@@ -0,0 +1,445 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cartridge.h"
+#include "env.h"
+#include "gameboy.h"
+#include "global.h"
+#include "gpu.h"
+#include "input.h"
+#include "mmu.h"
+#include "output.h"
+#include "persist.h"
+#include "snapshot.h"
+#include "sound.h"
+#include "utils.h"
+#include "watch.h"
+
+/* the machine is global, so every instance is a worker process. */
+/* workers are forked once and driven through shared memory      */
+
+/* seconds to wait a worker before checking it's still alive */
+#define ENV_WAIT_SECS 1
+
+enum {
+    ENV_CMD_STEP,
+    ENV_CMD_RESET,
+    ENV_CMD_QUIT
+};
+
+struct env_ctrl_s
+{
+    sem_t    go;
+    sem_t    done;
+
+    uint8_t  cmd;
+    uint8_t  action;
+
+    /* worker could not start */
+    uint8_t  failed;
+
+};
+
+/* compiled reward and done expressions, NULL if not used */
+watch_t  env_reward_watch;
+watch_t  env_done_watch;
+watch_t *env_reward = NULL;
+watch_t *env_done = NULL;
+
+/* nothing to present */
+void env_frame_cb() {}
+
+/* observations of instance i */
+void env_observe(env_t *e, int i)
+{
+    uint8_t *ram = &e->ram[i * ENV_RAM_SZ];
+    int j;
+
+    /* gray frames are written by the GPU while drawing */
+    if (e->obs)
+        memcpy(&e->obs[i * ENV_OBS_SZ], gpu.frame_buffer, 
+               ENV_OBS_SZ * sizeof(uint16_t));
+
+    for (j = 0; j < 0x2000; j++)
+        ram[j] = mmu_read_no_cyc(0xC000 + j);
+
+    for (j = 0; j < 0x7F; j++)
+        ram[0x2000 + j] = mmu_read_no_cyc(0xFF80 + j);
+}
+
+/* export again the whole frame in the gray observation */
+void env_output_frame()
+{
+    uint8_t y;
+
+    if (output_on)
+        for (y = 0; y < 144; y++)
+            output_line(y);
+}
+
+/* take current values as base of the next deltas */
+void env_watch_prime()
+{
+    if (env_reward)
+    {
+        watch_reset(env_reward);
+        watch_eval(env_reward);
+    }
+
+    if (env_done)
+    {
+        watch_reset(env_done);
+        watch_eval(env_done);
+    }
+}
+
+/* back to the state right after power on */
+void env_restore()
+{
+    snapshot_restore(0);
+
+    env_output_frame();
+    env_watch_prime();
+
+    input_set_state(0);
+}
+
+char env_worker_init(env_t *e, env_config_t *cfg, int i)
+{
+    global_init();
+    global_deterministic = 1;
+    global_seed = cfg->seed + i;
+    global_uncapped = 1;
+    global_skip_audio = 1;
+
+    if (cartridge_load(cfg->rom))
+        return 1;
+
+    gameboy_init();
+    gpu_init(&env_frame_cb);
+    sound_set_output_rate(44100);
+
+    /* gray observations only: lines are drawn as luma, no RGB at all */
+    if (e->gray)
+    {
+        gpu_blend = 0;
+
+        if (gpu_set_luma(1))
+            return 1;
+
+        if (output_set_gray(&e->gray[i * e->gray_sz], 
+                            cfg->gray_w, cfg->gray_h, 0))
+            return 1;
+    }
+
+    /* initial state, restored by ENV_CMD_RESET */
+    return snapshot_save(0);
+}
+
+void env_worker(env_t *e, env_config_t *cfg, int i)
+{
+    env_ctrl_t *c = &e->ctrl[i];
+    uint32_t f;
+
+    if (env_worker_init(e, cfg, i))
+        c->failed = 1;
+    else
+    {
+        env_output_frame();
+        env_watch_prime();
+        env_observe(e, i);
+    }
+
+    sem_post(&c->done);
+
+    if (c->failed)
+        _exit(1);
+
+    while (1)
+    {
+        while (sem_wait(&c->go) && errno == EINTR);
+
+        switch (c->cmd)
+        {
+            case ENV_CMD_STEP:
+
+                input_set_state(c->action);
+
+                /* only the last frame is observed, it's blended with */
+                /* the previous one so draw both                      */
+                for (f = 1; f <= cfg->frameskip; f++)
+                {
+                    if (f == cfg->frameskip)
+                        global_skip_video = GLOBAL_SKIP_VIDEO_NONE;
+                    else if (f == cfg->frameskip - 1 && gpu_blend)
+                        global_skip_video = GLOBAL_SKIP_VIDEO_PRESENT;
+                    else
+                        global_skip_video = GLOBAL_SKIP_VIDEO_ALL;
+
+                    gameboy_run_frame();
+                }
+
+                e->dones[i] = 0;
+                e->rewards[i] = cfg->reward_cb ? 
+                    cfg->reward_cb(i, mmu_addr(0x0000), &e->dones[i]) : 0;
+
+                if (env_reward)
+                    e->rewards[i] = watch_eval(env_reward);
+
+                if (env_done && watch_eval(env_done))
+                    e->dones[i] = 1;
+
+                break;
+
+            case ENV_CMD_RESET:
+
+                env_restore();
+
+                e->rewards[i] = 0;
+                e->dones[i] = 0;
+
+                break;
+
+            case ENV_CMD_QUIT:
+
+                persist_term();
+                utils_log_stop();
+                _exit(0);
+        }
+
+        env_observe(e, i);
+
+        sem_post(&c->done);
+    }
+}
+
+/* wait for worker i, 1 if it died */
+char env_wait(env_t *e, int i)
+{
+    struct timespec ts;
+
+    while (1)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ENV_WAIT_SECS;
+
+        if (sem_timedwait(&e->ctrl[i].done, &ts) == 0)
+            return 0;
+
+        if (errno == ETIMEDOUT && waitpid(e->pids[i], NULL, WNOHANG) != 0)
+        {
+            utils_log_error("Environment worker %d died\n", i);
+            e->pids[i] = 0;
+            return 1;
+        }
+    }
+}
+
+/* start n instances of cfg->rom, every one in its own worker */
+env_t *env_create(int n, env_config_t *cfg)
+{
+    env_t *e;
+    uint8_t *p;
+    char err = 0;
+    int i;
+
+    if (n < 1 || cfg->rom == NULL)
+        return NULL;
+
+    /* compiled once, workers inherit them */
+    env_reward = NULL;
+    env_done = NULL;
+
+    if (cfg->reward_expr)
+    {
+        if (watch_compile(&env_reward_watch, cfg->reward_expr))
+            return NULL;
+
+        env_reward = &env_reward_watch;
+    }
+
+    if (cfg->done_expr)
+    {
+        if (watch_compile(&env_done_watch, cfg->done_expr))
+            return NULL;
+
+        env_done = &env_done_watch;
+    }
+
+    e = calloc(1, sizeof(env_t));
+
+    if (e == NULL)
+        return NULL;
+
+    e->n = n;
+    e->pids = calloc(n, sizeof(pid_t));
+
+    if (cfg->gray_w)
+        e->gray_sz = cfg->gray_w * cfg->gray_h;
+
+    /* control blocks, then arrays */
+    e->shm_sz = n * (sizeof(env_ctrl_t) + 
+                     (e->gray_sz ? e->gray_sz : ENV_OBS_SZ * sizeof(uint16_t)) +
+                     ENV_RAM_SZ + sizeof(float) + sizeof(uint8_t));
+
+    e->shm = mmap(NULL, e->shm_sz, PROT_READ | PROT_WRITE, 
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (e->pids == NULL || e->shm == MAP_FAILED)
+    {
+        free(e->pids);
+        free(e);
+        return NULL;
+    }
+
+    p = e->shm;
+    e->ctrl = (env_ctrl_t *) p;
+    p += n * sizeof(env_ctrl_t);
+    e->rewards = (float *) p;
+    p += n * sizeof(float);
+
+    if (e->gray_sz)
+    {
+        e->gray = p;
+        p += n * e->gray_sz;
+    }
+    else
+    {
+        e->obs = (uint16_t *) p;
+        p += n * ENV_OBS_SZ * sizeof(uint16_t);
+    }
+    e->ram = p;
+    p += n * ENV_RAM_SZ;
+    e->dones = p;
+
+    if (cfg->frameskip == 0)
+        cfg->frameskip = 1;
+
+    for (i = 0; i < n; i++)
+    {
+        sem_init(&e->ctrl[i].go, 1, 0);
+        sem_init(&e->ctrl[i].done, 1, 0);
+
+        e->pids[i] = fork();
+
+        if (e->pids[i] == 0)
+            env_worker(e, cfg, i);
+
+        if (e->pids[i] < 0)
+        {
+            e->pids[i] = 0;
+            err = 1;
+            break;
+        }
+    }
+
+    /* every worker is ready with its first observation */
+    for (i = 0; i < n && !err; i++)
+        if (env_wait(e, i) || e->ctrl[i].failed)
+            err = 1;
+
+    if (err)
+    {
+        utils_log_error("Cannot start %d environments of %s\n", n, cfg->rom);
+        env_destroy(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+/* restart the episode of instance i */
+char env_reset(env_t *e, int i)
+{
+    if (i < 0 || i >= e->n || e->pids[i] == 0)
+        return 1;
+
+    e->ctrl[i].cmd = ENV_CMD_RESET;
+    sem_post(&e->ctrl[i].go);
+
+    return env_wait(e, i);
+}
+
+/* advance every instance by frameskip frames holding the keys of */
+/* actions[i] (1 << INPUT_KEY_*), all the instances run in parallel */
+char env_step(env_t *e, uint8_t *actions)
+{
+    char err = 0;
+    int i;
+
+    for (i = 0; i < e->n; i++)
+    {
+        if (e->pids[i] == 0)
+        {
+            err = 1;
+            continue;
+        }
+
+        e->ctrl[i].cmd = ENV_CMD_STEP;
+        e->ctrl[i].action = actions[i];
+        sem_post(&e->ctrl[i].go);
+    }
+
+    for (i = 0; i < e->n; i++)
+        if (e->pids[i] && env_wait(e, i))
+            err = 1;
+
+    return err;
+}
+
+void env_destroy(env_t *e)
+{
+    int i;
+
+    if (e == NULL)
+        return;
+
+    for (i = 0; i < e->n; i++)
+    {
+        if (e->pids[i] <= 0)
+            continue;
+
+        e->ctrl[i].cmd = ENV_CMD_QUIT;
+        sem_post(&e->ctrl[i].go);
+
+        waitpid(e->pids[i], NULL, 0);
+    }
+
+    for (i = 0; i < e->n; i++)
+    {
+        sem_destroy(&e->ctrl[i].go);
+        sem_destroy(&e->ctrl[i].done);
+    }
+
+    munmap(e->shm, e->shm_sz);
+    free(e->pids);
+    free(e);
+}
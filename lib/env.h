@@ -0,0 +1,93 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __ENV_HDR__
+#define __ENV_HDR__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* observations of every instance */
+#define ENV_OBS_W   160
+#define ENV_OBS_H   144
+#define ENV_OBS_SZ  (ENV_OBS_W * ENV_OBS_H)
+
+/* RAM observation: 0xC000 - 0xDFFF work RAM, 0xFF80 - 0xFFFE high RAM */
+#define ENV_RAM_SZ  (0x2000 + 0x7F)
+
+/* reward of instance i after a step, computed by its worker on the 64 kB */
+/* memory map. set *done to end the episode (env_reset() to restart it)   */
+typedef float (*env_reward_cb_t) (int i, uint8_t *mem, uint8_t *done);
+
+typedef struct env_config_s
+{
+    char           *rom;
+
+    /* frames run by every step with the same action */
+    uint32_t        frameskip;
+
+    /* can be NULL, rewards are 0 then */
+    env_reward_cb_t reward_cb;
+
+    /* watch expressions (see watch.h) evaluated after every step, they */
+    /* override the callback. d() are changes since the previous step   */
+    char           *reward_expr;
+    char           *done_expr;
+
+    /* seed of instance i is seed + i */
+    uint32_t        seed;
+
+    /* 0 for 160x144 RGB565 frames into obs, else w x h 8 bit gray frames */
+    /* (84x84, 80x72...) into gray, drawn as luma without LCD blending    */
+    uint32_t        gray_w;
+    uint32_t        gray_h;
+
+} env_config_t;
+
+/* per instance control block, shared with the worker */
+typedef struct env_ctrl_s env_ctrl_t;
+
+typedef struct env_s
+{
+    int          n;
+
+    /* contiguous arrays of n elements, updated by env_step/env_reset */
+    uint16_t    *obs;           /* n * ENV_OBS_SZ RGB565 pixels */
+    uint8_t     *gray;          /* n * gray_sz luma pixels      */
+    uint32_t     gray_sz;
+    uint8_t     *ram;           /* n * ENV_RAM_SZ bytes          */
+    float       *rewards;
+    uint8_t     *dones;
+
+    /* private */
+    env_ctrl_t  *ctrl;
+    pid_t       *pids;
+    void        *shm;
+    size_t       shm_sz;
+
+} env_t;
+
+/* prototypes */
+env_t *env_create(int n, env_config_t *cfg);
+void   env_destroy(env_t *e);
+char   env_reset(env_t *e, int i);
+char   env_step(env_t *e, uint8_t *actions);
+
+#endif
@@ -17,22 +17,35 @@
 
 */
 
+#include <pthread.h>
 #include <semaphore.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
 #include "cartridge.h"
+#include "checkpoint.h"
+#include "cputrace.h"
 #include "sound.h"
 #include "mmu.h"
 #include "cycles.h"
+#include "gameboy.h"
 #include "gpu.h"
 #include "global.h"
+#include "idle.h"
 #include "input.h"
 #include "timer.h"
+#include "movie.h"
+#include "persist.h"
+#include "profile.h"
+#include "rewind.h"
 #include "serial.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
+#include "watch.h"
 #include "z80_gameboy_regs.h"
 #include "z80_gameboy.h"
 
@@ -41,6 +54,35 @@ sem_t gameboy_sem;
 
 char gameboy_inited = 0;
 
+/* commands queue, size must be a power of 2 */
+#define GAMEBOY_CMD_QUEUE_SZ 64
+
+utils_queue_t   gameboy_cmd_queue;
+
+/* completion of commands */
+pthread_cond_t  gameboy_cmd_cond;
+pthread_mutex_t gameboy_cmd_mutex;
+size_t          gameboy_cmd_done = 0;
+
+/* last frame handled by gameboy_frame_end */
+uint_fast16_t   gameboy_last_frame = 0;
+
+/* frames since last battery backed RAM flush */
+uint32_t        gameboy_battery_frames = 0;
+
+/* rewind key is held */
+char            gameboy_rewinding = 0;
+
+/* run-ahead frames and the snapshot to come back from them */
+uint8_t         gameboy_runahead = 0;
+uint8_t        *gameboy_runahead_buf = NULL;
+size_t          gameboy_runahead_sz = 0;
+
+/* internal prototypes */
+void gameboy_runahead_video();
+void gameboy_set_defaults();
+char gameboy_set_runahead(uint8_t frames);
+
 
 void gameboy_init()
 {
@@ -50,6 +92,9 @@ void gameboy_init()
     /* init z80 */
     z80_init(); 
 
+    /* power on at normal speed */
+    global_cpu_double_speed = 0;
+
     /* init cycles syncronizer */
     cycles_init();
 
@@ -69,6 +114,39 @@ void gameboy_init()
     gpu_reset();
 
     /* reset to default values */
+    gameboy_set_defaults();
+
+    /* init semaphore for pauses */
+    sem_init(&gameboy_sem, 0, 0);
+
+    /* init commands queue */
+    if (!gameboy_inited)
+    {
+        utils_queue_init(&gameboy_cmd_queue, sizeof(gameboy_cmd_t),
+                         GAMEBOY_CMD_QUEUE_SZ);
+
+        pthread_mutex_init(&gameboy_cmd_mutex, NULL);
+        pthread_cond_init(&gameboy_cmd_cond, NULL);
+    }
+
+    /* files are written by a dedicated thread */
+    persist_init();
+
+    /* and so are log messages */
+    utils_log_start();
+
+    /* start instrumentation from scratch (if compiled in) */
+    STATS_RESET();
+
+    /* mark as inited */
+    gameboy_inited = 1;
+
+    return;
+} 
+
+/* registers values after boot ROM */
+void gameboy_set_defaults()
+{
     mmu_write_no_cyc(0xFF05, 0x00);
     mmu_write_no_cyc(0xFF06, 0x00); 
     mmu_write_no_cyc(0xFF07, 0x00);
@@ -119,16 +197,168 @@ void gameboy_init()
     state.l = 0x4d;
     state.pc = 0x0100;
     state.sp = 0xFFFE;
+    state.int_enable = 0;
     *state.f = 0xB0;
+}
 
-    /* init semaphore for pauses */
-    sem_init(&gameboy_sem, 0, 0);
+/* power cycle, keeping cartridge and battery backed RAM */
+void gameboy_reset()
+{
+    mmu_reset();
+    idle_reset();
 
-    /* mark as inited */
-    gameboy_inited = 1;
+    /* back to normal speed */
+    global_cpu_double_speed = 0;
 
-    return;
-} 
+    cycles_init();
+    cycles_change_emulation_speed();
+    timer_reset();
+    sound_reset();
+    gpu_reset();
+    gpu_set_speed(0);
+
+    gameboy_set_defaults();
+}
+
+/* execute a single command, running on emulation thread */
+char gameboy_cmd_exec(gameboy_cmd_t *cmd)
+{
+    char ret;
+
+    switch (cmd->type)
+    {
+        case GAMEBOY_CMD_SAVE_STAT:
+            return gameboy_save_stat(cmd->arg1);
+
+        case GAMEBOY_CMD_RESTORE_STAT:
+            ret = gameboy_restore_stat(cmd->arg1);
+            cycles_start_timer();
+
+            /* older snapshots don't belong to this timeline anymore */
+            rewind_reset();
+            movie_sync();
+            return ret;
+
+        case GAMEBOY_CMD_RESET:
+            gameboy_reset();
+            cycles_start_timer();
+            rewind_reset();
+            movie_sync();
+            return 0;
+
+        case GAMEBOY_CMD_REWIND:
+            gameboy_rewinding = cmd->arg1;
+            return 0;
+
+        case GAMEBOY_CMD_RUNAHEAD:
+            return gameboy_set_runahead(cmd->arg1);
+
+        case GAMEBOY_CMD_INPUT:
+
+            /* joypad belongs to the movie while playing */
+            if (movie_mode == MOVIE_MODE_PLAY)
+                return 1;
+
+            input_set_key(cmd->arg1, cmd->arg2);
+            movie_input();
+            return 0;
+
+        case GAMEBOY_CMD_SPEED:
+            global_emulation_speed = cmd->arg1;
+            cycles_change_emulation_speed();
+            sound_change_emulation_speed();
+            gpu_change_emulation_speed();
+            return 0;
+    }
+
+    return 1;
+}
+
+/* run every queued command and notify who's waiting for them */
+void gameboy_cmd_drain()
+{
+    gameboy_cmd_t cmd;
+    char ret;
+
+    while (utils_queue_pop(&gameboy_cmd_queue, &cmd) == 0)
+    {
+        ret = gameboy_cmd_exec(&cmd);
+
+        pthread_mutex_lock(&gameboy_cmd_mutex);
+
+        /* a waiter gives up when quitting, its result is gone */
+        if (cmd.result && !global_quit)
+            *cmd.result = ret;
+
+        gameboy_cmd_done++;
+
+        pthread_cond_broadcast(&gameboy_cmd_cond);
+        pthread_mutex_unlock(&gameboy_cmd_mutex);
+    }
+}
+
+/* enqueue a command, its result is stored into *result (can be NULL)  */
+/* once executed. return a ticket to wait for it, 0 if queue is full    */
+size_t gameboy_cmd_push_result(uint8_t type, int arg1, int arg2, 
+                               char *result)
+{
+    gameboy_cmd_t cmd;
+    size_t pos;
+
+    if (!gameboy_inited)
+        return 0;
+
+    cmd.type = type;
+    cmd.arg1 = arg1;
+    cmd.arg2 = arg2;
+    cmd.result = result;
+
+    if (utils_queue_push(&gameboy_cmd_queue, &cmd, &pos))
+        return 0;
+
+    /* emulation thread could be sleeping into pause */
+    if (__atomic_load_n(&global_pause, __ATOMIC_SEQ_CST))
+        sem_post(&gameboy_sem);
+
+    return pos + 1;
+}
+
+/* enqueue a command nobody waits the result of */
+size_t gameboy_cmd_push(uint8_t type, int arg1, int arg2)
+{
+    return gameboy_cmd_push_result(type, arg1, arg2, NULL);
+}
+
+/* wait for a command to be executed - 1 if it never will */
+char gameboy_cmd_wait(size_t ticket)
+{
+    char ret;
+
+    if (ticket == 0)
+        return 1;
+
+    pthread_mutex_lock(&gameboy_cmd_mutex);
+
+    while (gameboy_cmd_done < ticket && !global_quit)
+        pthread_cond_wait(&gameboy_cmd_cond, &gameboy_cmd_mutex);
+
+    ret = (gameboy_cmd_done < ticket);
+
+    pthread_mutex_unlock(&gameboy_cmd_mutex);
+
+    return ret;
+}
+
+/* push a command and wait for its result */
+char gameboy_cmd(uint8_t type, int arg1, int arg2)
+{
+    char result = 1;
+
+    if (gameboy_cmd_wait(gameboy_cmd_push_result(type, arg1, arg2, &result)))
+        return 1;
+
+    return result;
+}
 
 void gameboy_set_pause(char pause)
 {
@@ -138,13 +368,10 @@ void gameboy_set_pause(char pause)
     if (pause == global_pause)
         return;
 
-    global_pause = pause;
+    __atomic_store_n(&global_pause, pause, __ATOMIC_SEQ_CST);
 
     if (pause)
     {
-        /* wait a bit - i need the main cycle fall into global_pause check */
-        usleep(100000);
-
         /* stop timer */
         cycles_stop_timer();
     }
@@ -158,23 +385,364 @@ void gameboy_set_pause(char pause)
     }
 }
 
-void gameboy_run()
+/* run till the end of current frame (or a frame time if LCD is off), */
+/* playing the movie - hidden run-ahead frames keep current input      */
+void gameboy_run_frame()
+{
+    uint_fast16_t frame = gpu.frame_counter;
+    uint_fast32_t start = cycles.cnt;
+    uint_fast32_t horizon = idle_horizon;
+
+    /* skipped busy waits stop at the frame time too */
+    idle_horizon = start + (70224 << global_cpu_double_speed);
+
+    while (gpu.frame_counter == frame && 
+           cycles.cnt - start < (70224 << global_cpu_double_speed))
+    {
+        /* movie input to inject? */
+        if (cycles.cnt >= movie_next && !global_speculative)
+            movie_step();
+
+        gameboy_step();
+    }
+
+    idle_horizon = horizon;
+}
+
+/* video output of the real timeline */
+void gameboy_runahead_video()
+{
+    /* hard sync peer needs the real timeline, no run-ahead there */
+    if (gameboy_runahead == 0 || cycles_hs_mode)
+        global_skip_video = GLOBAL_SKIP_VIDEO_NONE;
+    else if (gameboy_runahead == 1)
+        global_skip_video = GLOBAL_SKIP_VIDEO_PRESENT;
+    else
+        global_skip_video = GLOBAL_SKIP_VIDEO_ALL;
+}
+
+/* run hidden frames with current input, present the last one */
+/* and go back to the real timeline                           */
+void gameboy_run_ahead()
+{
+    char trace = trace_on, profile = profile_on, cputrace = cputrace_on;
+    char checkpoint = checkpoint_on;
+    uint8_t i;
+
+    if (gameboy_save_stat_buf(gameboy_runahead_buf, gameboy_runahead_sz))
+        return;
+
+    global_uncapped = 1;
+    global_skip_audio = 1;
+
+    /* nothing of hidden frames must leave the machine: link cable, */
+    /* rumble and what traces, hashes and counts the execution      */
+    global_speculative = 1;
+    trace_on = 0;
+    checkpoint_on = 0;
+    profile_on = 0;
+    cputrace_on = 0;
+    STATS_MARK();
+
+    for (i = 1; i <= gameboy_runahead && !global_quit; i++)
+    {
+        /* last frame is blended with the previous one, draw both */
+        if (i == gameboy_runahead)
+            global_skip_video = GLOBAL_SKIP_VIDEO_NONE;
+        else if (i == gameboy_runahead - 1)
+            global_skip_video = GLOBAL_SKIP_VIDEO_PRESENT;
+        else
+            global_skip_video = GLOBAL_SKIP_VIDEO_ALL;
+
+        gameboy_run_frame();
+    }
+
+    gameboy_restore_stat_buf(gameboy_runahead_buf, gameboy_runahead_sz);
+
+    STATS_ROLLBACK();
+    cputrace_on = cputrace;
+    profile_on = profile;
+    checkpoint_on = checkpoint;
+    trace_on = trace;
+    global_speculative = 0;
+
+    global_uncapped = 0;
+    global_skip_audio = 0;
+}
+
+/* set how many frames to run ahead, 0 to disable */
+char gameboy_set_runahead(uint8_t frames)
+{
+    if (frames > GAMEBOY_RUNAHEAD_MAX)
+        return 1;
+
+    if (frames && gameboy_runahead_buf == NULL)
+    {
+        gameboy_runahead_sz = gameboy_stat_size();
+        gameboy_runahead_buf = malloc(gameboy_runahead_sz);
+
+        if (gameboy_runahead_buf == NULL)
+            return 1;
+    }
+
+    gameboy_runahead = frames;
+    gameboy_runahead_video();
+
+    return 0;
+}
+
+/* stuff to do between two instructions once a frame is completed */
+void gameboy_frame_end()
+{
+    if (!gameboy_rewinding)
+    {
+        if (checkpoint_on)
+            checkpoint_frame();
+
+        if (watch_on)
+            watch_frame();
+
+        rewind_frame();
+
+        STATS_FRAME();
+
+        /* don't lose too much progress in case of crash */
+        if (++gameboy_battery_frames == GAMEBOY_BATTERY_FLUSH_FRAMES)
+        {
+            gameboy_battery_frames = 0;
+            cartridge_save();
+        }
+
+        if (gameboy_runahead && !cycles_hs_mode)
+            gameboy_run_ahead();
+
+        gameboy_runahead_video();
+
+        gameboy_last_frame = gpu.frame_counter;
+        return;
+    }
+
+    /* step back a snapshot every frame time till rewind is released */
+    while (gameboy_rewinding && !global_quit)
+    {
+        if (rewind_back() == 0)
+            gpu_present_frame();
+
+        usleep(1000000 / 60);
+
+        gameboy_cmd_drain();
+    }
+
+    /* don't try to recover time spent rewinding */
+    cycles_start_timer();
+
+    movie_sync();
+
+    gameboy_last_frame = gpu.frame_counter;
+}
+
+/* dump CPU state before op execution into the binary trace */
+static inline void gameboy_cputrace(uint8_t op, uint64_t cnt)
+{
+    cputrace_record_t *r = cputrace_next();
+
+    r->cycles = cnt;
+    r->pc = state.pc;
+    r->sp = state.sp;
+    r->a = state.a;
+    r->f = *state.f & 0xF0;
+    r->b = state.b;
+    r->c = state.c;
+    r->d = state.d;
+    r->e = state.e;
+    r->h = state.h;
+    r->l = state.l;
+    r->mem[0] = op;
+    r->mem[1] = mmu_read_no_cyc(state.pc + 1);
+    r->mem[2] = mmu_read_no_cyc(state.pc + 2);
+    r->mem[3] = mmu_read_no_cyc(state.pc + 3);
+    r->ime = state.int_enable;
+    r->ie = mmu.memory[0xFFFF];
+    r->iflag = mmu.memory[0xFF0F];
+    r->bank = mmu.rom_current_bank;
+
+    cputrace_commit();
+}
+
+/* instruction at pc, started at cycle cnt, has just been executed */
+void gameboy_idle(uint16_t pc, uint_fast32_t cnt)
+{
+    idle_loop_t *l;
+
+    /* traced and profiled runs want to see every instruction */
+    if (cputrace_on || profile_on || global_debug)
+    {
+        idle_reset();
+        return;
+    }
+
+    if (idle_rec)
+    {
+        if (idle_record(pc, state.pc, state.a, *state.f, 
+                        cycles.cnt - cnt) == 1)
+            state.pc = idle_skip(state.int_enable, &state.a, state.f);
+
+        return;
+    }
+
+    /* back to the start of a known busy wait? */
+    l = idle_lookup(state.pc);
+
+    if (l)
+        idle_record_start(l, state.a, *state.f, 
+                          *state.bc, *state.de, *state.hl);
+}
+
+/* execute a single instruction and handle interrupts */
+void gameboy_step()
 {
     uint8_t op;
 
-    /* reset counter */
-    cycles.cnt = 0;
+    /* interrupt enables and flags */
+    uint8_t *int_e = &mmu.memory[0xFFFF];
+    uint8_t *int_f = &mmu.memory[0xFF0F];
 
-    /* get interrupt flags and interrupt enables */
-    uint8_t *int_e;
-    uint8_t *int_f;
+    /* where this instruction starts, for profiler and CPU trace */
+    uint16_t      prof_pc = state.pc;
+    uint_fast32_t prof_cnt = cycles.cnt;
 
-    /* pointers to memory location of interrupt enables/flags */
-    int_e = mmu_addr(0xFFFF);
-    int_f = mmu_addr(0xFF0F);
+    /* get op */
+    op = mmu_read(state.pc);
 
-    /* start at normal speed */
-    global_cpu_double_speed = 0;
+    /* binary CPU trace is way faster than the text log below */
+    if (cputrace_on)
+        gameboy_cputrace(op, prof_cnt);
+
+    /* print out CPU state if enabled by debug flag */
+    else if (global_debug)
+    {
+        utils_log("OP: %02x F: %02x PC: %04x:%02x:%02x SP: %04x:%02x:%02x ",
+                               op, *state.f & 0xd0, state.pc, 
+                               mmu_read_no_cyc(state.pc + 1),
+                               mmu_read_no_cyc(state.pc + 2), state.sp,
+                               mmu_read_no_cyc(state.sp), 
+                               mmu_read_no_cyc(state.sp + 1));
+
+
+        utils_log("A: %02x BC: %04x DE: %04x HL: %04x FF41: %02x "
+                  "FF44: %02x ENAB: %02x INTE: %02x INTF: %02x\n", 
+                                                 state.a, *state.bc,
+                                                 *state.de, *state.hl,
+                                                 mmu_read_no_cyc(0xFF41),
+                                                 mmu_read_no_cyc(0xFF44),
+                                                 state.int_enable,
+                                                 *int_e, *int_f);
+    }
+
+    /* execute instruction by the GB Z80 version */
+    {
+        STATS_SCOPE(STATS_SCOPE_Z80_EXECUTE);
+
+        z80_execute(op);
+    }
+
+    if (profile_on)
+        profile_count(prof_pc, op, cycles.cnt - prof_cnt);
+
+    /* busy waits: record an iteration, then skip the ones alike */
+    if (idle_on && (idle_rec || state.pc < prof_pc || 
+                    (state.pc == prof_pc && op != 0x76)))
+        gameboy_idle(prof_pc, prof_cnt);
+
+    /* if last op was Interrupt Enable (0xFB)  */
+    /* we need to check for INTR on next cycle */
+    if (op == 0xFB)
+        return;
+
+    /* interrupts filtered by enable flags */
+    uint8_t int_r = (*int_f & *int_e);
+
+    /* check for interrupts */
+    if ((state.int_enable || op == 0x76) && (int_r != 0))
+    {
+        /* discard useless bits */
+        if ((int_r & 0x1F) == 0x00)
+            return;
+
+        /* beware of instruction that doesn't move PC! */
+        /* like HALT (0x76)                            */
+        if (op == 0x76)
+        {
+            state.pc++;
+
+            if (state.int_enable == 0)
+                return;
+        }
+
+        /* reset int-enable flag, it will be restored after a RETI op */
+        state.int_enable = 0;
+
+        if ((int_r & 0x01) == 0x01)
+        {
+            /* vblank interrupt triggers RST 5 */
+
+            /* reset flag */
+            *int_f &= 0xFE;
+
+            STATS_INC(STATS_CNT_INT_VBLANK);
+            TRACE(TRACE_INT, 0x0040);
+
+            /* handle the interrupt */
+            z80_intr(0x0040); 
+        }
+        else if ((int_r & 0x02) == 0x02)
+        {
+            /* LCD Stat interrupt */
+
+            /* reset flag */
+            *int_f &= 0xFD;
+
+            STATS_INC(STATS_CNT_INT_LCD);
+            TRACE(TRACE_INT, 0x0048);
+
+            /* handle the interrupt! */
+            z80_intr(0x0048); 
+        }
+        else if ((int_r & 0x04) == 0x04)
+        {
+            /* timer interrupt */
+
+            /* reset flag */
+            *int_f &= 0xFB;
+
+            STATS_INC(STATS_CNT_INT_TIMER);
+            TRACE(TRACE_INT, 0x0050);
+
+            /* handle the interrupt! */
+            z80_intr(0x0050); 
+        } 
+        else if ((int_r & 0x08) == 0x08)
+        {
+            /* serial interrupt */
+
+            /* reset flag */
+            *int_f &= 0xF7;
+
+            STATS_INC(STATS_CNT_INT_SERIAL);
+            TRACE(TRACE_INT, 0x0058);
+
+            /* handle the interrupt! */
+            z80_intr(0x0058); 
+        } 
+    }
+}
+
+void gameboy_run()
+{
+    /* counters were reset by gameboy_init(), states reached since then */
+    /* (boot cache, snapshots) carry their own absolute cycle values     */
+    /* and their frames are already over                                 */
+    gameboy_last_frame = gpu.frame_counter;
 
     /* run stuff!                                                          */
     /* mechanism is simple.                                                */
@@ -188,112 +756,47 @@ void gameboy_run()
             global_slow_down = 0;
         }*/
 
-        /* pause? */
-        while (global_pause)
-            sem_wait(&gameboy_sem);
-
-        /* get op */
-        op = mmu_read(state.pc);
-
-        /* print out CPU state if enabled by debug flag */
-        if (global_debug)
+        /* pause? keep serving commands meanwhile */
+        while (global_pause && !global_quit)
         {
-            utils_log("OP: %02x F: %02x PC: %04x:%02x:%02x SP: %04x:%02x:%02x ",
-                                   op, *state.f & 0xd0, state.pc, 
-                                   mmu_read_no_cyc(state.pc + 1),
-                                   mmu_read_no_cyc(state.pc + 2), state.sp,
-                                   mmu_read_no_cyc(state.sp), 
-                                   mmu_read_no_cyc(state.sp + 1));
-
-
-            utils_log("A: %02x BC: %04x DE: %04x HL: %04x FF41: %02x "
-                      "FF44: %02x ENAB: %02x INTE: %02x INTF: %02x\n", 
-                                                     state.a, *state.bc,
-                                                     *state.de, *state.hl,
-                                                     mmu_read_no_cyc(0xFF41),
-                                                     mmu_read_no_cyc(0xFF44),
-                                                     state.int_enable,
-                                                     *int_e, *int_f);
+            gameboy_cmd_drain();
+
+            if (global_pause)
+                sem_wait(&gameboy_sem);
         }
 
-        /* execute instruction by the GB Z80 version */
-        z80_execute(op);
+        /* commands from other threads */
+        if (!utils_queue_empty(&gameboy_cmd_queue))
+            gameboy_cmd_drain();
 
-        /* if last op was Interrupt Enable (0xFB)  */
-        /* we need to check for INTR on next cycle */
-        if (op == 0xFB)
-            continue;
+        /* a new frame has been completed? */
+        if (gpu.frame_counter != gameboy_last_frame)
+            gameboy_frame_end();
 
-        /* interrupts filtered by enable flags */
-        uint8_t int_r = (*int_f & *int_e);
+        /* movie input to inject? */
+        if (cycles.cnt >= movie_next)
+            movie_step();
 
-        /* check for interrupts */
-        if ((state.int_enable || op == 0x76) && (int_r != 0))
-        {
-            /* discard useless bits */
-            if ((int_r & 0x1F) == 0x00)
-                continue;
-
-            /* beware of instruction that doesn't move PC! */
-            /* like HALT (0x76)                            */
-            if (op == 0x76)
-            {
-                state.pc++;
-
-                if (state.int_enable == 0)
-                    continue;
-            }
-
-            /* reset int-enable flag, it will be restored after a RETI op */
-            state.int_enable = 0;
-
-            if ((int_r & 0x01) == 0x01)
-            {
-                /* vblank interrupt triggers RST 5 */
-
-                /* reset flag */
-                *int_f &= 0xFE;
-
-                /* handle the interrupt */
-                z80_intr(0x0040); 
-            }
-            else if ((int_r & 0x02) == 0x02)
-            {
-                /* LCD Stat interrupt */
-
-                /* reset flag */
-                *int_f &= 0xFD;
-
-                /* handle the interrupt! */
-                z80_intr(0x0048); 
-            }
-            else if ((int_r & 0x04) == 0x04)
-            {
-                /* timer interrupt */
-
-                /* reset flag */
-                *int_f &= 0xFB;
-
-                /* handle the interrupt! */
-                z80_intr(0x0050); 
-            } 
-            else if ((int_r & 0x08) == 0x08)
-            {
-                /* serial interrupt */
-
-                /* reset flag */
-                *int_f &= 0xF7;
-
-                /* handle the interrupt! */
-                z80_intr(0x0058); 
-            } 
-        }
+        gameboy_step();
     }
 
     /* terminate all the stuff */
     cartridge_term();
+    movie_stop();
+    trace_stop();
+    profile_stop();
+    cputrace_stop();
+    checkpoint_stop();
+    persist_term();
     sound_term();
     mmu_term();
+    rewind_term();
+
+    free(gameboy_runahead_buf);
+    gameboy_runahead_buf = NULL;
+
+    /* write pending messages, back to synchronous logging */
+    utils_log_stop();
 
     return; 
 }
@@ -309,6 +812,11 @@ void gameboy_stop()
         sem_post(&gameboy_sem);
     }
 
+    /* unlock threads waiting for commands */
+    pthread_mutex_lock(&gameboy_cmd_mutex);
+    pthread_cond_broadcast(&gameboy_cmd_cond);
+    pthread_mutex_unlock(&gameboy_cmd_mutex);
+
     /* unlock threads stuck during reading */
     sound_term();
 
@@ -316,100 +824,201 @@ void gameboy_stop()
     cycles_term();
 }
 
+/* walk through the whole machine state, in both directions */
+void gameboy_serialize_stat(utils_stat_t *s)
+{
+    char version[6];
+    uint8_t f;
+
+    /* version first */
+    memcpy(version, GAMEBOY_STAT_VERSION, 6);
+
+    UTILS_STAT(s, version);
+
+    if (s->restore && memcmp(version, GAMEBOY_STAT_VERSION, 6))
+    {
+        utils_log_error("Version of stat doesnt match\n");
+        s->err = 1;
+        return;
+    }
+
+    /* CPU status */
+    UTILS_STAT(s, state.a);
+    UTILS_STAT(s, state.b);
+    UTILS_STAT(s, state.c);
+    UTILS_STAT(s, state.d);
+    UTILS_STAT(s, state.e);
+    UTILS_STAT(s, state.h);
+    UTILS_STAT(s, state.l);
+    UTILS_STAT16(s, state.sp);
+    UTILS_STAT16(s, state.pc);
+
+    /* flags are bitfields, store them as F register */
+    f = state.flags.z << 7 |
+        state.flags.n << 6 |
+        state.flags.ac << 5 |
+        state.flags.cy << 4;
+
+    UTILS_STAT(s, f);
+
+    if (s->restore)
+    {
+        state.flags.z  = (f >> 7) & 0x01;
+        state.flags.n  = (f >> 6) & 0x01;
+        state.flags.ac = (f >> 5) & 0x01;
+        state.flags.cy = (f >> 4) & 0x01;
+    }
+
+    UTILS_STAT(s, state.int_enable);
+    UTILS_STAT32(s, state.skip_cycle);
+    UTILS_STAT64(s, state.cycles);
+
+    /* modules depend on it to recalc their steps */
+    UTILS_STAT(s, global_cpu_double_speed);
+
+    /* every module */
+    cycles_serialize_stat(s);
+    timer_serialize_stat(s);
+    sound_serialize_stat(s);
+    gpu_serialize_stat(s);
+    serial_serialize_stat(s);
+    mmu_serialize_stat(s);
+}
+
+/* bytes needed to store the state - constant once cartridge is loaded */
+size_t gameboy_stat_size()
+{
+    utils_stat_t s;
+
+    utils_stat_init(&s, NULL, 0, 0);
+
+    gameboy_serialize_stat(&s);
+
+    return s.pos;
+}
+
+/* dump the state into a buffer of at least gameboy_stat_size() bytes */
+char gameboy_save_stat_buf(void *buf, size_t sz)
+{
+    utils_stat_t s;
+
+    utils_stat_init(&s, buf, sz, 0);
+
+    gameboy_serialize_stat(&s);
+
+    return s.err;
+}
+
+/* restore the state from a buffer filled by gameboy_save_stat_buf */
+char gameboy_restore_stat_buf(void *buf, size_t sz)
+{
+    utils_stat_t s;
+
+    /* check version before touching anything */
+    if (sz < 6 || memcmp(buf, GAMEBOY_STAT_VERSION, 6))
+    {
+        utils_log_error("Version of stat doesnt match\n");
+        return 1;
+    }
+
+    utils_stat_init(&s, buf, sz, 1);
+
+    gameboy_serialize_stat(&s);
+
+    /* loop iterations recorded before don't belong to this timeline */
+    idle_reset();
+
+    /* restored frame counter is not a frame just completed */
+    gameboy_last_frame = gpu.frame_counter;
+
+    return s.err;
+}
+
 char gameboy_restore_stat(int idx)
 {
     char path[256];
-    char buf[6];
-
-    /* ensure i'm in pause */
-    gameboy_set_pause(1);
+    uint8_t *buf;
+    size_t sz;
+    char ret;
 
     /* build output file name */
     snprintf(path, sizeof(path), "%s/%s.%d.stat", global_save_folder,
                                                   global_rom_name, idx);
 
+    /* it could be still pending */
+    persist_flush();
+
     FILE *fp = fopen(path, "r+");
 
     if (fp == NULL)
     {
-        utils_log("Cannot open stat file\n");
+        utils_log_error("Cannot open stat file\n");
         return 1;
     }
 
-    /* read version */
-    fread(buf, 1, 6, fp);
+    sz = gameboy_stat_size();
+    buf = malloc(sz);
 
-    if (memcmp(buf, "000001", 6))
+    if (buf == NULL)
     {
-        utils_log("Version of stat file doesnt match\n");
+        fclose(fp);
         return 1;
     }
 
-    /* restore CPU status */
-    fread(&state, 1, sizeof(z80_state_t), fp);
-
-    state.f = (uint8_t *) &state.flags;
-    state.bc = (uint16_t *) &state.c;
-    state.de = (uint16_t *) &state.e;
-    state.hl = (uint16_t *) &state.l;
-
-    /* dump every module */
-    cycles_restore_stat(fp);
-    sound_restore_stat(fp);
-    gpu_restore_stat(fp);
-    serial_restore_stat(fp);
-    mmu_restore_stat(fp);
+    /* a truncated file would leave the machine half restored */
+    if (fread(buf, 1, sz, fp) != sz)
+    {
+        utils_log_error("Stat file is too short\n");
+        ret = 1;
+    }
+    else
+        ret = gameboy_restore_stat_buf(buf, sz);
 
+    free(buf);
     fclose(fp);
 
-    return 0;
+    return ret;
 }
 
 char gameboy_save_stat(int idx)
 {
     char path[256];
-
-    /* ensure i'm in pause */
-    gameboy_set_pause(1);
+    uint8_t *buf;
+    size_t sz;
 
     /* build output file name */
     snprintf(path, sizeof(path), "%s/%s.%d.stat", global_save_folder, 
                                                   global_rom_name, idx);
 
-    FILE *fp = fopen(path, "w+");
+    sz = gameboy_stat_size();
+    buf = malloc(sz);
 
-    if (fp == NULL)
+    if (buf == NULL)
         return 1;
 
-    /* dump current version */
-    fwrite("000001", 1, 6, fp);
+    /* a partial state must not replace a good one on disk */
+    if (gameboy_save_stat_buf(buf, sz))
+    {
+        utils_log_error("Cannot dump state\n");
+        free(buf);
+        return 1;
+    }
 
-    /* dump cpu status */
-    fwrite(&state, 1, sizeof(z80_state_t), fp);
+    /* disk is not our business, worker thread will write it */
+    if (persist_write(path, buf, sz))
+    {
+        free(buf);
+        return 1;
+    }
 
-    /* dump every module */
-    cycles_save_stat(fp);
-    sound_save_stat(fp);
-    gpu_save_stat(fp);
-    serial_save_stat(fp);
-    mmu_save_stat(fp);
-
-    fclose(fp);
+    free(buf);
 
     /* now dump raw data of frame buffer */
     snprintf(path, sizeof(path), "%s/%s.%d.fb", global_save_folder, 
                                                 global_rom_name, idx);
 
-    fp = fopen(path, "w+");
-
-    if (fp == NULL)
-        return 1;
-
     /* dump frame buffer pixels */
-    gpu_save_fb(fp);
-
-    fclose(fp);
-    
-    return 0;
+    return persist_write(path, gpu_get_frame_buffer(), 
+                         sizeof(uint16_t) * 144 * 160);
 }
 
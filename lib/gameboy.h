@@ -20,12 +20,57 @@
 #ifndef __GAMEBOY_HDR__
 #define __GAMEBOY_HDR__
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* version of save states, bump it on every layout change */
+#define GAMEBOY_STAT_VERSION "000003"
+
+/* max frames of run-ahead */
+#define GAMEBOY_RUNAHEAD_MAX 4
+
+/* battery backed RAM is flushed every ~10 seconds */
+#define GAMEBOY_BATTERY_FLUSH_FRAMES 600
+
+/* commands executed by the emulation thread between two instructions */
+enum {
+    GAMEBOY_CMD_SAVE_STAT,
+    GAMEBOY_CMD_RESTORE_STAT,
+    GAMEBOY_CMD_RESET,
+    GAMEBOY_CMD_INPUT,
+    GAMEBOY_CMD_SPEED,
+    GAMEBOY_CMD_REWIND,
+    GAMEBOY_CMD_RUNAHEAD
+};
+
+typedef struct gameboy_cmd_s
+{
+    uint8_t type;
+    int     arg1;
+    int     arg2;
+
+    /* where the result goes, owned by the waiter - NULL if nobody waits */
+    char   *result;
+
+} gameboy_cmd_t;
+
 /* prototypes */
-void gameboy_init();
-void gameboy_run();
-char gameboy_restore_stat(int idx);
-char gameboy_save_stat(int idx);
-void gameboy_set_pause(char pause);
-void gameboy_stop();
+char   gameboy_cmd(uint8_t type, int arg1, int arg2);
+size_t gameboy_cmd_push(uint8_t type, int arg1, int arg2);
+size_t gameboy_cmd_push_result(uint8_t type, int arg1, int arg2, 
+                               char *result);
+char   gameboy_cmd_wait(size_t ticket);
+void   gameboy_init();
+void   gameboy_reset();
+void   gameboy_run();
+void   gameboy_run_frame();
+char   gameboy_restore_stat(int idx);
+char   gameboy_restore_stat_buf(void *buf, size_t sz);
+char   gameboy_save_stat(int idx);
+char   gameboy_save_stat_buf(void *buf, size_t sz);
+void   gameboy_set_pause(char pause);
+size_t gameboy_stat_size();
+void   gameboy_step();
+void   gameboy_stop();
 
 #endif
@@ -26,6 +26,7 @@ char global_cart_name[256];
 char global_cgb;
 char global_cpu_double_speed;
 char global_debug;
+char global_deterministic;
 char global_emulation_speed;
 char global_next_frame;
 char global_pause;
@@ -35,6 +36,11 @@ char global_rom_name[256];
 char global_rumble;
 char global_slow_down;
 char global_save_folder[256];
+unsigned int global_seed;
+char global_skip_audio;
+char global_skip_video;
+char global_speculative;
+char global_uncapped;
 char global_window;
 
 void global_init()
@@ -43,12 +49,18 @@ void global_init()
     global_pause = 0;
     global_window = 1;
     global_debug = 0;
+    global_deterministic = 0;
+    global_seed = 0;
     global_cgb = 0;
     global_cpu_double_speed = 0;
     global_slow_down = 0;
     global_record_audio = 0;
     global_next_frame = 0;
     global_rumble = 0;
+    global_skip_audio = 0;
+    global_skip_video = GLOBAL_SKIP_VIDEO_NONE;
+    global_speculative = 0;
+    global_uncapped = 0;
     global_emulation_speed = GLOBAL_EMULATION_SPEED_NORMAL;
     // bzero(global_save_folder, 256);
     bzero(global_rom_name, 256);
@@ -29,10 +29,17 @@ enum {
     GLOBAL_EMULATION_SPEED_4X
 };
 
+enum {
+    GLOBAL_SKIP_VIDEO_NONE,
+    GLOBAL_SKIP_VIDEO_PRESENT,
+    GLOBAL_SKIP_VIDEO_ALL
+};
+
 extern char global_quit;
 extern char global_pause;
 extern char global_window;
 extern char global_debug;
+extern char global_deterministic;
 extern char global_cgb;
 extern char global_next_frame;
 // extern char global_started;
@@ -41,10 +48,19 @@ extern char global_slow_down;
 extern char global_record_audio;
 extern char global_emulation_speed;
 extern char global_rumble;
+extern char global_skip_audio;
+extern char global_skip_video;
+extern char global_speculative;
+extern char global_uncapped;
+extern unsigned int global_seed;
 extern char global_save_folder[256];
 extern char global_rom_name[256];
 extern char global_cart_name[256];
 
+/* hot functions are written once with the model (DMG/CGB) as argument */
+/* and instanced per model with a constant, dropping the other branches */
+#define GLOBAL_MODEL_BODY static inline __attribute__ ((always_inline))
+
 /* prototypes */
 void global_init();
 
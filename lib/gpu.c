@@ -24,12 +24,16 @@
 #include <strings.h>
 #include <time.h>
 
+#include "checkpoint.h"
 #include "cycles.h"
 #include "gameboy.h"
 #include "global.h"
 #include "gpu.h"
 #include "interrupt.h"
 #include "mmu.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 /* Gameboy OAM 4 bytes data */
@@ -71,11 +75,15 @@ typedef struct oam_list_s
 interrupts_flags_t *gpu_if;
 
 /* internal functions prototypes */
-void gpu_draw_sprite_line(gpu_oam_t *oam, 
-                          uint8_t sprites_size,
-                          uint8_t line);
-void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
-                          uint8_t frame_y, uint8_t line);
+GLOBAL_MODEL_BODY void gpu_draw_sprite_line(gpu_oam_t *oam, 
+                                            uint8_t sprites_size,
+                                            uint8_t line, const char cgb,
+                                            const char luma);
+GLOBAL_MODEL_BODY void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
+                                            uint8_t frame_y, uint8_t line,
+                                            const char cgb, const char luma);
+void gpu_draw_line_dmg(uint8_t line);
+void gpu_update_luma();
 
 /* 2 bit to 8 bit color lookup */
 static uint16_t gpu_color_lookup[] = { 0xFFFF, 0xAD55, 0x52AA, 0x0000 };
@@ -86,6 +94,21 @@ gpu_frame_ready_cb_t gpu_frame_ready_cb;
 /* global state of GPU */
 gpu_t gpu;
 
+/* line drawing variant of the cartridge model, see gpu_set_model() */
+void (*gpu_draw_line_fn) (uint8_t line) = gpu_draw_line_dmg;
+
+/* simulate LCD response time averaging current and previous frame */
+char gpu_blend = 1;
+
+/* draw luma values instead of RGB565 ones, see gpu_set_luma() */
+char gpu_luma = 0;
+
+/* model set by gpu_set_model() */
+char gpu_cgb = 0;
+
+/* frames with (frame_counter & mask) != 0 are not drawn (fast forward) */
+uint_fast16_t gpu_frame_skip_mask = 0;
+
 
 void gpu_dump_oam()
 {
@@ -149,6 +172,8 @@ void gpu_init(gpu_frame_ready_cb_t cb)
     memcpy(gpu.obj_palette_0, gpu_color_lookup, sizeof(uint16_t) * 4);
     memcpy(gpu.obj_palette_1, gpu_color_lookup, sizeof(uint16_t) * 4);
 
+    gpu_update_luma();
+
     /* set callback */
     gpu_frame_ready_cb = cb;
 }
@@ -181,14 +206,24 @@ void gpu_draw_frame()
     gpu.frame_counter++;
 
     /* is it the case to push samples? */
-    if ((global_emulation_speed == GLOBAL_EMULATION_SPEED_DOUBLE &&
-        (gpu.frame_counter & 0x0001) != 0) ||
-        (global_emulation_speed == GLOBAL_EMULATION_SPEED_4X &&
-        (gpu.frame_counter & 0x0003) != 0))
+    if ((gpu.frame_counter & gpu_frame_skip_mask) != 0 ||
+        global_skip_video == GLOBAL_SKIP_VIDEO_ALL)
         return;
 
+    /* regression hashes are taken on the lines as they were drawn */
+    if (checkpoint_on)
+        checkpoint_video(gpu.frame_buffer);
+
+    /* exported frames are not blended either */
+    if (output_on)
+        output_frame();
+
     uint_fast32_t i,r,g,b,r2,g2,b2,res;
 
+    /* headless runs reading exported frames don't need the blending */
+    if (!gpu_blend)
+        goto present;
+
     /* simulate shitty gameboy response time of LCD                 */
     /* by calculating an average between current and previous frame */
     //for (i=0; i<(144*160); i++)
@@ -226,8 +261,10 @@ void gpu_draw_frame()
         gpu.frame_buffer[i] = res;
     } 
        
+present:
+
     /* call the callback */
-    if (gpu_frame_ready_cb)
+    if (gpu_frame_ready_cb && global_skip_video == GLOBAL_SKIP_VIDEO_NONE)
         (*gpu_frame_ready_cb) ();
 
     /* reset priority matrix */
@@ -243,6 +280,13 @@ void gpu_draw_frame()
     return;
 }
 
+/* push current frame buffer to the frontend again */
+void gpu_present_frame()
+{
+    if (gpu_frame_ready_cb)
+        (*gpu_frame_ready_cb) ();
+}
+
 /* get pointer to frame buffer */
 uint16_t *gpu_get_frame_buffer()
 {
@@ -250,32 +294,22 @@ uint16_t *gpu_get_frame_buffer()
 }
 
 /* draw a single line */
-void gpu_draw_line(uint8_t line)
+GLOBAL_MODEL_BODY void gpu_draw_line_model(uint8_t line, const char cgb,
+                                           const char luma)
 {
-    /* avoid mess */
-    if (line > 144)
-        return;
-
-    /* is it the case to push samples? */
-    if ((global_emulation_speed == GLOBAL_EMULATION_SPEED_DOUBLE &&
-        (gpu.frame_counter & 0x0001) != 0) ||
-        (global_emulation_speed == GLOBAL_EMULATION_SPEED_4X &&
-        (gpu.frame_counter & 0x0003) != 0))
-        return;
-
     int i, t, y, px_start, px_drawn;
     uint8_t *tiles_map, tile_subline, palette_idx, x_flip, priority;
     uint16_t tiles_addr, tile_n, tile_idx, tile_line;
     uint16_t tile_y;
     
     /* gotta show BG? Answer is always YES in case of Gameboy Color */
-    if ((*gpu.lcd_ctrl).bg || global_cgb)
+    if ((*gpu.lcd_ctrl).bg || cgb)
     {
         gpu_cgb_bg_tile_t *tiles_map_cgb = NULL;
         uint8_t *tiles = NULL; 
         uint16_t *palette;
 
-        if (global_cgb)
+        if (cgb)
         {
             /* CGB tile map into VRAM0 */
             tiles_map = mmu_addr_vram0() + ((*gpu.lcd_ctrl).bg_tiles_map ?
@@ -303,7 +337,7 @@ void gpu_draw_line(uint8_t line)
             tiles = mmu_addr(tiles_addr);
 
             /* monochrome GB uses a single BG palette */
-            palette = gpu.bg_palette; 
+            palette = luma ? gpu.bg_luma : gpu.bg_palette; 
 
             /* always priority = 0 */
             priority = 0;
@@ -336,14 +370,15 @@ void gpu_draw_line(uint8_t line)
                 tile_n = (tiles_map[tile_idx] & 0x00FF);
 
             /* if color gameboy, resolv which palette is bound */
-            if (global_cgb)
+            if (cgb)
             {
                 /* extract palette index (0-31) */
                 palette_idx = tiles_map_cgb[tile_idx].palette;
 
                 /* get palette pointer to 4 (16bit) colors */
-                palette = 
-                    (uint16_t *) &gpu.cgb_palette_bg_rgb565[palette_idx * 4];
+                palette = luma ?
+                    &gpu.cgb_palette_bg_luma[palette_idx * 4] :
+                    &gpu.cgb_palette_bg_rgb565[palette_idx * 4];
 
                 /* get priority of the tile */
                 priority = tiles_map_cgb[tile_idx].priority;
@@ -472,7 +507,7 @@ void gpu_draw_line(uint8_t line)
                 line >= (oam[i].y - 16))
             {
                 /* color GB uses memory position as priority criteria */
-                if (global_cgb)
+                if (cgb)
                 {
                     sort[j++] = i; 
                     continue;
@@ -487,7 +522,7 @@ void gpu_draw_line(uint8_t line)
                         break;
                     }
 
-                    if (global_cgb)
+                    if (cgb)
                         continue;
 
                     if ((oam[i].y < oam[sort[j]].y) ||
@@ -509,7 +544,8 @@ void gpu_draw_line(uint8_t line)
         /* draw ordered sprite list */
         for (i=0; i<40 && sort[i] != -1; i++)
             gpu_draw_sprite_line(&oam[sort[i]], 
-                                 (*gpu.lcd_ctrl).sprites_size, line);
+                                 (*gpu.lcd_ctrl).sprites_size, line, cgb,
+                                 luma);
         
     }
 
@@ -564,7 +600,7 @@ void gpu_draw_line(uint8_t line)
 
             /* put tile on frame buffer */
             gpu_draw_window_line(z, (uint8_t) tile_pos_x, 
-                                    (uint8_t) tile_pos_y, line);
+                                    (uint8_t) tile_pos_y, line, cgb, luma);
         }
     }
 }
@@ -572,8 +608,9 @@ void gpu_draw_line(uint8_t line)
 
 
 /* draw a tile in x,y coordinates */
-void gpu_draw_window_line(int tile_idx, uint8_t frame_x, 
-                          uint8_t frame_y, uint8_t line)
+GLOBAL_MODEL_BODY void gpu_draw_window_line(int tile_idx, uint8_t frame_x, 
+                                            uint8_t frame_y, uint8_t line,
+                                            const char cgb, const char luma)
 {
     int i, p, y, pos;
     int16_t tile_n;
@@ -582,7 +619,7 @@ void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
     uint8_t *tiles, x_flip;
     uint16_t *palette;
 
-    if (global_cgb)
+    if (cgb)
     {
         /* CGB tile map into VRAM0 */
         tiles_map = mmu_addr_vram0() + ((*gpu.lcd_ctrl).window_tiles_map ?
@@ -597,7 +634,8 @@ void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
         x_flip = tiles_map_cgb[tile_idx].x_flip;
 
         /* get palette pointer to 4 (16bit) colors */
-        palette = (uint16_t *) &gpu.cgb_palette_bg_rgb565[palette_idx * 4];
+        palette = luma ? &gpu.cgb_palette_bg_luma[palette_idx * 4] :
+                         &gpu.cgb_palette_bg_rgb565[palette_idx * 4];
 
         /* attribute table will tell us where is the tile */
         if (tiles_map_cgb[tile_idx].vram_bank)
@@ -621,7 +659,7 @@ void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
             tiles = mmu_addr(0x9000);
 
         /* monochrome GB uses a single BG palette */
-        palette = gpu.bg_palette;
+        palette = luma ? gpu.bg_luma : gpu.bg_palette;
 
         /* never flip */
         x_flip = 0;
@@ -681,7 +719,10 @@ void gpu_draw_window_line(int tile_idx, uint8_t frame_x,
 }
 
 /* draw a sprite tile in x,y coordinates */
-void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
+GLOBAL_MODEL_BODY void gpu_draw_sprite_line(gpu_oam_t *oam, 
+                                            uint8_t sprites_size, 
+                                            uint8_t line, const char cgb,
+                                            const char luma)
 {
     int_fast32_t x, y, pos, fb_x, off;
     uint_fast16_t p, i, j;
@@ -709,12 +750,13 @@ void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
     uint32_t tile_pos_fb = (y * 160) + x;
 
     /* choose palette */
-    if (global_cgb)
+    if (cgb)
     {
          uint8_t palette_idx = oam->palette_cgb;
 
          /* get palette pointer to 4 (16bit) colors */
-         palette = (uint16_t *) &gpu.cgb_palette_oam_rgb565[palette_idx * 4];
+         palette = luma ? &gpu.cgb_palette_oam_luma[palette_idx * 4] :
+                          &gpu.cgb_palette_oam_rgb565[palette_idx * 4];
    
          /* tiles are into vram0 */
          if (oam->vram_bank)
@@ -728,9 +770,9 @@ void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
         tiles = mmu_addr(0x8000);
 
         if (oam->palette)
-            palette = gpu.obj_palette_1;
+            palette = luma ? gpu.obj_luma_1 : gpu.obj_palette_1;
         else
-            palette = gpu.obj_palette_0;
+            palette = luma ? gpu.obj_luma_0 : gpu.obj_palette_0;
     }
 
     /* calc sprite in byte */
@@ -789,7 +831,7 @@ void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
             if (pos >= 144 * 160 || pos < 0)
                 continue;
 
-            if (global_cgb)
+            if (cgb)
             {
                 /* sprite color 0 = transparent */
                 if (pxa[i] != 0x00) 
@@ -823,7 +865,8 @@ void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
                 if ((pxa[i] != 0x00) &&
                     (oam->priority == 0 || 
                     (oam->priority == 1 && 
-                     gpu.frame_buffer[pos] == gpu.bg_palette[0x00])))
+                     gpu.frame_buffer[pos] == 
+                     (luma ? gpu.bg_luma[0x00] : gpu.bg_palette[0x00]))))
                 {
                     gpu.frame_buffer[pos] = palette[pxa[i]];
                     gpu.priority[pos] = (oam->priority ? 0x00 : 0x02);
@@ -833,11 +876,52 @@ void gpu_draw_sprite_line(gpu_oam_t *oam, uint8_t sprites_size, uint8_t line)
     }
 }
 
+void gpu_draw_line_dmg(uint8_t line)
+{
+    gpu_draw_line_model(line, 0, 0);
+}
+
+void gpu_draw_line_cgb(uint8_t line)
+{
+    gpu_draw_line_model(line, 1, 0);
+}
+
+void gpu_draw_line_dmg_luma(uint8_t line)
+{
+    gpu_draw_line_model(line, 0, 1);
+}
+
+void gpu_draw_line_cgb_luma(uint8_t line)
+{
+    gpu_draw_line_model(line, 1, 1);
+}
+
+/* draw a single line */
+void gpu_draw_line(uint8_t line)
+{
+    STATS_SCOPE(STATS_SCOPE_GPU_DRAW_LINE);
+
+    /* avoid mess */
+    if (line > 144)
+        return;
+
+    /* is it the case to push samples? */
+    if ((gpu.frame_counter & gpu_frame_skip_mask) != 0 ||
+        global_skip_video == GLOBAL_SKIP_VIDEO_ALL)
+        return;
+
+    (*gpu_draw_line_fn) (line);
+
+    if (output_on)
+        output_line(line);
+}
+
 /* update GPU internal state given CPU T-states */
 void gpu_step()
 {
     char ly_changed = 0;
     char mode_changed = 0;
+    uint8_t mode = (*gpu.lcd_status).mode;
 
     /* take different action based on current state */
     switch((*gpu.lcd_status).mode)
@@ -1004,6 +1088,10 @@ void gpu_step()
                  (*gpu.lcd_status).ir_mode_10)
             gpu_if->lcd_ctrl = 1;
     }
+
+    /* timeline of LCD modes */
+    if ((*gpu.lcd_status).mode != mode)
+        TRACE(TRACE_GPU_MODE, (*gpu.lcd_status).mode | (*gpu.ly << 8));
 }
 
 uint8_t gpu_read_reg(uint16_t a)
@@ -1056,6 +1144,9 @@ void gpu_write_reg(uint16_t a, uint8_t v)
             gpu.bg_palette[2] = gpu_color_lookup[(v & 0x30) >> 4];
             gpu.bg_palette[3] = gpu_color_lookup[(v & 0xc0) >> 6];
 
+            for (i = 0; i < 4; i++)
+                gpu.bg_luma[i] = gpu_rgb565_luma(gpu.bg_palette[i]);
+
             break;
 
         case 0xFF48:
@@ -1065,6 +1156,9 @@ void gpu_write_reg(uint16_t a, uint8_t v)
             gpu.obj_palette_0[2] = gpu_color_lookup[(v & 0x30) >> 4];
             gpu.obj_palette_0[3] = gpu_color_lookup[(v & 0xc0) >> 6];
 
+            for (i = 0; i < 4; i++)
+                gpu.obj_luma_0[i] = gpu_rgb565_luma(gpu.obj_palette_0[i]);
+
             break;
 
         case 0xFF49:
@@ -1074,6 +1168,9 @@ void gpu_write_reg(uint16_t a, uint8_t v)
             gpu.obj_palette_1[2] = gpu_color_lookup[(v & 0x30) >> 4];
             gpu.obj_palette_1[3] = gpu_color_lookup[(v & 0xc0) >> 6];
 
+            for (i = 0; i < 4; i++)
+                gpu.obj_luma_1[i] = gpu_rgb565_luma(gpu.obj_palette_1[i]);
+
             break;
 
         case 0xFF68:
@@ -1106,6 +1203,9 @@ void gpu_write_reg(uint16_t a, uint8_t v)
                 (((r * 13 + g * 2 + b + 8) << 7) & 0xF800) |
                  ((g * 3 + b + 1) >> 1) << 5 |
                  ((r * 3 + g * 2 + b * 11 + 8) >> 4);
+
+            gpu.cgb_palette_bg_luma[i] = 
+                gpu_rgb565_luma(gpu.cgb_palette_bg_rgb565[i]);
  
             if (gpu.cgb_palette_bg_autoinc)
                 gpu.cgb_palette_bg_idx = ((gpu.cgb_palette_bg_idx + 1) & 0x3f);
@@ -1143,6 +1243,9 @@ void gpu_write_reg(uint16_t a, uint8_t v)
                  ((g * 3 + b + 1) >> 1) << 5 |
                  ((r * 3 + g * 2 + b * 11 + 8) >> 4);
 
+            gpu.cgb_palette_oam_luma[i] = 
+                gpu_rgb565_luma(gpu.cgb_palette_oam_rgb565[i]);
+
             if (gpu.cgb_palette_oam_autoinc)
                 gpu.cgb_palette_oam_idx = 
                     ((gpu.cgb_palette_oam_idx + 1) & 0x3f);
@@ -1152,6 +1255,66 @@ void gpu_write_reg(uint16_t a, uint8_t v)
     }
 }
 
+/* draw one frame every 2 or 4 when going faster than normal */
+void gpu_change_emulation_speed()
+{
+    if (global_emulation_speed == GLOBAL_EMULATION_SPEED_DOUBLE)
+        gpu_frame_skip_mask = 0x0001;
+    else if (global_emulation_speed == GLOBAL_EMULATION_SPEED_4X)
+        gpu_frame_skip_mask = 0x0003;
+    else
+        gpu_frame_skip_mask = 0x0000;
+}
+
+/* pick the line drawing without the branches of the other model */
+void gpu_set_model(char cgb)
+{
+    gpu_cgb = cgb;
+
+    if (gpu_luma)
+        gpu_draw_line_fn = cgb ? gpu_draw_line_cgb_luma : 
+                                 gpu_draw_line_dmg_luma;
+    else
+        gpu_draw_line_fn = cgb ? gpu_draw_line_cgb : gpu_draw_line_dmg;
+}
+
+/* draw 8 bit luma values (0 black - 255 white) into the frame buffer    */
+/* instead of RGB565 ones, taken from the palette of every pixel. meant  */
+/* for headless runs only exporting gray or INDEX2 frames: presented and */
+/* hashed frames are luma too, and LCD blending must be off              */
+char gpu_set_luma(char on)
+{
+    if (on && gpu_blend)
+        return 1;
+
+    gpu_luma = on;
+
+    gpu_set_model(gpu_cgb);
+
+    return 0;
+}
+
+/* luma palettes follow the RGB565 ones */
+void gpu_update_luma()
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        gpu.bg_luma[i] = gpu_rgb565_luma(gpu.bg_palette[i]);
+        gpu.obj_luma_0[i] = gpu_rgb565_luma(gpu.obj_palette_0[i]);
+        gpu.obj_luma_1[i] = gpu_rgb565_luma(gpu.obj_palette_1[i]);
+    }
+
+    for (i = 0; i < 0x20; i++)
+    {
+        gpu.cgb_palette_bg_luma[i] = 
+            gpu_rgb565_luma(gpu.cgb_palette_bg_rgb565[i]);
+        gpu.cgb_palette_oam_luma[i] = 
+            gpu_rgb565_luma(gpu.cgb_palette_oam_rgb565[i]);
+    }
+}
+
 void gpu_set_speed(char speed)
 {
     if (speed == 1)
@@ -1165,15 +1328,67 @@ void gpu_save_fb(FILE *fp)
     fwrite(&gpu.frame_buffer, 1, sizeof(int16_t) * 144 * 160, fp);
 }
 
-void gpu_save_stat(FILE *fp)
+void gpu_serialize_stat(utils_stat_t *s)
 {
-    fwrite(&gpu, 1, sizeof(gpu_t), fp);
-}
+    uint8_t rows = 144;
+    uint8_t mode = (*gpu.lcd_status).mode;
+
+    UTILS_STAT64(s, gpu.next);
+    UTILS_STAT64(s, gpu.step);
+    UTILS_STAT(s, gpu.window_last_ly);
+    UTILS_STAT(s, gpu.window_skipped_lines);
+    UTILS_STAT64(s, gpu.frame_counter);
+    UTILS_STAT_ARRAY16(s, gpu.bg_palette);
+    UTILS_STAT_ARRAY16(s, gpu.obj_palette_0);
+    UTILS_STAT_ARRAY16(s, gpu.obj_palette_1);
+    UTILS_STAT_ARRAY16(s, gpu.cgb_palette_bg_rgb565);
+    UTILS_STAT_ARRAY16(s, gpu.cgb_palette_bg);
+    UTILS_STAT(s, gpu.cgb_palette_bg_idx);
+    UTILS_STAT(s, gpu.cgb_palette_bg_autoinc);
+    UTILS_STAT_ARRAY16(s, gpu.cgb_palette_oam_rgb565);
+    UTILS_STAT_ARRAY16(s, gpu.cgb_palette_oam);
+    UTILS_STAT(s, gpu.cgb_palette_oam_idx);
+    UTILS_STAT(s, gpu.cgb_palette_oam_autoinc);
+
+    /* a single frame is stored: the rows of the current frame already */
+    /* drawn, then the rows of the previous one, as drawn before LCD    */
+    /* blending. that's all the next frames depend on - only the first  */
+    /* blend after a restore sees the current rows instead of the old   */
+    if (gpu_blend && !s->restore)
+    {
+        if ((*gpu.lcd_ctrl).display && mode != 0x01 && *gpu.ly < 144 &&
+            (gpu.frame_counter & gpu_frame_skip_mask) == 0 &&
+            global_skip_video != GLOBAL_SKIP_VIDEO_ALL)
+            rows = *gpu.ly + (mode == 0x00);
+        else
+            rows = 0;
+    }
 
-void gpu_restore_stat(FILE *fp)
-{
-    fread(&gpu, 1, sizeof(gpu_t), fp);
+    UTILS_STAT(s, rows);
 
-    gpu_init_pointers();
+    if (rows > 144)
+    {
+        s->err = 1;
+        return;
+    }
+
+    utils_stat_array16(s, gpu.frame_buffer, rows * 160);
+    utils_stat_array16(s, &gpu.frame_buffer_prev[rows * 160], 
+                       (144 - rows) * 160);
+
+    /* priority and palette indexes only live during a single line */
+    if (s->restore)
+    {
+        bzero(gpu.priority, sizeof(gpu.priority));
+        bzero(gpu.palette_idx, sizeof(gpu.palette_idx));
+
+        gpu_update_luma();
+
+        memcpy(gpu.frame_buffer_prev, gpu.frame_buffer, rows * 160 * 2);
+        memcpy(&gpu.frame_buffer[rows * 160], &gpu.frame_buffer_prev[rows * 160],
+               (144 - rows) * 160 * 2);
+
+        gpu_init_pointers();
+    }
 }
 
@@ -23,17 +23,23 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "utils.h"
+
 /* callback function */ 
 typedef void (*gpu_frame_ready_cb_t) ();
 
 /* prototypes */
+void      gpu_change_emulation_speed();
+void      gpu_draw_line(uint8_t line);
 void      gpu_dump_oam();
 uint16_t *gpu_get_frame_buffer();
 void      gpu_init(gpu_frame_ready_cb_t cb);
+void      gpu_present_frame();
 void      gpu_reset();
-void      gpu_restore_stat(FILE *fp);
-void      gpu_save_stat(FILE *fp);
 void      gpu_save_fb(FILE *fp);
+void      gpu_serialize_stat(utils_stat_t *s);
+char      gpu_set_luma(char on);
+void      gpu_set_model(char cgb);
 void      gpu_set_speed(char speed);
 void      gpu_step();
 void      gpu_toggle(uint8_t state);
@@ -128,6 +134,13 @@ typedef struct gpu_s
     uint8_t   cgb_palette_oam_autoinc;
     uint16_t  spare3;
 
+    /* same palettes as 8 bit luma, drawn in place of RGB565 by gpu_luma */
+    uint16_t  bg_luma[4];
+    uint16_t  obj_luma_0[4];
+    uint16_t  obj_luma_1[4];
+    uint16_t  cgb_palette_bg_luma[0x20];
+    uint16_t  cgb_palette_oam_luma[0x20];
+
     /* frame buffer     */
     uint16_t  frame_buffer_prev[160 * 144];
     uint16_t  frame_buffer[160 * 144];
@@ -141,4 +154,21 @@ typedef struct gpu_s
 
 extern gpu_t gpu;
 
+/* LCD blending of frames, off when only exported frames are read */
+extern char gpu_blend;
+
+/* frame buffer holds luma instead of RGB565, see gpu_set_luma() */
+extern char gpu_luma;
+
+/* BT.601 luma of a RGB565 pixel */
+static inline uint8_t gpu_rgb565_luma(uint16_t p)
+{
+    uint32_t r = (p >> 11) * 2114;
+    uint32_t g = ((p >> 5) & 0x3F) * 1040;
+    uint32_t b = (p & 0x1F) * 2114;
+
+    /* components scaled to 0..65535, then BT.601 weights */
+    return (r * 77 + g * 150 + b * 29) >> 16;
+}
+
 #endif
@@ -0,0 +1,514 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "global.h"
+#include "gpu.h"
+#include "idle.h"
+#include "mmu.h"
+#include "movie.h"
+#include "stats.h"
+#include "utils.h"
+
+/* skipping busy waits - off unless asked, peripherals still tick */
+/* every M-cycle so the gain is small                             */
+char          idle_on = 0;
+
+/* loops found into the ROM, sorted by offset */
+idle_loop_t  *idle_loops = NULL;
+size_t        idle_count = 0;
+
+/* a bit for every ROM byte where a loop starts */
+uint8_t      *idle_map = NULL;
+size_t        idle_rom_sz = 0;
+
+/* no bound by default */
+uint_fast32_t idle_horizon = UINT_FAST32_MAX;
+
+/* iteration being recorded */
+idle_loop_t  *idle_rec = NULL;
+uint8_t       idle_k;
+uint8_t       idle_gpu;
+uint8_t       idle_a0;
+uint8_t       idle_f0;
+uint_fast32_t idle_gpu_next;
+
+/* frame counter before the last recorded instruction */
+uint_fast16_t idle_frame;
+
+/* A, flags and cycles of every instruction of the recorded iteration */
+uint8_t       idle_a[IDLE_OPS_MAX];
+uint8_t       idle_f[IDLE_OPS_MAX];
+uint8_t       idle_cyc[IDLE_OPS_MAX];
+
+/* loop of the last recorded iteration, the one to skip */
+idle_loop_t  *idle_cur = NULL;
+
+/* what can change a value read at address a while the CPU spins */
+/* return values                                                */
+/* 0:                 CPU writes only (interrupt handlers)      */
+/* IDLE_FLAG_GPU:     GPU steps too                             */
+/* 0xFF:              anything else, not skippable              */
+
+uint8_t idle_mem_class(uint16_t a)
+{
+    /* ROM, work RAM and its mirror, high RAM and interrupt enable */
+    if (a < 0x8000 || (a >= 0xC000 && a < 0xFE00) || a >= 0xFF80)
+        return 0;
+
+    /* STAT and LY */
+    if (a == 0xFF41 || a == 0xFF44)
+        return IDLE_FLAG_GPU;
+
+    return 0xFF;
+}
+
+/* length of an instruction allowed into a busy wait, 0 if it's not.  */
+/* allowed ones read memory at most and write nothing but A and flags */
+uint8_t idle_decode(uint8_t *p, size_t left, uint8_t *mem, uint16_t *addr)
+{
+    uint8_t op = p[0];
+
+    *mem = IDLE_MEM_NONE;
+
+    switch (op)
+    {
+        /* NOP */
+        case 0x00: return 1;
+
+        /* LD A,(BC) LD A,(DE) LD A,(HL) LD A,(C) */
+        case 0x0A: *mem = IDLE_MEM_BC; return 1;
+        case 0x1A: *mem = IDLE_MEM_DE; return 1;
+        case 0x7E: *mem = IDLE_MEM_HL; return 1;
+        case 0xF2: *mem = IDLE_MEM_C; return 1;
+
+        /* LD A,r */
+        case 0x78 ... 0x7D:
+        case 0x7F: return 1;
+
+        /* AND XOR OR CP on A */
+        case 0xA0 ... 0xBF:
+
+            if ((op & 0x07) == 0x06)
+                *mem = IDLE_MEM_HL;
+
+            return 1;
+
+        /* AND XOR OR CP immediate */
+        case 0xE6:
+        case 0xEE:
+        case 0xF6:
+        case 0xFE: return (left >= 2) ? 2 : 0;
+
+        /* LDH A,(n) */
+        case 0xF0:
+
+            if (left < 2)
+                return 0;
+
+            *mem = IDLE_MEM_DIRECT;
+            *addr = 0xFF00 + p[1];
+
+            return 2;
+
+        /* LD A,(nn) */
+        case 0xFA:
+
+            if (left < 3)
+                return 0;
+
+            *mem = IDLE_MEM_DIRECT;
+            *addr = p[1] | (p[2] << 8);
+
+            return 3;
+
+        /* BIT b,r */
+        case 0xCB:
+
+            if (left < 2 || p[1] < 0x40 || p[1] > 0x7F)
+                return 0;
+
+            if ((p[1] & 0x07) == 0x06)
+                *mem = IDLE_MEM_HL;
+
+            return 2;
+    }
+
+    return 0;
+}
+
+/* CPU address of a ROM offset */
+uint16_t idle_cpu_addr(size_t o)
+{
+    return (o < 0x4000) ? o : 0x4000 + (o & 0x3FFF);
+}
+
+/* a loop ending with the branch at offset o? add it */
+void idle_add(uint8_t *rom, size_t sz, size_t o, size_t *max)
+{
+    idle_loop_t *l, *tmp;
+    size_t t, len, blen;
+    uint16_t addr, nn;
+    uint8_t mem, n, i;
+
+    /* JP is 3 bytes, JR 2 */
+    blen = (rom[o] == 0xC3 || (rom[o] & 0xE7) == 0xC2) ? 3 : 2;
+
+    if (o + blen > sz)
+        return;
+
+    /* branch target, into the same bank */
+    if (blen == 2)
+        t = o + 2 + (int8_t) rom[o + 1];
+    else
+    {
+        nn = rom[o + 1] | (rom[o + 2] << 8);
+
+        if (nn >= 0x8000 || (nn >= 0x4000) != (o >= 0x4000))
+            return;
+
+        t = (o & ~0x3FFF) + (nn & 0x3FFF);
+    }
+
+    if (t > o || o + blen - t > IDLE_CODE_MAX || (t >> 14) != (o >> 14))
+        return;
+
+    if (idle_count == *max)
+    {
+        tmp = realloc(idle_loops, (*max ? *max * 2 : 256) * 
+                                  sizeof(idle_loop_t));
+
+        if (tmp == NULL)
+            return;
+
+        idle_loops = tmp;
+        *max = *max ? *max * 2 : 256;
+    }
+
+    l = &idle_loops[idle_count];
+
+    memset(l, 0, sizeof(idle_loop_t));
+
+    /* every instruction up to the branch must be harmless */
+    for (n = 0, i = 0; t + i < o; n++)
+    {
+        if (n == IDLE_OPS_MAX - 1)
+            return;
+
+        len = idle_decode(&rom[t + i], o - t - i, &mem, &addr);
+
+        if (len == 0)
+            return;
+
+        if (mem == IDLE_MEM_DIRECT)
+        {
+            if (idle_mem_class(addr) == 0xFF)
+                return;
+
+            l->flags |= idle_mem_class(addr);
+        }
+        else if (mem != IDLE_MEM_NONE)
+            l->flags |= IDLE_FLAG_INDIRECT;
+
+        l->pc[n] = idle_cpu_addr(t + i);
+        l->mem[n] = mem;
+
+        i += len;
+    }
+
+    /* last instruction is the branch */
+    l->pc[n] = idle_cpu_addr(o);
+    l->mem[n] = IDLE_MEM_NONE;
+    l->n = n + 1;
+
+    l->offset = t;
+    l->code_sz = o + blen - t;
+    memcpy(l->code, &rom[t], l->code_sz);
+
+    idle_count++;
+}
+
+int idle_cmp(const void *a, const void *b)
+{
+    const idle_loop_t *la = a, *lb = b;
+
+    if (la->offset != lb->offset)
+        return (la->offset < lb->offset) ? -1 : 1;
+
+    /* keep the shortest loop of a start */
+    return la->code_sz - lb->code_sz;
+}
+
+/* find the busy waits of a ROM: short loops of reads and compares */
+/* closed by a branch back (JR/JP, conditional or not)             */
+char idle_analyze(uint8_t *rom, size_t sz)
+{
+    size_t o, max = 0, n = 0;
+
+    free(idle_loops);
+    free(idle_map);
+
+    idle_loops = NULL;
+    idle_count = 0;
+    idle_rom_sz = 0;
+    idle_reset();
+
+    idle_map = calloc(sz / 8 + 1, 1);
+
+    if (idle_map == NULL)
+        return 1;
+
+    for (o = 0; o < sz; o++)
+    {
+        switch (rom[o])
+        {
+            /* JR, JR cc, JP, JP cc */
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+                idle_add(rom, sz, o, &max);
+        }
+    }
+
+    qsort(idle_loops, idle_count, sizeof(idle_loop_t), idle_cmp);
+
+    /* one loop per start */
+    for (o = 0; o < idle_count; o++)
+    {
+        if (n && idle_loops[n - 1].offset == idle_loops[o].offset)
+            continue;
+
+        idle_loops[n++] = idle_loops[o];
+        idle_map[idle_loops[o].offset >> 3] |= 1 << (idle_loops[o].offset & 7);
+    }
+
+    idle_count = n;
+    idle_rom_sz = sz;
+
+    utils_log("Busy wait candidates: %zu\n", idle_count);
+
+    return 0;
+}
+
+/* loop starting at pc of the mapped bank, NULL if none */
+idle_loop_t *idle_lookup(uint16_t pc)
+{
+    size_t o, lo, hi, mid;
+    idle_loop_t *l;
+
+    if (pc < 0x4000)
+        o = pc;
+    else if (pc < 0x8000)
+        o = mmu.rom_current_bank * 0x4000 + pc - 0x4000;
+    else
+        return NULL;
+
+    if (o >= idle_rom_sz || (idle_map[o >> 3] & (1 << (o & 7))) == 0)
+        return NULL;
+
+    lo = 0;
+    hi = idle_count;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+
+        if (idle_loops[mid].offset < o)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    l = &idle_loops[lo];
+
+    if (l->n == 0)
+        return NULL;
+
+    /* MBC mappings not following the bank number */
+    if (memcmp(&mmu.memory[pc], l->code, l->code_sz))
+        return NULL;
+
+    return l;
+}
+
+/* the CPU is at the start of l after a branch back - record next */
+/* iteration, registers but A and flags don't change into it       */
+void idle_record_start(idle_loop_t *l, uint8_t a, uint8_t f, 
+                       uint16_t bc, uint16_t de, uint16_t hl)
+{
+    uint8_t i, c, cls = l->flags & IDLE_FLAG_GPU;
+
+    /* runtime refinement: where indirect reads point to */
+    if (l->flags & IDLE_FLAG_INDIRECT)
+    {
+        for (i = 0; i < l->n; i++)
+        {
+            switch (l->mem[i])
+            {
+                case IDLE_MEM_BC: c = idle_mem_class(bc); break;
+                case IDLE_MEM_DE: c = idle_mem_class(de); break;
+                case IDLE_MEM_HL: c = idle_mem_class(hl); break;
+                case IDLE_MEM_C:  c = idle_mem_class(0xFF00 + (bc & 0xFF)); 
+                                  break;
+                default:          c = 0;
+            }
+
+            if (c == 0xFF)
+            {
+                /* keeps reading hardware, stop trying */
+                if (++l->rejects == IDLE_REJECTS_MAX)
+                    l->n = 0;
+
+                return;
+            }
+
+            cls |= c;
+        }
+    }
+
+    idle_rec = l;
+    idle_k = 0;
+    idle_gpu = cls;
+    idle_a0 = a;
+    idle_f0 = f;
+    idle_gpu_next = gpu.next;
+    idle_frame = gpu.frame_counter;
+}
+
+/* instruction at pc of the recorded iteration executed, CPU is at next */
+/* return values                                                        */
+/* 0: recording                                                         */
+/* 1: iteration didn't change anything, the next ones can be skipped    */
+/* 2: loop left or interrupted                                          */
+
+char idle_record(uint16_t pc, uint16_t next, uint8_t a, uint8_t f, 
+                 uint_fast32_t cycles)
+{
+    idle_loop_t *l = idle_rec;
+    uint_fast16_t frame;
+
+    if (pc != l->pc[idle_k])
+    {
+        idle_rec = NULL;
+        return 2;
+    }
+
+    /* a skip started from here has to see a frame ended by this one */
+    frame = idle_frame;
+    idle_frame = gpu.frame_counter;
+
+    idle_a[idle_k] = a;
+    idle_f[idle_k] = f;
+    idle_cyc[idle_k] = cycles;
+
+    if (++idle_k < l->n)
+    {
+        if (next == l->pc[idle_k])
+            return 0;
+
+        idle_rec = NULL;
+        return 2;
+    }
+
+    if (next != l->pc[0])
+    {
+        idle_rec = NULL;
+        return 2;
+    }
+
+    /* same registers and same values read, a fixed point */
+    if (a == idle_a0 && f == idle_f0 && 
+        (!idle_gpu || gpu.next == idle_gpu_next))
+    {
+        idle_rec = NULL;
+        idle_cur = l;
+        idle_frame = frame;
+        return 1;
+    }
+
+    /* not yet, try with the next iteration */
+    idle_k = 0;
+    idle_a0 = a;
+    idle_f0 = f;
+    idle_gpu_next = gpu.next;
+
+    return 0;
+}
+
+/* run the hardware for the iterations of the recorded loop, till the */
+/* next event the CPU would see: an interrupt to serve, a GPU step    */
+/* changing LY/STAT, a new frame, a movie event or the horizon.       */
+/* return the address of the next instruction, A and flags as the    */
+/* CPU would have them there                                          */
+uint16_t idle_skip(uint8_t ime, uint8_t *a, uint8_t *f)
+{
+    idle_loop_t *l = idle_cur;
+    uint_fast16_t frame = idle_frame;
+    uint_fast32_t start = cycles.cnt;
+    uint_fast32_t limit, m, i;
+    uint8_t k = 0;
+
+    /* a frame time at most, other threads' commands wait meanwhile */
+    limit = start + (70224 << global_cpu_double_speed);
+
+    if (idle_horizon < limit)
+        limit = idle_horizon;
+
+    for (;;)
+    {
+        /* something to do before the next instruction? the branch */
+        /* closing the recorded iteration could have raised it too */
+        if (gpu.frame_counter != frame || 
+            cycles.cnt >= movie_next || cycles.cnt >= limit || 
+            (ime && (mmu.memory[0xFF0F] & mmu.memory[0xFFFF] & 0x1F)) ||
+            global_quit)
+            break;
+
+        m = idle_cyc[k];
+
+        /* LY/STAT could change while the instruction runs */
+        if (idle_gpu && gpu.next - cycles.cnt <= m)
+            break;
+
+        for (i = 0; i < m; i += 4)
+            cycles_step();
+
+        if (++k == l->n)
+            k = 0;
+    }
+
+    STATS_INC(STATS_CNT_IDLE_SKIPS);
+    STATS_ADD(STATS_CNT_IDLE_CYCLES, cycles.cnt - start);
+
+    /* registers as left by the previous instruction */
+    *a = idle_a[k ? k - 1 : l->n - 1];
+    *f = idle_f[k ? k - 1 : l->n - 1];
+
+    return l->pc[k];
+}
+
+/* machine state jumped, a recording in progress is meaningless */
+void idle_reset()
+{
+    idle_rec = NULL;
+}
@@ -0,0 +1,98 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifndef __IDLE_HDR__
+#define __IDLE_HDR__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* instructions of a loop, the last one branches back to the first */
+#define IDLE_OPS_MAX   8
+
+/* bytes of a loop, branch included */
+#define IDLE_CODE_MAX  16
+
+/* times a loop can read something not skippable before being dropped */
+#define IDLE_REJECTS_MAX 8
+
+/* loop reads LY/STAT, their value changes at every GPU step */
+#define IDLE_FLAG_GPU      0x01
+
+/* loop reads through HL, BC, DE or C - known only at runtime */
+#define IDLE_FLAG_INDIRECT 0x02
+
+/* memory read by an instruction */
+enum {
+    IDLE_MEM_NONE,
+    IDLE_MEM_DIRECT,
+    IDLE_MEM_BC,
+    IDLE_MEM_DE,
+    IDLE_MEM_HL,
+    IDLE_MEM_C
+};
+
+/* a busy wait found into the ROM: reads, compares and a branch back */
+typedef struct idle_loop_s
+{
+    /* offset of the first instruction into the ROM, key of the table */
+    uint32_t  offset;
+
+    /* CPU address of every instruction */
+    uint16_t  pc[IDLE_OPS_MAX];
+
+    /* instructions, 0 = dropped */
+    uint8_t   n;
+
+    /* IDLE_FLAG_* */
+    uint8_t   flags;
+
+    /* IDLE_MEM_* read by every instruction */
+    uint8_t   mem[IDLE_OPS_MAX];
+
+    uint8_t   rejects;
+
+    /* bytes of the loop, to check they are the mapped ones */
+    uint8_t   code_sz;
+    uint8_t   code[IDLE_CODE_MAX];
+
+} idle_loop_t;
+
+/* skipping busy waits (off by default) - checked on every backward branch */
+extern char         idle_on;
+
+/* loop whose iteration is being recorded, NULL if none */
+extern idle_loop_t *idle_rec;
+
+/* frame loops bounded by time don't let a skip go past this cycle */
+extern uint_fast32_t idle_horizon;
+
+/* prototypes */
+char         idle_analyze(uint8_t *rom, size_t sz);
+idle_loop_t *idle_lookup(uint16_t pc);
+char         idle_record(uint16_t pc, uint16_t next, uint8_t a, uint8_t f, 
+                         uint_fast32_t cycles);
+void         idle_record_start(idle_loop_t *l, uint8_t a, uint8_t f, 
+                               uint16_t bc, uint16_t de, uint16_t hl);
+void         idle_reset();
+uint16_t     idle_skip(uint8_t ime, uint8_t *a, uint8_t *f);
+
+#endif
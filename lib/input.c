@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#include "input.h"
+
 /* button states */
 char input_key_left;
 char input_key_right;
@@ -100,3 +102,38 @@ void input_set_key_b(char state) { input_key_b = state; }
 void input_set_key_select(char state) { input_key_select = state; }
 void input_set_key_start(char state) { input_key_start = state; }
 
+/* all the keys as a bitmask, bit n = INPUT_KEY n */
+uint8_t input_get_state()
+{
+    return (input_key_right  ? 1 << INPUT_KEY_RIGHT  : 0) |
+           (input_key_left   ? 1 << INPUT_KEY_LEFT   : 0) |
+           (input_key_up     ? 1 << INPUT_KEY_UP     : 0) |
+           (input_key_down   ? 1 << INPUT_KEY_DOWN   : 0) |
+           (input_key_a      ? 1 << INPUT_KEY_A      : 0) |
+           (input_key_b      ? 1 << INPUT_KEY_B      : 0) |
+           (input_key_select ? 1 << INPUT_KEY_SELECT : 0) |
+           (input_key_start  ? 1 << INPUT_KEY_START  : 0);
+}
+
+void input_set_state(uint8_t keys)
+{
+    uint8_t i;
+
+    for (i = INPUT_KEY_RIGHT; i <= INPUT_KEY_START; i++)
+        input_set_key(i, (keys >> i) & 0x01);
+}
+
+void input_set_key(uint8_t key, char state)
+{
+    switch (key)
+    {
+        case INPUT_KEY_RIGHT:  input_key_right = state;  break;
+        case INPUT_KEY_LEFT:   input_key_left = state;   break;
+        case INPUT_KEY_UP:     input_key_up = state;     break;
+        case INPUT_KEY_DOWN:   input_key_down = state;   break;
+        case INPUT_KEY_A:      input_key_a = state;      break;
+        case INPUT_KEY_B:      input_key_b = state;      break;
+        case INPUT_KEY_SELECT: input_key_select = state; break;
+        case INPUT_KEY_START:  input_key_start = state;  break;
+    }
+}
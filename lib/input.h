@@ -20,9 +20,24 @@
 #ifndef __INPUT_HDR__
 #define __INPUT_HDR__
 
+/* joypad keys */
+enum {
+    INPUT_KEY_RIGHT,
+    INPUT_KEY_LEFT,
+    INPUT_KEY_UP,
+    INPUT_KEY_DOWN,
+    INPUT_KEY_A,
+    INPUT_KEY_B,
+    INPUT_KEY_SELECT,
+    INPUT_KEY_START
+};
+
 /* prototypes */
 uint8_t input_get_keys(uint8_t line);
+uint8_t input_get_state();
 uint8_t input_init();
+void    input_set_key(uint8_t key, char state);
+void    input_set_state(uint8_t keys);
 void    input_set_key_left(char state);
 void    input_set_key_right(char state);
 void    input_set_key_up(char state);
@@ -0,0 +1,291 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bootcache.h"
+#include "cartridge.h"
+#include "cycles.h"
+#include "gameboy.h"
+#include "global.h"
+#include "gpu.h"
+#include "job.h"
+#include "mmu.h"
+#include "movie.h"
+#include "persist.h"
+#include "sound.h"
+#include "utils.h"
+
+/* nothing to present */
+void job_frame_cb() {}
+
+char *job_status_name(uint8_t status)
+{
+    switch (status)
+    {
+        case JOB_PENDING: return "pending";
+        case JOB_OK:      return "ok";
+        case JOB_ERROR:   return "error";
+        case JOB_CRASHED: return "crashed";
+        case JOB_TIMEOUT: return "timeout";
+    }
+
+    return "unknown";
+}
+
+/* parse "rom movie|- frames [hash,ram,time]"                  */
+/* return values                                               */
+/* 0: OK                                                       */
+/* 1: malformed line                                           */
+/* 2: empty line or comment                                    */
+
+char job_parse(char *line, job_t *j)
+{
+    char outputs[64] = "hash,time";
+    char *tok;
+    int n;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+
+    if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0')
+        return 2;
+
+    n = sscanf(line, "%1023s %1023s %u %63s", j->rom, j->movie, 
+               &j->frames, outputs);
+
+    if (n < 3 || j->frames == 0)
+        return 1;
+
+    if (strcmp(j->movie, "-") == 0)
+        j->movie[0] = '\0';
+
+    j->boot = 0;
+    j->outputs = 0;
+
+    for (tok = strtok(outputs, ","); tok; tok = strtok(NULL, ","))
+    {
+        if (strcmp(tok, "hash") == 0)
+            j->outputs |= JOB_OUT_HASH;
+        else if (strcmp(tok, "ram") == 0)
+            j->outputs |= JOB_OUT_RAM;
+        else if (strcmp(tok, "time") == 0)
+            j->outputs |= JOB_OUT_TIME;
+        else
+            return 1;
+    }
+
+    return 0;
+}
+
+/* dump work RAM and high RAM as they are mapped */
+char job_dump_ram(char *fn)
+{
+    uint8_t buf[0x2000 + 0x7F];
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < 0x2000; i++)
+        buf[i] = mmu_read_no_cyc(0xC000 + i);
+
+    for (i = 0; i < 0x7F; i++)
+        buf[0x2000 + i] = mmu_read_no_cyc(0xFF80 + i);
+
+    fp = fopen(fn, "w");
+
+    if (fp == NULL)
+        return 1;
+
+    fwrite(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    return 0;
+}
+
+/* load rom and power on, deterministic and uncapped */
+char job_load(char *rom)
+{
+    global_init();
+    global_deterministic = 1;
+    global_uncapped = 1;
+
+    if (cartridge_load(rom))
+    {
+        utils_log_error("Cannot load %s\n", rom);
+        return 1;
+    }
+
+    gameboy_init();
+    gpu_init(&job_frame_cb);
+    sound_set_output_rate(44100);
+
+    /* movies count cycles from power on */
+    cycles.cnt = 0;
+
+    return 0;
+}
+
+/* run j from the current machine state, loaded by job_load() */
+char job_exec(job_t *j, job_result_t *r, char *ram_fn)
+{
+    struct timespec t0, t1;
+    uint_fast16_t wr;
+    uint32_t i;
+
+    memset(r, 0, sizeof(job_result_t));
+    r->status = JOB_ERROR;
+
+    if (j->boot)
+    {
+        if (bootcache_reach(j->movie[0] ? j->movie : NULL, j->boot))
+            return 1;
+    }
+    else if (j->movie[0] && movie_play(j->movie))
+        return 1;
+
+    r->video = UTILS_HASH64_INIT;
+    r->audio = UTILS_HASH64_INIT;
+    r->cycles = cycles.cnt;
+    wr = sound.buf_wr;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < j->frames; i++)
+    {
+        gameboy_run_frame();
+
+        r->cycles = cycles.cnt;
+
+        if (!(j->outputs & JOB_OUT_HASH))
+            continue;
+
+        r->video = utils_hash64(gpu_get_frame_buffer(), 
+                                160 * 144 * sizeof(uint16_t), r->video);
+
+        while (wr != sound.buf_wr)
+        {
+            r->audio = utils_hash64(&sound.buf[wr], sizeof(int16_t), 
+                                    r->audio);
+
+            if (++wr == SOUND_BUF_SZ)
+                wr = 0;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    r->frames = i;
+    r->ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + 
+            (t1.tv_nsec - t0.tv_nsec);
+
+    if ((j->outputs & JOB_OUT_RAM) && job_dump_ram(ram_fn))
+    {
+        utils_log_error("Cannot write %s\n", ram_fn);
+        return 1;
+    }
+
+    movie_stop();
+    persist_term();
+    utils_log_stop();
+
+    r->status = JOB_OK;
+
+    return 0;
+}
+
+/* run a job in the calling process - the machine is global, so it's */
+/* meant to be called in a fresh process                             */
+char job_run(job_t *j, job_result_t *r, char *ram_fn)
+{
+    if (job_load(j->rom))
+    {
+        memset(r, 0, sizeof(job_result_t));
+        r->status = JOB_ERROR;
+        return 1;
+    }
+
+    return job_exec(j, r, ram_fn);
+}
+
+/* copy s into a JSON string body, escaping quotes, backslashes */
+/* and control chars. truncated (never inside an escape) to sz   */
+void job_json_escape(const char *s, char *out, size_t sz)
+{
+    size_t n = 0;
+    int l;
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            l = snprintf(out + n, sz - n, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            l = snprintf(out + n, sz - n, "\\u%04x", (unsigned char) *s);
+        else
+            l = snprintf(out + n, sz - n, "%c", *s);
+
+        if (l >= sz - n)
+            break;
+
+        n += l;
+    }
+
+    out[n] = '\0';
+}
+
+/* result fields as JSON members, without braces */
+int job_result_json(job_t *j, job_result_t *r, char *ram_fn, 
+                    char *buf, size_t sz)
+{
+    char rom[sizeof(j->rom) * 2], movie[sizeof(j->movie) * 2];
+    char ram[2048];
+    int n;
+
+    job_json_escape(j->rom, rom, sizeof(rom));
+    job_json_escape(j->movie, movie, sizeof(movie));
+
+    n = snprintf(buf, sz, "\"rom\": \"%s\", \"movie\": \"%s\", "
+                          "\"status\": \"%s\", \"frames\": %u",
+                          rom, movie, job_status_name(r->status), 
+                          r->frames);
+
+    if (r->status == JOB_OK && (j->outputs & JOB_OUT_HASH) && n < sz)
+        n += snprintf(buf + n, sz - n, ", \"video_hash\": \"%016llx\", "
+                                       "\"audio_hash\": \"%016llx\"",
+                                       (unsigned long long) r->video,
+                                       (unsigned long long) r->audio);
+
+    if (r->status == JOB_OK && (j->outputs & JOB_OUT_RAM) && n < sz)
+    {
+        job_json_escape(ram_fn, ram, sizeof(ram));
+        n += snprintf(buf + n, sz - n, ", \"ram\": \"%s\"", ram);
+    }
+
+    if (r->status == JOB_OK && (j->outputs & JOB_OUT_TIME) && n < sz)
+        n += snprintf(buf + n, sz - n, ", \"cycles\": %llu, \"ms\": %.3f, "
+                                       "\"fps\": %.1f",
+                                       (unsigned long long) r->cycles, 
+                                       r->ns / 1e6, r->ns ? 
+                                       r->frames * 1e9 / r->ns : 0);
+
+    return n;
+}
@@ -0,0 +1,85 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __JOB_HDR__
+#define __JOB_HDR__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* outputs a job can ask for */
+#define JOB_OUT_HASH 0x01
+#define JOB_OUT_RAM  0x02
+#define JOB_OUT_TIME 0x04
+
+/* job status */
+enum {
+    JOB_PENDING,
+    JOB_OK,
+    JOB_ERROR,
+    JOB_CRASHED,
+    JOB_TIMEOUT
+};
+
+/* a headless session: ROM, optional movie, frames to run */
+typedef struct job_s
+{
+    char     rom[1024];
+
+    /* empty string if no movie */
+    char     movie[1024];
+
+    uint32_t frames;
+
+    /* frames before the job starts, restored from the boot cache */
+    uint32_t boot;
+
+    /* JOB_OUT_* flags */
+    uint8_t  outputs;
+
+} job_t;
+
+/* fixed size, so it can live in memory shared between processes */
+typedef struct job_result_s
+{
+    uint8_t  status;
+    uint32_t frames;
+
+    /* chained hashes of every frame and of every audio sample */
+    uint64_t video;
+    uint64_t audio;
+
+    /* emulated cycles and wall clock time */
+    uint64_t cycles;
+    uint64_t ns;
+
+} job_result_t;
+
+/* prototypes */
+char  job_exec(job_t *j, job_result_t *r, char *ram_fn);
+void  job_json_escape(const char *s, char *out, size_t sz);
+char  job_load(char *rom);
+char  job_parse(char *line, job_t *j);
+int   job_result_json(job_t *j, job_result_t *r, char *ram_fn, 
+                      char *buf, size_t sz);
+char  job_run(job_t *j, job_result_t *r, char *ram_fn);
+char *job_status_name(uint8_t status);
+
+#endif
@@ -23,8 +23,11 @@
 #include "interrupt.h"
 #include "input.h"
 #include "mmu.h"
+#include "persist.h"
 #include "sound.h"
 #include "serial.h"
+#include "stats.h"
+#include "trace.h"
 #include "timer.h"
 #include "utils.h"
 
@@ -63,6 +66,18 @@ mmu_t mmu;
 /* function to call when rumble */
 mmu_rumble_cb_t mmu_rumble_cb = NULL;
 
+/* battery backed stuff as it was written last time */
+uint8_t *mmu_ram_flushed = NULL;
+size_t   mmu_ram_flushed_sz = 0;
+time_t   mmu_rtc_flushed = 0;
+
+/* read/write variants of the cartridge model, see mmu_set_model() */
+uint8_t mmu_read_dmg(uint16_t a);
+void    mmu_write_dmg(uint16_t a, uint8_t v);
+
+mmu_read_fn_t  mmu_read_fn = mmu_read_dmg;
+mmu_write_fn_t mmu_write_fn = mmu_write_dmg;
+
 
 /* return absolute memory address */
 void *mmu_addr(uint16_t a)
@@ -202,10 +217,57 @@ void mmu_init(uint8_t c, uint8_t rn)
     mmu.dma_cycles = 0;
     mmu.dma_address = 0;
     mmu.rtc_mode = 0;
-    time(&mmu.rtc_time);
+    mmu.rtc_time = mmu_rtc_now();
+
+    /* reset memory */
+    bzero(mmu.memory, 65536);
+}
+
+/* RTC wall clock - emulated seconds when running deterministic */
+time_t mmu_rtc_now()
+{
+    if (global_deterministic)
+        return (time_t) cycles.seconds;
+
+    return time(NULL);
+}
+
+/* back to power-on state, keeping cartridge and battery backed RAM */
+void mmu_reset()
+{
+    uint8_t ext[0x2000];
+
+    /* dump current external RAM bank where mmu_save_ram expects it */
+    if (ram_sz > 0x2000 && mmu.ram_external_enabled)
+        memcpy(&ram[0x2000 * mmu.ram_current_bank],
+               &mmu.memory[0xA000], 0x2000);
+
+    memcpy(ext, &mmu.memory[0xA000], 0x2000);
+
+    mmu.rom_current_bank = 0x01;
+    mmu.ram_current_bank = 0x00;
+    mmu.vram_idx = 0;
+    mmu.wram_current_bank = 1;
+    mmu.ram_external_enabled = 0;
+    mmu.banking = 0;
+    mmu.dma_cycles = 0;
+    mmu.dma_address = 0;
+    mmu.dma_next = 1;
+    mmu.hdma_to_transfer = 0;
+    mmu.rtc_mode = 0;
 
     /* reset memory */
     bzero(mmu.memory, 65536);
+    bzero(mmu.vram0, 0x2000);
+    bzero(mmu.vram1, 0x2000);
+    bzero(mmu.wram, 0x8000);
+
+    /* small RAMs live straight into 0xA000 area */
+    memcpy(&mmu.memory[0xA000],
+           ram_sz > 0x2000 ? mmu.ram_internal : ext, 0x2000);
+
+    /* first 32k of the cartridge */
+    memcpy(mmu.memory, cart_memory, 2 << 14);
 }
 
 /* init (alloc) system state.memory */
@@ -241,8 +303,10 @@ void mmu_move(uint16_t d, uint16_t s)
 }
 
 /* read 8 bit data from a memory addres */
-uint8_t mmu_read(uint16_t a)
+GLOBAL_MODEL_BODY uint8_t mmu_read_model(uint16_t a, const char cgb)
 {
+    STATS_SCOPE(STATS_SCOPE_MMU_READ);
+
     /* always takes 4 cycles */
     cycles_step();
 
@@ -253,7 +317,7 @@ uint8_t mmu_read(uint16_t a)
     /* test VRAM */
     if (a < 0xA000)
     {
-        if (global_cgb)
+        if (cgb)
         {
             if (mmu.vram_idx == 0)
                 return mmu.vram0[a - 0x8000];
@@ -318,7 +382,7 @@ uint8_t mmu_read(uint16_t a)
         /* CGB HDMA transfer */
         case 0xFF55:
 
-            if (!global_cgb) break;
+            if (!cgb) break;
 
             /* HDMA result */
             if (mmu.hdma_to_transfer)
@@ -332,7 +396,7 @@ uint8_t mmu_read(uint16_t a)
         case 0xFF6A:
         case 0xFF6B:
 
-            if (!global_cgb) break;
+            if (!cgb) break;
 
             /* color palettes registers */
             return gpu_read_reg(a);
@@ -346,6 +410,16 @@ uint8_t mmu_read(uint16_t a)
     return mmu.memory[a];
 }
 
+uint8_t mmu_read_dmg(uint16_t a)
+{
+    return mmu_read_model(a, 0);
+}
+
+uint8_t mmu_read_cgb(uint16_t a)
+{
+    return mmu_read_model(a, 1);
+}
+
 /* read 16 bit data from a memory addres */
 unsigned int mmu_read_16(uint16_t a)
 {
@@ -361,6 +435,68 @@ uint8_t mmu_read_no_cyc(uint16_t a)
     return mmu.memory[a];
 }
 
+/* read a from a bank, mapped or not (not affecting cycles). bank is   */
+/* the ROM bank for 0x4000-0x7FFF, VRAM bank for 0x8000-0x9FFF,        */
+/* cartridge RAM bank for 0xA000-0xBFFF and WRAM bank for 0xD000-0xDFFF */
+uint8_t mmu_read_bank(uint16_t bank, uint16_t a)
+{
+    if (a < 0x4000)
+        return mmu.memory[a];
+
+    if (a < 0x8000)
+        return cart_memory[(bank * 0x4000 + a - 0x4000) & 
+                           (sizeof(cart_memory) - 1)];
+
+    if (a < 0xA000)
+    {
+        if (!global_cgb)
+            return mmu.memory[a];
+
+        return bank ? mmu.vram1[a - 0x8000] : mmu.vram0[a - 0x8000];
+    }
+
+    if (a < 0xC000)
+    {
+        /* MBC3 and MBC5 keep the current bank at 0xA000 only while    */
+        /* external RAM is enabled, otherwise it's in ram[]. other MBCs */
+        /* always keep it at 0xA000                                     */
+        if (bank == mmu.ram_current_bank &&
+            (mmu.ram_external_enabled ||
+             (mmu.carttype != 0x10 && mmu.carttype != 0x13 &&
+              (mmu.carttype < 0x19 || mmu.carttype > 0x1E))))
+            return mmu.memory[a];
+
+        if (0x2000 * bank + a - 0xA000 >= ram_sz)
+            return 0xFF;
+
+        return ram[0x2000 * bank + a - 0xA000];
+    }
+
+    if (a >= 0xD000 && a < 0xE000)
+    {
+        bank &= 0x07;
+
+        if (!global_cgb || bank == 0 || bank == mmu.wram_current_bank)
+            return mmu.memory[a];
+
+        return mmu.wram[0x1000 * bank + a - 0xD000];
+    }
+
+    return mmu_read_no_cyc(a);
+}
+
+/* keep a copy of the battery backed RAM as it is on disk */
+void mmu_ram_flushed_set(uint8_t *img, size_t sz)
+{
+    free(mmu_ram_flushed);
+
+    mmu_ram_flushed = malloc(sz);
+    mmu_ram_flushed_sz = sz;
+
+    if (mmu_ram_flushed)
+        memcpy(mmu_ram_flushed, img, sz);
+}
+
 void mmu_restore_ram(char *fn)
 {   
     /* save only if cartridge got a battery */
@@ -378,21 +514,37 @@ void mmu_restore_ram(char *fn)
         mmu.carttype == 0xFF)
     {
         FILE *fp = fopen(fn, "r+");
+        uint8_t *img;
+        size_t n;
 
         /* it could be not present */
         if (fp == NULL)
             return;
 
+        /* loaded content is on disk already, a flush without changes */
+        /* has nothing to write. a short file has to be written again */
         if (ram_sz <= 0x2000)
         {
             /* no need to put togheter pieces of ram banks */
-            fread(&mmu.memory[0xA000], ram_sz, 1, fp);
+            if (fread(&mmu.memory[0xA000], ram_sz, 1, fp) == 1)
+                mmu_ram_flushed_set(&mmu.memory[0xA000], ram_sz);
         }
         else
         {
             /* read entire file into ram buffer */
-            fread(mmu.ram_internal, 0x2000, 1, fp);
-            fread(ram, ram_sz, 1, fp);
+            n = fread(mmu.ram_internal, 1, 0x2000, fp);
+            n += fread(ram, 1, ram_sz, fp);
+
+            /* same layout of mmu_save_ram() */
+            if (n == 0x2000 + ram_sz && (img = malloc(n)) != NULL)
+            {
+                memcpy(img, mmu.ram_internal, 0x2000);
+                memcpy(&img[0x2000], ram, ram_sz);
+
+                mmu_ram_flushed_set(img, n);
+
+                free(img);
+            }
 
             /* copy internal RAM to 0xA000 address */
             memcpy(&mmu.memory[0xA000], mmu.ram_internal, 0x2000);
@@ -414,25 +566,19 @@ void mmu_restore_rtc(char *fn)
         if (fp == NULL)
         {
             /* just pick current time */
-            time(&mmu.rtc_time);
+            mmu.rtc_time = mmu_rtc_now();
             return;
         }
 
         /* read last saved time */
         fscanf(fp, "%ld", &mmu.rtc_time);
 
+        mmu_rtc_flushed = mmu.rtc_time;
+
         fclose(fp);
     }
 }
 
-void mmu_restore_stat(FILE *fp)
-{
-    fread(&mmu, 1, sizeof(mmu_t), fp);
-
-    if (ram_sz)
-        fread(ram, 1, ram_sz, fp);
-}
-
 void mmu_save_ram(char *fn)
 {
     /* save only if cartridge got a battery */
@@ -449,18 +595,14 @@ void mmu_save_ram(char *fn)
         mmu.carttype == 0x22 ||
         mmu.carttype == 0xff)
     {
-        FILE *fp = fopen(fn, "w+");
-
-        if (fp == NULL)
-        {
-            printf("Error dumping RAM\n");
-            return;
-        } 
+        uint8_t *img;
+        size_t sz;
 
         if (ram_sz <= 0x2000)
         {
             /* no need to put togheter pieces of ram banks */
-            fwrite(&mmu.memory[0xA000], ram_sz, 1, fp);
+            img = &mmu.memory[0xA000];
+            sz = ram_sz;
         }
         else
         {
@@ -474,12 +616,29 @@ void mmu_save_ram(char *fn)
                 memcpy(mmu.ram_internal,
                        &mmu.memory[0xA000], 0x2000);
            
-            /* dump the entire internal + external RAM */
-            fwrite(mmu.ram_internal, 0x2000, 1, fp); 
-            fwrite(ram, ram_sz, 1, fp); 
+            /* the entire internal + external RAM */
+            sz = 0x2000 + ram_sz;
+            img = malloc(sz);
+
+            if (img == NULL)
+                return;
+
+            memcpy(img, mmu.ram_internal, 0x2000);
+            memcpy(&img[0x2000], ram, ram_sz);
         }
 
-        fclose(fp);
+        /* nothing changed since last write? */
+        if (mmu_ram_flushed == NULL || mmu_ram_flushed_sz != sz ||
+            memcmp(mmu_ram_flushed, img, sz))
+        {
+            /* hand a copy to the persistence worker */
+            persist_write(fn, img, sz);
+
+            mmu_ram_flushed_set(img, sz);
+        }
+
+        if (img != &mmu.memory[0xA000])
+            free(img);
     }
 }
 
@@ -489,24 +648,60 @@ void mmu_save_rtc(char *fn)
     if (mmu.carttype == 0x10 ||
         mmu.carttype == 0x13)
     {
-        FILE *fp = fopen(fn, "w+");
+        char buf[32];
+        int len;
 
-        if (fp == NULL)
-        {
-            printf("Error saving RTC\n");
+        if (mmu.rtc_time == mmu_rtc_flushed)
             return;
-        }
 
-        fprintf(fp, "%ld", mmu.rtc_time);
+        len = snprintf(buf, sizeof(buf), "%ld", mmu.rtc_time);
+
+        persist_write(fn, buf, len);
+
+        mmu_rtc_flushed = mmu.rtc_time;
     }
 }
 
-void mmu_save_stat(FILE *fp)
+void mmu_serialize_stat(utils_stat_t *s)
 {
-    fwrite(&mmu, 1, sizeof(mmu_t), fp);
+    uint16_t rom_bank = mmu.rom_current_bank;
+
+    /* ROM area is rebuilt from the cartridge, no need to store it */
+    utils_stat_bytes(s, &mmu.memory[0x8000], 0x8000);
+
+    UTILS_STAT(s, mmu.vram0);
+    UTILS_STAT(s, mmu.vram1);
+    UTILS_STAT(s, mmu.vram_idx);
+    UTILS_STAT(s, mmu.ram_internal);
+    UTILS_STAT(s, mmu.ram_external_enabled);
+    UTILS_STAT(s, mmu.ram_current_bank);
+    UTILS_STAT(s, mmu.rom_current_bank);
+    UTILS_STAT(s, mmu.banking);
+    UTILS_STAT(s, mmu.wram);
+    UTILS_STAT(s, mmu.wram_current_bank);
+    UTILS_STAT64(s, mmu.dma_address);
+    UTILS_STAT64(s, mmu.dma_cycles);
+    UTILS_STAT64(s, mmu.dma_next);
+    UTILS_STAT16(s, mmu.hdma_src_address);
+    UTILS_STAT16(s, mmu.hdma_dst_address);
+    UTILS_STAT16(s, mmu.hdma_to_transfer);
+    UTILS_STAT(s, mmu.hdma_transfer_mode);
+    UTILS_STAT(s, mmu.hdma_current_line);
+    UTILS_STAT(s, mmu.rtc_mode);
+    UTILS_STAT64(s, mmu.rtc_time);
+    UTILS_STAT64(s, mmu.rtc_latch_time);
 
     if (ram_sz)
-        fwrite(ram, 1, ram_sz, fp);
+        utils_stat_bytes(s, ram, ram_sz);
+
+    /* ROM area only changes with banks and Gamegenie patches, */
+    /* leave it alone when it's already the right one          */
+    if (s->restore && (rom_bank != mmu.rom_current_bank || mmu.gg_count))
+    {
+        memcpy(mmu.memory, cart_memory, 0x4000);
+        memcpy(&mmu.memory[0x4000], 
+               &cart_memory[mmu.rom_current_bank * 0x4000], 0x4000);
+    }
 }
 
 char mmu_set_cheat(char *str)
@@ -614,7 +809,7 @@ char mmu_set_cheat(char *str)
         return 0;
     }
 
-    utils_log("Unknown cheat format");
+    utils_log_error("Unknown cheat format\n");
 
     return 1;
 }
@@ -631,16 +826,21 @@ void mmu_term()
         free(ram);
         ram = NULL;
     }
+
+    free(mmu_ram_flushed);
+    mmu_ram_flushed = NULL;
 }
 
-/* write 16 bit block on a memory address */
-void mmu_write(uint16_t a, uint8_t v)
+/* write 8 bit data to a memory address */
+GLOBAL_MODEL_BODY void mmu_write_model(uint16_t a, uint8_t v, const char cgb)
 {
+    STATS_SCOPE(STATS_SCOPE_MMU_WRITE);
+
     /* update cycles AFTER memory set */
     cycles_step();
 
     /* color gameboy stuff */
-    if (global_cgb)
+    if (cgb)
     {
         /* VRAM write? */
         if (a >= 0x8000 && a < 0xA000)
@@ -660,7 +860,7 @@ void mmu_write(uint16_t a, uint8_t v)
                 time_t t,s1,s2,m1,m2,h1,h2,d1,d2,days;
 
                 /* get current time */
-                time(&t);
+                t = mmu_rtc_now();
 
                 /* extract parts in seconds from current and ref times */
                 s1 = t % 60;
@@ -754,6 +954,8 @@ void mmu_write(uint16_t a, uint8_t v)
 
             mmu.wram_current_bank = new;
 
+            STATS_INC(STATS_CNT_WRAM_BANK);
+
             /* move new ram bank */
             memcpy(&mmu.memory[0xD000],
                    &mmu.wram[0x1000 * mmu.wram_current_bank],
@@ -770,6 +972,8 @@ void mmu_write(uint16_t a, uint8_t v)
             /* extract VRAM index from last bit */            
             mmu.vram_idx = (v & 0x01);
 
+            STATS_INC(STATS_CNT_VRAM_BANK);
+
             /* save current VRAM bank */
             mmu.memory[0xFF4F] = mmu.vram_idx;
 
@@ -841,6 +1045,9 @@ void mmu_write(uint16_t a, uint8_t v)
   
                             mmu.ram_current_bank = v;
 
+                            STATS_INC(STATS_CNT_RAM_BANK);
+                            TRACE(TRACE_RAM_BANK, mmu.ram_current_bank);
+
                             /* move new ram bank */
                             memcpy(&mmu.memory[0xA000], 
                                    &ram[0x2000 * mmu.ram_current_bank], 
@@ -948,6 +1155,9 @@ void mmu_write(uint16_t a, uint8_t v)
   
                             mmu.ram_current_bank = v & 0x0f;
 
+                            STATS_INC(STATS_CNT_RAM_BANK);
+                            TRACE(TRACE_RAM_BANK, mmu.ram_current_bank);
+
                             /* move new ram bank */
                             memcpy(&mmu.memory[0xA000],
                                    &ram[0x2000 * mmu.ram_current_bank],
@@ -964,7 +1174,7 @@ void mmu_write(uint16_t a, uint8_t v)
                 else if (a >= 0x6000 && a <= 0x7FFF)
                 {
                     /* latch clock data. move clock data to RTC registers */
-                    time(&mmu.rtc_latch_time);
+                    mmu.rtc_latch_time = mmu_rtc_now();
                 }
 
 
@@ -1060,7 +1270,8 @@ void mmu_write(uint16_t a, uint8_t v)
                     {
                         mask = 0x07;
 
-                        if (mmu_rumble_cb)
+                        /* not for frames to be rolled back */
+                        if (mmu_rumble_cb && !global_speculative)
                             (*mmu_rumble_cb) ((v & 0x08) ? 1 : 0);
 
                         /* check if we want to appizz the motor */
@@ -1086,6 +1297,9 @@ void mmu_write(uint16_t a, uint8_t v)
 
                         mmu.ram_current_bank = (v & 0x0f);
 
+                        STATS_INC(STATS_CNT_RAM_BANK);
+                        TRACE(TRACE_RAM_BANK, mmu.ram_current_bank);
+
                         /* move new ram bank */
                         memcpy(&mmu.memory[0xA000],
                                &ram[0x2000 * mmu.ram_current_bank],
@@ -1106,6 +1320,9 @@ void mmu_write(uint16_t a, uint8_t v)
             /* save new current bank */
             mmu.rom_current_bank = b;
 
+            STATS_INC(STATS_CNT_ROM_BANK);
+            TRACE(TRACE_ROM_BANK, b);
+
             /* re-apply cheats */
 //            mmu_apply_gg();
         }
@@ -1163,7 +1380,7 @@ void mmu_write(uint16_t a, uint8_t v)
             gpu_write_reg(a, v);
 
         /* CGB only registers */
-        if (global_cgb)
+        if (cgb)
         {
             switch (a)
             {
@@ -1248,6 +1465,8 @@ void mmu_write(uint16_t a, uint8_t v)
                     /* calc how many bytes gotta be transferred */
                     uint16_t to_transfer = ((v & 0x7f) + 1) * 0x10;
 
+                    STATS_INC(STATS_CNT_HDMA);
+
                     /* general must be done immediately */
                     if (mmu.hdma_transfer_mode == 0)
                     {
@@ -1266,6 +1485,9 @@ void mmu_write(uint16_t a, uint8_t v)
                         /* reset to_transfer var */
                         mmu.hdma_to_transfer = 0;
 
+                        STATS_ADD(STATS_CNT_HDMA_BYTES, to_transfer);
+                        TRACE(TRACE_HDMA, to_transfer);
+
                         /* move forward src and dst addresses =| */
                         mmu.hdma_src_address += to_transfer;
                         mmu.hdma_dst_address += to_transfer;
@@ -1291,6 +1513,9 @@ void mmu_write(uint16_t a, uint8_t v)
             /* calc source address */ 
             mmu.dma_address = v * 256;
 
+            STATS_INC(STATS_CNT_DMA);
+            TRACE(TRACE_DMA, mmu.dma_address);
+
             /* initialize counter, DMA needs 672 ticks */
             mmu.dma_next = cycles.cnt + 4; // 168 / 2;
         }
@@ -1299,6 +1524,23 @@ void mmu_write(uint16_t a, uint8_t v)
         mmu.memory[a] = v; 
 }
 
+void mmu_write_dmg(uint16_t a, uint8_t v)
+{
+    mmu_write_model(a, v, 0);
+}
+
+void mmu_write_cgb(uint16_t a, uint8_t v)
+{
+    mmu_write_model(a, v, 1);
+}
+
+/* pick read/write variants without the branches of the other model */
+void mmu_set_model(char cgb)
+{
+    mmu_read_fn = cgb ? mmu_read_cgb : mmu_read_dmg;
+    mmu_write_fn = cgb ? mmu_write_cgb : mmu_write_dmg;
+}
+
 /* write 16 bit block on a memory address */
 void mmu_write_16(uint16_t a, uint16_t v)
 {
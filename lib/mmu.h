@@ -24,6 +24,8 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "utils.h"
+
 typedef struct mmu_gamegenie_s {
 
     /* data necessary */
@@ -120,6 +122,13 @@ extern mmu_t mmu;
 /* callback function */
 typedef void (*mmu_rumble_cb_t) (uint8_t onoff);
 
+/* read/write instanced per model (DMG/CGB) */
+typedef uint8_t (*mmu_read_fn_t) (uint16_t a);
+typedef void    (*mmu_write_fn_t) (uint16_t a, uint8_t v);
+
+extern mmu_read_fn_t  mmu_read_fn;
+extern mmu_write_fn_t mmu_write_fn;
+
 /* functions prototypes */
 void         *mmu_addr(uint16_t a);
 void         *mmu_addr_vram0();
@@ -132,21 +141,34 @@ void          mmu_init_ram(uint32_t c);
 void          mmu_load(uint8_t *data, size_t sz, uint16_t a);
 void          mmu_load_cartridge(uint8_t *data, size_t sz);
 void          mmu_move(uint16_t d, uint16_t s);
+void          mmu_reset();
+uint8_t       mmu_read_bank(uint16_t bank, uint16_t a);
 uint8_t       mmu_read_no_cyc(uint16_t a);
-uint8_t       mmu_read(uint16_t a);
 unsigned int  mmu_read_16(uint16_t a);
 void          mmu_restore_ram(char *fn);
 void          mmu_restore_rtc(char *fn);
-void          mmu_restore_stat(FILE *fp);
+time_t        mmu_rtc_now();
 void          mmu_save_ram(char *fn);
 void          mmu_save_rtc(char *fn);
-void          mmu_save_stat(FILE *fp);
+void          mmu_serialize_stat(utils_stat_t *s);
 char          mmu_set_cheat(char *cheat);
+void          mmu_set_model(char cgb);
 void          mmu_set_rumble_cb(mmu_rumble_cb_t cb);
 void          mmu_step();
 void          mmu_term();
 void          mmu_write_no_cyc(uint16_t a, uint8_t v);
-void          mmu_write(uint16_t a, uint8_t v);
 void          mmu_write_16(uint16_t a, uint16_t v);
 
+/* read 8 bit data from a memory address */
+static inline uint8_t mmu_read(uint16_t a)
+{
+    return (*mmu_read_fn) (a);
+}
+
+/* write 8 bit data to a memory address */
+static inline void mmu_write(uint16_t a, uint8_t v)
+{
+    (*mmu_write_fn) (a, v);
+}
+
 #endif
@@ -0,0 +1,242 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "gpu.h"
+#include "input.h"
+#include "movie.h"
+#include "persist.h"
+#include "utils.h"
+
+/* current mode */
+uint8_t        movie_mode = MOVIE_MODE_NONE;
+
+/* events and next one to play */
+movie_event_t *movie_events = NULL;
+size_t         movie_count = 0;
+size_t         movie_max = 0;
+size_t         movie_idx = 0;
+
+/* nothing to play = never */
+uint_fast32_t  movie_next = UINT_FAST32_MAX;
+
+/* file to write when recording stops */
+char           movie_file[1024];
+
+
+/* append a new event with current keys */
+void movie_append(uint8_t keys)
+{
+    movie_event_t *p;
+
+    if (movie_count == movie_max)
+    {
+        p = realloc(movie_events, (movie_max ? movie_max * 2 : 1024) * 
+                                  sizeof(movie_event_t));
+
+        if (p == NULL)
+        {
+            utils_log_error("Cannot grow movie, input is lost\n");
+            return;
+        }
+
+        movie_events = p;
+        movie_max = movie_max ? movie_max * 2 : 1024;
+    }
+
+    p = &movie_events[movie_count++];
+
+    memset(p, 0, sizeof(movie_event_t));
+
+    p->cycles = cycles.cnt;
+    p->frame = gpu.frame_counter;
+    p->keys = keys;
+}
+
+/* joypad could be changed, record it if it's the case */
+void movie_input()
+{
+    uint8_t keys;
+
+    if (movie_mode != MOVIE_MODE_RECORD)
+        return;
+
+    keys = input_get_state();
+
+    if (movie_count && movie_events[movie_count - 1].keys == keys)
+        return;
+
+    movie_append(keys);
+}
+
+/* start recording from current machine state */
+char movie_record(char *fn)
+{
+    movie_stop();
+
+    snprintf(movie_file, sizeof(movie_file), "%s", fn);
+
+    movie_count = 0;
+    movie_mode = MOVIE_MODE_RECORD;
+
+    /* initial state of the joypad */
+    movie_append(input_get_state());
+
+    return 0;
+}
+
+/* load a movie and start playing it */
+char movie_play(char *fn)
+{
+    char magic[8];
+    size_t sz;
+
+    movie_stop();
+
+    FILE *fp = fopen(fn, "r");
+
+    if (fp == NULL)
+    {
+        utils_log_error("Cannot open movie %s\n", fn);
+        return 1;
+    }
+
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, MOVIE_MAGIC, 8))
+    {
+        utils_log("%s is not a movie\n", fn);
+        fclose(fp);
+        return 1;
+    }
+
+    /* events till the end of file */
+    fseek(fp, 0, SEEK_END);
+    sz = (ftell(fp) - 8) / sizeof(movie_event_t);
+    fseek(fp, 8, SEEK_SET);
+
+    movie_events = malloc((sz ? sz : 1) * sizeof(movie_event_t));
+
+    if (movie_events == NULL)
+    {
+        fclose(fp);
+        return 1;
+    }
+
+    movie_count = fread(movie_events, sizeof(movie_event_t), sz, fp);
+    movie_max = sz;
+
+    fclose(fp);
+
+    utils_log("Playing movie %s, %zu events\n", fn, movie_count);
+
+    movie_mode = MOVIE_MODE_PLAY;
+
+    movie_sync();
+
+    return 0;
+}
+
+/* apply every event reached by the cycles counter */
+void movie_step()
+{
+    while (movie_idx < movie_count && 
+           movie_events[movie_idx].cycles <= cycles.cnt)
+        input_set_state(movie_events[movie_idx++].keys);
+
+    if (movie_idx < movie_count)
+        movie_next = movie_events[movie_idx].cycles;
+    else
+    {
+        utils_log("Movie ended\n");
+
+        movie_next = UINT_FAST32_MAX;
+        movie_mode = MOVIE_MODE_NONE;
+    }
+}
+
+/* machine state jumped (save state, reset, rewind) */
+void movie_sync()
+{
+    size_t i;
+
+    switch (movie_mode)
+    {
+        case MOVIE_MODE_RECORD:
+
+            /* drop the future, a new timeline starts here */
+            while (movie_count && 
+                   movie_events[movie_count - 1].cycles > cycles.cnt)
+                movie_count--;
+
+            movie_input();
+
+            break;
+
+        case MOVIE_MODE_PLAY:
+
+            /* last event already reached sets the joypad */
+            for (i = 0; i < movie_count; i++)
+                if (movie_events[i].cycles > cycles.cnt)
+                    break;
+
+            input_set_state(i ? movie_events[i - 1].keys : 0);
+
+            movie_idx = i;
+            movie_step();
+
+            break;
+    }
+}
+
+/* stop playing/recording. recorded movie is written */
+void movie_stop()
+{
+    uint8_t *buf;
+    size_t sz;
+
+    if (movie_mode == MOVIE_MODE_RECORD)
+    {
+        sz = 8 + movie_count * sizeof(movie_event_t);
+        buf = malloc(sz);
+
+        if (buf)
+        {
+            memcpy(buf, MOVIE_MAGIC, 8);
+            memcpy(&buf[8], movie_events, 
+                   movie_count * sizeof(movie_event_t));
+
+            persist_write(movie_file, buf, sz);
+
+            free(buf);
+        }
+    }
+
+    free(movie_events);
+
+    movie_events = NULL;
+    movie_count = 0;
+    movie_max = 0;
+    movie_idx = 0;
+    movie_next = UINT_FAST32_MAX;
+    movie_mode = MOVIE_MODE_NONE;
+}
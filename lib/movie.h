@@ -0,0 +1,58 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __MOVIE_HDR__
+#define __MOVIE_HDR__
+
+#include <stdint.h>
+
+/* movie file starts with this */
+#define MOVIE_MAGIC "PIZZAMV1"
+
+enum {
+    MOVIE_MODE_NONE,
+    MOVIE_MODE_RECORD,
+    MOVIE_MODE_PLAY
+};
+
+/* a joypad state change, stamped with emulated cycles */
+typedef struct movie_event_s
+{
+    uint64_t cycles;
+    uint32_t frame;
+    uint8_t  keys;
+    uint8_t  spare[3];
+
+} movie_event_t;
+
+extern uint8_t       movie_mode;
+
+/* cycles of next event to play - checked every instruction */
+extern uint_fast32_t movie_next;
+
+/* prototypes */
+void movie_input();
+char movie_play(char *fn);
+char movie_record(char *fn);
+void movie_step();
+void movie_stop();
+void movie_sync();
+
+#endif
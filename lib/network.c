@@ -91,6 +91,14 @@ char network_is_running()
 void network_start(network_cb_t connected_cb, network_cb_t disconnected_cb,
                    char *broadcast_addr)
 {
+    /* a link cable peer drives the serial port and the hard sync, */
+    /* deterministic runs could not be replayed anymore            */
+    if (global_deterministic)
+    {
+        utils_log("Network disabled in deterministic mode\n");
+        return;
+    }
+
     /* init semaphore */
     // network_sem_init(&network_sem);
 
@@ -132,7 +140,7 @@ void *network_start_thread(void *args)
     /* exit on error */
     if (network_sock_broad < 1)
     {
-        utils_log("Error opening broadcast socket");
+        utils_log_error("Error opening broadcast socket\n");
         return NULL;
     }
         
@@ -142,7 +150,7 @@ void *network_start_thread(void *args)
     /* exit on error */
     if (network_sock_bound < 1)
     {
-        utils_log("Error opening serial-link socket");
+        utils_log_error("Error opening serial-link socket\n");
         close (network_sock_broad);
         return NULL;
     }
@@ -178,7 +186,7 @@ void *network_start_thread(void *args)
     if (bind(network_sock_bound, (struct sockaddr *) &bound_addr, 
              sizeof(bound_addr)))
     {
-        utils_log("Error binding to port 64333");
+        utils_log_error("Error binding to port 64333\n");
 
         /* close sockets and exit */
         close(network_sock_broad);
@@ -195,7 +203,7 @@ void *network_start_thread(void *args)
     if (setsockopt(network_sock_bound, IPPROTO_IP, IP_ADD_MEMBERSHIP,
                &mreq, sizeof(mreq)) < 0)
     {
-        utils_log("Error joining multicast network");
+        utils_log_error("Error joining multicast network\n");
 
         close(network_sock_broad);
         close(network_sock_bound);
@@ -217,8 +225,8 @@ void *network_start_thread(void *args)
     char         msg_content[64];
 
     /* generate a random uuid */
-    srand(time(NULL));
-    network_uuid = rand() & 0xFFFFFFFF;
+    utils_srand(time(NULL));
+    network_uuid = utils_rand();
 
     /* set callback in case of data to send */
     serial_set_send_cb(&network_send_data);
@@ -258,7 +266,7 @@ void *network_start_thread(void *args)
                              (struct sockaddr *) &broadcast_addr, 
                              sizeof(broadcast_addr));
 
-                utils_log("Sending broadcast message %s\n", buf);
+                utils_log_debug("Sending broadcast message %s\n", buf);
 
                 timeouts = 0;
             }
@@ -0,0 +1,353 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gpu.h"
+#include "output.h"
+#include "utils.h"
+
+/* export frames into a caller buffer or a shared memory one, so another */
+/* process reads observations without copies or conversions              */
+
+char      output_on = 0;
+
+uint8_t  *output_buf;
+uint8_t   output_fmt;
+uint32_t  output_stride_sz;
+
+/* downscaled gray: destination size, column and row of every pixel, */
+/* luma sums of the row in progress                                 */
+char      output_scaled = 0;
+uint32_t  output_w;
+uint32_t  output_h;
+uint8_t   output_col[160];
+uint8_t   output_row[144];
+uint8_t   output_col_cnt[160];
+uint8_t   output_row_lines;
+uint32_t  output_acc[160];
+
+/* sequence counter, only with a shared memory header */
+uint32_t *output_seq = NULL;
+
+/* shared memory mapping */
+void     *output_map = NULL;
+size_t    output_map_sz;
+int       output_fd = -1;
+
+/* minimum stride of a line */
+uint32_t output_stride(uint8_t fmt)
+{
+    switch (fmt)
+    {
+        case OUTPUT_FMT_RGB565:   return 160 * 2;
+        case OUTPUT_FMT_RGBA8888: return 160 * 4;
+        case OUTPUT_FMT_GRAY8:    return 160;
+        case OUTPUT_FMT_INDEX2:   return 160 / 4;
+    }
+
+    return 0;
+}
+
+/* gray level of a pixel: drawn as it is by the GPU in luma mode, */
+/* converted from RGB565 when frames are composed anyway           */
+static inline uint8_t output_luma(uint16_t p, const char luma)
+{
+    return luma ? p : gpu_rgb565_luma(p);
+}
+
+/* box filter the line into the row it belongs to, write the row */
+/* after its last line                                            */
+void output_line_scaled(uint8_t line, uint16_t *src)
+{
+    uint8_t row = output_row[line];
+    char luma = gpu_luma;
+    uint8_t *dst;
+    int i;
+
+    /* first line of the row */
+    if (line == 0 || output_row[line - 1] != row)
+    {
+        bzero(output_acc, sizeof(output_acc));
+        output_row_lines = 0;
+    }
+
+    for (i = 0; i < 160; i++)
+        output_acc[output_col[i]] += output_luma(src[i], luma);
+
+    output_row_lines++;
+
+    if (line != 143 && output_row[line + 1] == row)
+        return;
+
+    dst = output_buf + row * output_stride_sz;
+
+    for (i = 0; i < output_w; i++)
+        dst[i] = output_acc[i] / (output_col_cnt[i] * output_row_lines);
+}
+
+/* convert a line just drawn into the output buffer */
+void output_line(uint8_t line)
+{
+    uint16_t *src = &gpu.frame_buffer[line * 160];
+    char luma = gpu_luma;
+    uint8_t *dst;
+    uint16_t p;
+    int i;
+
+    if (line >= 144)
+        return;
+
+    /* first line, frame is incomplete */
+    if (line == 0 && output_seq && (*output_seq & 0x01) == 0)
+        __atomic_add_fetch(output_seq, 1, __ATOMIC_RELEASE);
+
+    if (output_scaled)
+    {
+        output_line_scaled(line, src);
+        return;
+    }
+
+    dst = output_buf + line * output_stride_sz;
+
+    switch (output_fmt)
+    {
+        case OUTPUT_FMT_RGB565:
+
+            memcpy(dst, src, 160 * sizeof(uint16_t));
+            break;
+
+        case OUTPUT_FMT_RGBA8888:
+
+            for (i = 0; i < 160; i++)
+            {
+                p = src[i];
+
+                dst[0] = ((p >> 11) << 3) | (p >> 13);
+                dst[1] = (((p >> 5) & 0x3F) << 2) | ((p >> 9) & 0x03);
+                dst[2] = ((p & 0x1F) << 3) | ((p >> 2) & 0x07);
+                dst[3] = 0xFF;
+
+                dst += 4;
+            }
+
+            break;
+
+        case OUTPUT_FMT_GRAY8:
+
+            for (i = 0; i < 160; i++)
+                dst[i] = output_luma(src[i], luma);
+
+            break;
+
+        case OUTPUT_FMT_INDEX2:
+
+            /* DMG shades map exactly to their palette index */
+            for (i = 0; i < 160; i += 4)
+                dst[i >> 2] = (3 - (output_luma(src[i], luma) >> 6)) << 6 |
+                              (3 - (output_luma(src[i + 1], luma) >> 6)) << 4 |
+                              (3 - (output_luma(src[i + 2], luma) >> 6)) << 2 |
+                              (3 - (output_luma(src[i + 3], luma) >> 6));
+
+            break;
+    }
+}
+
+/* every line of the frame has been exported */
+void output_frame()
+{
+    if (output_seq && (*output_seq & 0x01))
+        __atomic_add_fetch(output_seq, 1, __ATOMIC_RELEASE);
+}
+
+/* export frames into buf (NULL to stop), stride 0 means packed lines */
+char output_set(void *buf, uint8_t fmt, uint32_t stride)
+{
+    if (buf == NULL)
+    {
+        output_on = 0;
+        return 0;
+    }
+
+    if (fmt >= OUTPUT_FMT_MAX)
+        return 1;
+
+    if (stride == 0)
+        stride = output_stride(fmt);
+
+    if (stride < output_stride(fmt))
+    {
+        utils_log_error("Output stride %u too short\n", stride);
+        return 1;
+    }
+
+    /* no colors to export out of a luma frame */
+    if (gpu_luma && (fmt == OUTPUT_FMT_RGB565 || fmt == OUTPUT_FMT_RGBA8888))
+    {
+        utils_log_error("Color output of luma frames\n");
+        return 1;
+    }
+
+    output_buf = buf;
+    output_fmt = fmt;
+    output_stride_sz = stride;
+    output_scaled = 0;
+    output_on = 1;
+
+    return 0;
+}
+
+/* export frames into buf as w x h 8 bit gray (84x84, 80x72...), */
+/* averaging the pixels that fall in every destination pixel     */
+char output_set_gray(void *buf, uint32_t w, uint32_t h, uint32_t stride)
+{
+    int i;
+
+    if (w < 1 || w > 160 || h < 1 || h > 144 || (stride && stride < w))
+        return 1;
+
+    if (output_set(buf, OUTPUT_FMT_GRAY8, 160))
+        return 1;
+
+    output_w = w;
+    output_h = h;
+    output_stride_sz = stride ? stride : w;
+    output_scaled = (w != 160 || h != 144);
+
+    bzero(output_col_cnt, sizeof(output_col_cnt));
+
+    for (i = 0; i < 160; i++)
+    {
+        output_col[i] = i * w / 160;
+        output_col_cnt[output_col[i]]++;
+    }
+
+    for (i = 0; i < 144; i++)
+        output_row[i] = i * h / 144;
+
+    return 0;
+}
+
+/* export frames into shared memory, behind an output_hdr_t header. */
+/* name NULL creates an anonymous memfd (pass it to the child or    */
+/* open /proc/<pid>/fd/<fd>), else a POSIX shm object. only gray    */
+/* frames can be smaller than 160x144. returns the descriptor or -1 */
+int output_shm(char *name, uint8_t fmt, uint32_t w, uint32_t h, 
+               uint32_t stride)
+{
+    output_hdr_t *hdr;
+    uint32_t min;
+    char err;
+    int fd;
+
+    if (fmt >= OUTPUT_FMT_MAX || w < 1 || w > 160 || h < 1 || h > 144 ||
+        (fmt != OUTPUT_FMT_GRAY8 && (w != 160 || h != 144)))
+        return -1;
+
+    min = (fmt == OUTPUT_FMT_GRAY8) ? w : output_stride(fmt);
+
+    if (stride && stride < min)
+        return -1;
+
+    if (stride == 0)
+        stride = min;
+
+    output_close();
+
+    if (name)
+        fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    else
+    {
+#ifdef __linux__
+        fd = memfd_create("pizza-output", 0);
+#else
+        char tmp[64];
+
+        /* no memfd, an unlinked shm object is the same */
+        snprintf(tmp, sizeof(tmp), "/pizza-output-%d", getpid());
+
+        fd = shm_open(tmp, O_RDWR | O_CREAT | O_EXCL, 0600);
+        shm_unlink(tmp);
+#endif
+    }
+
+    if (fd < 0)
+    {
+        utils_log_error("Cannot create output shared memory\n");
+        return -1;
+    }
+
+    output_map_sz = OUTPUT_HDR_SZ + stride * h;
+
+    if (ftruncate(fd, output_map_sz) ||
+        (output_map = mmap(NULL, output_map_sz, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        utils_log_error("Cannot map output shared memory\n");
+        output_map = NULL;
+        close(fd);
+        return -1;
+    }
+
+    hdr = output_map;
+
+    memcpy(hdr->magic, OUTPUT_MAGIC, sizeof(hdr->magic));
+    hdr->fmt = fmt;
+    hdr->width = w;
+    hdr->height = h;
+    hdr->stride = stride;
+    hdr->seq = 0;
+
+    output_fd = fd;
+    output_seq = &hdr->seq;
+
+    if (fmt == OUTPUT_FMT_GRAY8)
+        err = output_set_gray((uint8_t *) output_map + OUTPUT_HDR_SZ, 
+                              w, h, stride);
+    else
+        err = output_set((uint8_t *) output_map + OUTPUT_HDR_SZ, 
+                         fmt, stride);
+
+    return err ? -1 : fd;
+}
+
+/* stop exporting, release shared memory (the shm name is left to the */
+/* caller to unlink)                                                  */
+void output_close()
+{
+    output_on = 0;
+    output_seq = NULL;
+
+    if (output_map)
+    {
+        munmap(output_map, output_map_sz);
+        close(output_fd);
+
+        output_map = NULL;
+        output_fd = -1;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __OUTPUT_HDR__
+#define __OUTPUT_HDR__
+
+#include <stdint.h>
+
+/* pixel formats of the exported frames */
+enum {
+    OUTPUT_FMT_RGB565,      /* 2 bytes per pixel, as drawn by the GPU    */
+    OUTPUT_FMT_RGBA8888,    /* 4 bytes per pixel, R G B A in memory      */
+    OUTPUT_FMT_GRAY8,       /* 1 byte per pixel, luma                    */
+    OUTPUT_FMT_INDEX2,      /* 2 bits per pixel, 0 = white .. 3 = black, */
+                            /* leftmost pixel in the high bits           */
+    OUTPUT_FMT_MAX
+};
+
+/* shared memory layout: this header, then the frame at OUTPUT_HDR_SZ */
+#define OUTPUT_MAGIC  "PIZZAFB1"
+#define OUTPUT_HDR_SZ 64
+
+typedef struct output_hdr_s
+{
+    char     magic[8];
+    uint32_t fmt;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+
+    /* odd while a frame is being drawn, frame number is seq / 2 */
+    uint32_t seq;
+
+} output_hdr_t;
+
+/* lines are exported as they are drawn */
+extern char output_on;
+
+/* prototypes */
+void  output_close();
+void  output_frame();
+void  output_line(uint8_t line);
+char  output_set(void *buf, uint8_t fmt, uint32_t stride);
+char  output_set_gray(void *buf, uint32_t w, uint32_t h, uint32_t stride);
+int   output_shm(char *name, uint8_t fmt, uint32_t w, uint32_t h, 
+                 uint32_t stride);
+uint32_t output_stride(uint8_t fmt);
+
+#endif
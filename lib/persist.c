@@ -0,0 +1,245 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "persist.h"
+#include "utils.h"
+
+/* a pending write */
+typedef struct persist_job_s
+{
+    char    path[1024];
+    void   *data;
+    size_t  sz;
+
+    struct persist_job_s *next;
+
+} persist_job_t;
+
+/* pending writes, oldest first */
+persist_job_t  *persist_head = NULL;
+persist_job_t  *persist_tail = NULL;
+
+/* worker is writing something right now */
+char            persist_busy = 0;
+
+/* worker thread and its sync stuff */
+pthread_t       persist_thread;
+pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  persist_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  persist_done_cond = PTHREAD_COND_INITIALIZER;
+char            persist_running = 0;
+char            persist_quit = 0;
+
+
+/* write a file atomically: temp file, sync and rename over the old one */
+char persist_write_file(char *path, void *data, size_t sz)
+{
+    char tmp[1040];
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    fp = fopen(tmp, "w");
+
+    if (fp == NULL)
+    {
+        utils_log_error("Cannot write %s\n", tmp);
+        return 1;
+    }
+
+    if (fwrite(data, 1, sz, fp) != sz || fflush(fp) || fsync(fileno(fp)))
+    {
+        utils_log_error("Error writing %s\n", tmp);
+        fclose(fp);
+        unlink(tmp);
+        return 1;
+    }
+
+    fclose(fp);
+
+    if (rename(tmp, path))
+    {
+        utils_log_error("Cannot rename %s\n", tmp);
+        unlink(tmp);
+        return 1;
+    }
+
+    return 0;
+}
+
+void *persist_worker(void *args)
+{
+    persist_job_t *job;
+
+    pthread_mutex_lock(&persist_mutex);
+
+    while (1)
+    {
+        while (persist_head == NULL && !persist_quit)
+            pthread_cond_wait(&persist_cond, &persist_mutex);
+
+        /* quit only when everything has been written */
+        if (persist_head == NULL)
+            break;
+
+        job = persist_head;
+        persist_head = job->next;
+
+        if (persist_head == NULL)
+            persist_tail = NULL;
+
+        persist_busy = 1;
+
+        /* disk stuff is done unlocked */
+        pthread_mutex_unlock(&persist_mutex);
+
+        persist_write_file(job->path, job->data, job->sz);
+
+        free(job->data);
+        free(job);
+
+        pthread_mutex_lock(&persist_mutex);
+
+        persist_busy = 0;
+
+        pthread_cond_broadcast(&persist_done_cond);
+    }
+
+    pthread_mutex_unlock(&persist_mutex);
+
+    return NULL;
+}
+
+/* start the worker */
+char persist_init()
+{
+    if (persist_running)
+        return 0;
+
+    persist_quit = 0;
+
+    if (pthread_create(&persist_thread, NULL, persist_worker, NULL))
+    {
+        utils_log_error("Cannot start persistence thread\n");
+        return 1;
+    }
+
+    persist_running = 1;
+
+    return 0;
+}
+
+/* copy data and let the worker write it. a pending write on the same */
+/* path is replaced, only the newest content matters                  */
+char persist_write(char *path, void *data, size_t sz)
+{
+    persist_job_t *job;
+    void *copy;
+
+    /* no worker? do it right now */
+    if (!persist_running)
+        return persist_write_file(path, data, sz);
+
+    copy = malloc(sz);
+
+    if (copy == NULL)
+        return 1;
+
+    memcpy(copy, data, sz);
+
+    pthread_mutex_lock(&persist_mutex);
+
+    for (job = persist_head; job; job = job->next)
+    {
+        if (strcmp(job->path, path) == 0)
+        {
+            free(job->data);
+
+            job->data = copy;
+            job->sz = sz;
+
+            pthread_mutex_unlock(&persist_mutex);
+
+            return 0;
+        }
+    }
+
+    job = malloc(sizeof(persist_job_t));
+
+    if (job == NULL)
+    {
+        pthread_mutex_unlock(&persist_mutex);
+        free(copy);
+        return 1;
+    }
+
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->data = copy;
+    job->sz = sz;
+    job->next = NULL;
+
+    if (persist_tail)
+        persist_tail->next = job;
+    else
+        persist_head = job;
+
+    persist_tail = job;
+
+    pthread_cond_signal(&persist_cond);
+    pthread_mutex_unlock(&persist_mutex);
+
+    return 0;
+}
+
+/* wait for every pending write to hit the disk */
+void persist_flush()
+{
+    if (!persist_running)
+        return;
+
+    pthread_mutex_lock(&persist_mutex);
+
+    while (persist_head || persist_busy)
+        pthread_cond_wait(&persist_done_cond, &persist_mutex);
+
+    pthread_mutex_unlock(&persist_mutex);
+}
+
+/* write everything pending and stop the worker */
+void persist_term()
+{
+    if (!persist_running)
+        return;
+
+    pthread_mutex_lock(&persist_mutex);
+    persist_quit = 1;
+    pthread_cond_signal(&persist_cond);
+    pthread_mutex_unlock(&persist_mutex);
+
+    pthread_join(persist_thread, NULL);
+
+    persist_running = 0;
+}
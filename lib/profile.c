@@ -0,0 +1,262 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmu.h"
+#include "profile.h"
+#include "utils.h"
+
+/* profiler is counting */
+char             profile_on = 0;
+
+/* per opcode counters, plain and CB prefixed */
+profile_entry_t  profile_op[256];
+profile_entry_t  profile_cb[256];
+
+/* per (bank, PC) counters */
+profile_pc_t    *profile_pc = NULL;
+
+/* instructions that didn't find room into the hash table */
+profile_entry_t  profile_pc_lost;
+
+/* totals */
+profile_entry_t  profile_total;
+
+/* report written here by profile_stop() */
+char             profile_file[1024];
+
+/* bank mapped where PC points to */
+static inline uint16_t profile_bank(uint16_t pc)
+{
+    if (pc >= 0x4000 && pc < 0x8000)
+        return mmu.rom_current_bank;
+
+    if (pc >= 0xA000 && pc < 0xC000)
+        return mmu.ram_current_bank;
+
+    if (pc >= 0xD000 && pc < 0xE000)
+        return mmu.wram_current_bank;
+
+    return 0;
+}
+
+/* account an executed instruction */
+void profile_count(uint16_t pc, uint8_t op, uint32_t cycles)
+{
+    uint32_t key = PROFILE_PC_USED | (profile_bank(pc) << 16) | pc;
+    uint32_t h, i;
+
+    profile_total.count++;
+    profile_total.cycles += cycles;
+
+    if (op == 0xCB)
+    {
+        uint8_t cb = mmu.memory[(uint16_t) (pc + 1)];
+
+        profile_cb[cb].count++;
+        profile_cb[cb].cycles += cycles;
+    }
+    else
+    {
+        profile_op[op].count++;
+        profile_op[op].cycles += cycles;
+    }
+
+    /* open addressing, linear probing */
+    h = (key * 2654435761u) >> 16;
+
+    for (i = 0; i < PROFILE_PC_SZ; i++)
+    {
+        profile_pc_t *p = &profile_pc[(h + i) & (PROFILE_PC_SZ - 1)];
+
+        if (p->key == key || p->key == 0)
+        {
+            p->key = key;
+            p->e.count++;
+            p->e.cycles += cycles;
+            return;
+        }
+    }
+
+    profile_pc_lost.count++;
+    profile_pc_lost.cycles += cycles;
+}
+
+void profile_reset()
+{
+    bzero(profile_op, sizeof(profile_op));
+    bzero(profile_cb, sizeof(profile_cb));
+    bzero(&profile_pc_lost, sizeof(profile_pc_lost));
+    bzero(&profile_total, sizeof(profile_total));
+
+    if (profile_pc)
+        bzero(profile_pc, sizeof(profile_pc_t) * PROFILE_PC_SZ);
+}
+
+/* start counting. fn is where profile_stop() writes the report (or NULL) */
+char profile_start(char *fn)
+{
+    if (profile_pc == NULL)
+    {
+        profile_pc = calloc(PROFILE_PC_SZ, sizeof(profile_pc_t));
+
+        if (profile_pc == NULL)
+            return 1;
+    }
+
+    profile_reset();
+
+    if (fn)
+        snprintf(profile_file, sizeof(profile_file), "%s", fn);
+    else
+        profile_file[0] = '\0';
+
+    profile_on = 1;
+
+    return 0;
+}
+
+/* 0-255 plain opcodes, 256-511 CB prefixed ones */
+profile_entry_t *profile_op_entry(int i)
+{
+    return (i < 256) ? &profile_op[i] : &profile_cb[i - 256];
+}
+
+/* sort by cycles, descending */
+int profile_cmp_op(const void *a, const void *b)
+{
+    const profile_entry_t *x = profile_op_entry(*(const int *) a);
+    const profile_entry_t *y = profile_op_entry(*(const int *) b);
+
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+int profile_cmp_pc(const void *a, const void *b)
+{
+    const profile_pc_t *x = a;
+    const profile_pc_t *y = b;
+
+    return (x->e.cycles < y->e.cycles) - (x->e.cycles > y->e.cycles);
+}
+
+/* write sorted hot spots */
+void profile_report(FILE *fp)
+{
+    profile_entry_t *e;
+    profile_pc_t *pcs;
+    int ops[512];
+    double total;
+    int i, n;
+
+    if (profile_pc == NULL || profile_total.cycles == 0)
+        return;
+
+    total = profile_total.cycles;
+
+    fprintf(fp, "profile: %lu instructions, %lu cycles\n",
+                (unsigned long) profile_total.count,
+                (unsigned long) profile_total.cycles);
+
+    /* opcodes, both tables together */
+    for (i = 0; i < 512; i++)
+        ops[i] = i;
+
+    qsort(ops, 512, sizeof(int), profile_cmp_op);
+
+    fprintf(fp, "\n%-8s %14s %14s %7s %6s\n", "opcode", "count", 
+                "cycles", "% cyc", "avg");
+
+    for (i = 0; i < PROFILE_REPORT_ROWS; i++)
+    {
+        char name[16];
+
+        e = profile_op_entry(ops[i]);
+
+        if (e->count == 0)
+            break;
+
+        if (ops[i] < 256)
+            snprintf(name, sizeof(name), "%02X", ops[i]);
+        else
+            snprintf(name, sizeof(name), "CB %02X", ops[i] - 256);
+
+        fprintf(fp, "%-8s %14lu %14lu %7.2f %6.1f\n", name,
+                    (unsigned long) e->count, (unsigned long) e->cycles,
+                    e->cycles * 100 / total, (double) e->cycles / e->count);
+    }
+
+    /* (bank, PC) - compact used slots and sort them */
+    pcs = malloc(sizeof(profile_pc_t) * PROFILE_PC_SZ);
+
+    if (pcs == NULL)
+        return;
+
+    for (i = 0, n = 0; i < PROFILE_PC_SZ; i++)
+        if (profile_pc[i].key)
+            pcs[n++] = profile_pc[i];
+
+    qsort(pcs, n, sizeof(profile_pc_t), profile_cmp_pc);
+
+    fprintf(fp, "\n%-8s %14s %14s %7s\n", "bank:pc", "count", 
+                "cycles", "% cyc");
+
+    for (i = 0; i < PROFILE_REPORT_ROWS && i < n; i++)
+        fprintf(fp, "%02X:%04X  %14lu %14lu %7.2f\n", 
+                    (pcs[i].key >> 16) & 0x7FFF, pcs[i].key & 0xFFFF,
+                    (unsigned long) pcs[i].e.count, 
+                    (unsigned long) pcs[i].e.cycles,
+                    pcs[i].e.cycles * 100 / total);
+
+    if (profile_pc_lost.count)
+        fprintf(fp, "(%lu instructions didn't fit the PC table)\n",
+                    (unsigned long) profile_pc_lost.count);
+
+    free(pcs);
+}
+
+/* stop counting and write the report, if a file was given */
+void profile_stop()
+{
+    FILE *fp;
+
+    if (!profile_on)
+        return;
+
+    profile_on = 0;
+
+    if (profile_file[0])
+    {
+        fp = fopen(profile_file, "w");
+
+        if (fp == NULL)
+            utils_log_error("Cannot write profile %s\n", profile_file);
+        else
+        {
+            profile_report(fp);
+            fclose(fp);
+        }
+    }
+
+    free(profile_pc);
+    profile_pc = NULL;
+}
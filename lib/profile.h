@@ -0,0 +1,60 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __PROFILE_HDR__
+#define __PROFILE_HDR__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* (bank, PC) hash table slots, must be a power of 2 */
+#define PROFILE_PC_SZ (1 << 16)
+
+/* rows of every section of the report */
+#define PROFILE_REPORT_ROWS 40
+
+typedef struct profile_entry_s
+{
+    uint64_t count;
+    uint64_t cycles;
+
+} profile_entry_t;
+
+typedef struct profile_pc_s
+{
+    /* bank << 16 | PC, PROFILE_PC_USED set when slot is taken */
+    uint32_t        key;
+    profile_entry_t e;
+
+} profile_pc_t;
+
+#define PROFILE_PC_USED 0x80000000
+
+/* profiler is counting - checked every instruction */
+extern char profile_on;
+
+/* prototypes */
+void profile_count(uint16_t pc, uint8_t op, uint32_t cycles);
+void profile_report(FILE *fp);
+void profile_reset();
+char profile_start(char *fn);
+void profile_stop();
+
+#endif
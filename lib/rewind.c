@@ -0,0 +1,307 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameboy.h"
+#include "rewind.h"
+#include "utils.h"
+
+/* snapshots are stored as XOR+RLE deltas that bring the newest one back */
+/* to the previous one. every record of a delta is                     */
+/* [16 bit unchanged bytes][16 bit changed bytes][changed bytes XOR]    */
+
+typedef struct rewind_entry_s
+{
+    size_t off;
+    size_t len;
+
+} rewind_entry_t;
+
+/* newest full snapshot and scratch areas */
+uint8_t        *rewind_cur = NULL;
+uint8_t        *rewind_tmp = NULL;
+uint8_t        *rewind_enc = NULL;
+size_t          rewind_stat_sz;
+char            rewind_has_cur = 0;
+
+/* ring of deltas */
+uint8_t        *rewind_ring = NULL;
+size_t          rewind_ring_sz;
+size_t          rewind_wr;
+
+/* deltas positions into the ring, from oldest to newest */
+rewind_entry_t *rewind_entries = NULL;
+size_t          rewind_entries_max;
+size_t          rewind_head;
+size_t          rewind_count;
+
+/* take a snapshot every rewind_interval frames */
+uint16_t        rewind_interval;
+uint16_t        rewind_frames;
+
+
+/* encode the XOR of a and b into out, return encoded length */
+size_t rewind_encode(uint8_t *a, uint8_t *b, size_t sz, uint8_t *out)
+{
+    size_t i = 0, o = 0, start;
+    uint16_t z, l;
+    uint64_t x, y;
+
+    while (i < sz)
+    {
+        z = 0;
+
+        /* unchanged bytes, 8 at a time when possible */
+        while (i + 8 <= sz && z <= 0xFFFF - 8)
+        {
+            memcpy(&x, &a[i], 8);
+            memcpy(&y, &b[i], 8);
+
+            if (x != y)
+                break;
+
+            i += 8;
+            z += 8;
+        }
+
+        while (i < sz && a[i] == b[i] && z < 0xFFFF)
+        {
+            i++;
+            z++;
+        }
+
+        /* changed bytes, stop on a run long enough to pay a new record */
+        start = i;
+        l = 0;
+
+        while (i < sz && l < 0xFFFF)
+        {
+            if (i + 4 <= sz && memcmp(&a[i], &b[i], 4) == 0)
+                break;
+
+            i++;
+            l++;
+        }
+
+        memcpy(&out[o], &z, 2);
+        memcpy(&out[o + 2], &l, 2);
+        o += 4;
+
+        for (; start < i; start++)
+            out[o++] = a[start] ^ b[start];
+    }
+
+    return o;
+}
+
+/* apply an encoded XOR over dst */
+void rewind_decode(uint8_t *dst, uint8_t *in, size_t len)
+{
+    size_t i = 0, p = 0;
+    uint16_t z, l;
+
+    while (i < len)
+    {
+        memcpy(&z, &in[i], 2);
+        memcpy(&l, &in[i + 2], 2);
+        i += 4;
+        p += z;
+
+        while (l--)
+            dst[p++] ^= in[i++];
+    }
+}
+
+/* index of the oldest delta */
+size_t rewind_oldest()
+{
+    return (rewind_head + rewind_entries_max - rewind_count) % 
+           rewind_entries_max;
+}
+
+/* store a delta into the ring, dropping the oldest ones if needed */
+void rewind_push(uint8_t *data, size_t len)
+{
+    rewind_entry_t *e;
+
+    /* a single delta bigger than the whole ring breaks the chain */
+    if (len > rewind_ring_sz)
+    {
+        rewind_count = 0;
+        rewind_wr = 0;
+        return;
+    }
+
+    /* not enough room till the end? tail is wasted, start over */
+    if (rewind_wr + len > rewind_ring_sz)
+    {
+        while (rewind_count && 
+               rewind_entries[rewind_oldest()].off >= rewind_wr)
+            rewind_count--;
+
+        rewind_wr = 0;
+    }
+
+    /* drop deltas that are gonna be overwritten */
+    while (rewind_count)
+    {
+        e = &rewind_entries[rewind_oldest()];
+
+        if (e->off < rewind_wr || e->off >= rewind_wr + len)
+            break;
+
+        rewind_count--;
+    }
+
+    /* no more slots? drop the oldest */
+    if (rewind_count == rewind_entries_max)
+        rewind_count--;
+
+    memcpy(&rewind_ring[rewind_wr], data, len);
+
+    e = &rewind_entries[rewind_head];
+    e->off = rewind_wr;
+    e->len = len;
+
+    rewind_head = (rewind_head + 1) % rewind_entries_max;
+    rewind_count++;
+
+    rewind_wr += len;
+}
+
+/* go back to previous snapshot. return 1 if there's nothing left */
+char rewind_back()
+{
+    rewind_entry_t *e;
+
+    if (rewind_ring == NULL || !rewind_has_cur || rewind_count == 0)
+        return 1;
+
+    rewind_head = (rewind_head + rewind_entries_max - 1) % rewind_entries_max;
+    rewind_count--;
+
+    e = &rewind_entries[rewind_head];
+
+    /* rebuild previous snapshot and give its space back to the ring */
+    rewind_decode(rewind_cur, &rewind_ring[e->off], e->len);
+
+    rewind_wr = e->off;
+    rewind_frames = 0;
+
+    return gameboy_restore_stat_buf(rewind_cur, rewind_stat_sz);
+}
+
+/* called at the end of every frame */
+void rewind_frame()
+{
+    uint8_t *p;
+    size_t len;
+
+    if (rewind_ring == NULL)
+        return;
+
+    if (rewind_has_cur && ++rewind_frames < rewind_interval)
+        return;
+
+    rewind_frames = 0;
+
+    /* keep the last good one, a broken state is not worth a delta */
+    if (gameboy_save_stat_buf(rewind_tmp, rewind_stat_sz))
+        return;
+
+    if (rewind_has_cur)
+    {
+        len = rewind_encode(rewind_tmp, rewind_cur, rewind_stat_sz, 
+                            rewind_enc);
+
+        rewind_push(rewind_enc, len);
+    }
+
+    /* newest one becomes the current */
+    p = rewind_cur;
+    rewind_cur = rewind_tmp;
+    rewind_tmp = p;
+
+    rewind_has_cur = 1;
+}
+
+/* budget is the size of the deltas ring. cartridge must be loaded */
+char rewind_init(size_t budget, uint16_t interval)
+{
+    rewind_term();
+
+    if (budget == 0)
+        return 0;
+
+    rewind_stat_sz = gameboy_stat_size();
+    rewind_ring_sz = budget;
+    rewind_interval = interval ? interval : 1;
+
+    /* counters and registers change every frame, deltas are rarely */
+    /* smaller than this. if they are, oldest ones get dropped       */
+    rewind_entries_max = budget / 256 + 1;
+
+    /* a record is never bigger than the bytes it covers, except the */
+    /* first one and those splitting very long runs                  */
+    rewind_cur = malloc(rewind_stat_sz);
+    rewind_tmp = malloc(rewind_stat_sz);
+    rewind_enc = malloc(rewind_stat_sz + rewind_stat_sz / 16 + 8);
+    rewind_ring = malloc(rewind_ring_sz);
+    rewind_entries = malloc(rewind_entries_max * sizeof(rewind_entry_t));
+
+    if (rewind_cur == NULL || rewind_tmp == NULL || rewind_enc == NULL ||
+        rewind_ring == NULL || rewind_entries == NULL)
+    {
+        utils_log_error("Cannot allocate rewind buffer\n");
+        rewind_term();
+        return 1;
+    }
+
+    rewind_reset();
+
+    return 0;
+}
+
+/* forget every snapshot, next frame starts a new chain */
+void rewind_reset()
+{
+    rewind_has_cur = 0;
+    rewind_frames = 0;
+    rewind_head = 0;
+    rewind_count = 0;
+    rewind_wr = 0;
+}
+
+void rewind_term()
+{
+    free(rewind_cur);
+    free(rewind_tmp);
+    free(rewind_enc);
+    free(rewind_ring);
+    free(rewind_entries);
+
+    rewind_cur = NULL;
+    rewind_tmp = NULL;
+    rewind_enc = NULL;
+    rewind_ring = NULL;
+    rewind_entries = NULL;
+}
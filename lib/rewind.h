@@ -0,0 +1,34 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __REWIND_HDR__
+#define __REWIND_HDR__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* prototypes */
+char rewind_back();
+char rewind_init(size_t budget, uint16_t interval);
+void rewind_frame();
+void rewind_reset();
+void rewind_term();
+
+#endif
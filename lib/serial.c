@@ -20,9 +20,11 @@
 #include <pthread.h>
 
 #include "cycles.h"
+#include "global.h"
 #include "interrupt.h"
 #include "mmu.h"
 #include "serial.h"
+#include "trace.h"
 #include "utils.h"
 
 /* main variable */
@@ -92,14 +94,40 @@ void serial_init()
     pthread_cond_init(&serial_cond, NULL);
 }
 
-void serial_save_stat(FILE *fp)
+void serial_serialize_stat(utils_stat_t *s)
 {
-    fwrite(&serial, 1, sizeof(serial_t), fp);
-}
-
-void serial_restore_stat(FILE *fp)
-{
-    fread(&serial, 1, sizeof(serial_t), fp);
+    uint8_t flags;
+
+    UTILS_STAT(s, serial.clock);
+    UTILS_STAT(s, serial.speed);
+    UTILS_STAT(s, serial.spare);
+    UTILS_STAT(s, serial.transfer_start);
+    UTILS_STAT(s, serial.data);
+    UTILS_STAT(s, serial.bits_sent);
+    UTILS_STAT(s, serial.data_to_send);
+    UTILS_STAT(s, serial.data_to_recv);
+    UTILS_STAT64(s, serial.next);
+    UTILS_STAT64(s, serial.last_send_cnt);
+
+    /* bitfields cannot be addressed, pack them into a byte */
+    flags = serial.data_sent | 
+            serial.data_sent_clock << 1 |
+            serial.data_sent_transfer_start << 2 |
+            serial.data_recv << 3 |
+            serial.data_recv_clock << 4 |
+            serial.data_recv_transfer_start << 5;
+
+    UTILS_STAT(s, flags);
+
+    if (s->restore)
+    {
+        serial.data_sent                = flags & 0x01;
+        serial.data_sent_clock          = (flags >> 1) & 0x01;
+        serial.data_sent_transfer_start = (flags >> 2) & 0x01;
+        serial.data_recv                = (flags >> 3) & 0x01;
+        serial.data_recv_clock          = (flags >> 4) & 0x01;
+        serial.data_recv_transfer_start = (flags >> 5) & 0x01;
+    }
 }
 
 void serial_write_reg(uint16_t a, uint8_t v)
@@ -117,6 +145,9 @@ void serial_write_reg(uint16_t a, uint8_t v)
         serial.spare = ((v >> 2) & 0x1F);
         serial.transfer_start = (v & 0x80) ? 0x01 : 0x00;
 
+        if (serial.transfer_start)
+            TRACE(TRACE_SERIAL_START, serial.data);
+
         /* reset? */
         serial.data_sent = 0;
     }
@@ -195,7 +226,10 @@ void serial_send_byte()
     serial.data_sent_clock = serial.clock; 
     serial.data_sent_transfer_start = serial.transfer_start; 
 
-    if (serial_data_send_cb)
+    TRACE(TRACE_SERIAL_SEND, serial.data);
+
+    /* frames to be rolled back don't talk to the peer */
+    if (serial_data_send_cb && !global_speculative)
         (*serial_data_send_cb) (serial.data, serial.clock, 
                                 serial.transfer_start);
 
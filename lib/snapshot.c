@@ -0,0 +1,85 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdlib.h>
+
+#include "gameboy.h"
+#include "snapshot.h"
+#include "utils.h"
+
+/* state buffers, allocated on first save of every slot */
+uint8_t *snapshot_buf[SNAPSHOT_MAX];
+
+/* size of every state of the loaded cartridge */
+size_t   snapshot_sz = 0;
+
+/* keep current state into slot, restore it later as many times as needed */
+char snapshot_save(uint8_t slot)
+{
+    size_t sz;
+
+    if (slot >= SNAPSHOT_MAX)
+        return 1;
+
+    /* another cartridge (or cartridge RAM) - old slots are useless */
+    sz = gameboy_stat_size();
+
+    if (sz != snapshot_sz)
+    {
+        snapshot_free();
+        snapshot_sz = sz;
+    }
+
+    if (snapshot_buf[slot] == NULL)
+    {
+        snapshot_buf[slot] = malloc(snapshot_sz);
+
+        if (snapshot_buf[slot] == NULL)
+            return 1;
+    }
+
+    return gameboy_save_stat_buf(snapshot_buf[slot], snapshot_sz);
+}
+
+/* go back to the state of slot - no allocation nor I/O */
+char snapshot_restore(uint8_t slot)
+{
+    if (slot >= SNAPSHOT_MAX || snapshot_buf[slot] == NULL)
+    {
+        utils_log_error("Snapshot %d is empty\n", slot);
+        return 1;
+    }
+
+    return gameboy_restore_stat_buf(snapshot_buf[slot], snapshot_sz);
+}
+
+/* release every slot */
+void snapshot_free()
+{
+    uint8_t i;
+
+    for (i = 0; i < SNAPSHOT_MAX; i++)
+    {
+        free(snapshot_buf[i]);
+        snapshot_buf[i] = NULL;
+    }
+
+    snapshot_sz = 0;
+}
@@ -17,11 +17,13 @@
 
 */
 
+#include "checkpoint.h"
 #include "cycles.h"
 #include "global.h"
 #include "gpu.h"
 #include "mmu.h"
 #include "sound.h"
+#include "stats.h"
 #include "utils.h"
 
 #include <errno.h>
@@ -38,6 +40,9 @@ pthread_mutex_t   sound_mutex;
 /* super variable for audio controller */
 sound_t sound;
 
+/* samples of frame with (frame_counter & mask) != 0 are not pushed */
+uint_fast16_t sound_frame_skip_mask = 0;
+
 /* global for output frequency */
 int sound_output_rate = 48000;
 int sound_output_rate_fifth = 48; // 48000 / 5;
@@ -50,6 +55,7 @@ void   sound_push_samples(int16_t l, int16_t r);
 void   sound_push_sample(int16_t s);
 void   sound_read_samples(int len, int16_t *buf);
 void   sound_rebuild_wave();
+void   sound_serialize_stat_square(utils_stat_t *s, channel_square_t *c);
 void   sound_sweep_step();
 void   sound_term();
 void   sound_write_wave(uint16_t a, uint8_t v);
@@ -133,6 +139,24 @@ void sound_init()
     sound.buf_empty = 0;
 }
 
+/* reset emulated channels, host output buffer is left untouched */
+void sound_reset()
+{
+    bzero(&sound.channel_one, sizeof(channel_square_t));
+    bzero(&sound.channel_two, sizeof(channel_square_t));
+    bzero(&sound.channel_three, sizeof(channel_wave_t));
+    bzero(&sound.channel_four, sizeof(channel_noise_t));
+
+    sound.frame_counter = 0;
+
+    /* restart frame sequencer and sample generation */
+    sound.fs_cycles_idx = 0;
+    sound.fs_cycles_next = sound.fs_cycles;
+    sound.sample_cycles_remainder = 0;
+    sound.sample_cycles_next = sound.sample_cycles / 1000;
+    sound.sample_cycles_next_rounded = sound.sample_cycles_next & 0xFFFFFFFC;
+}
+
 void sound_set_speed(char dbl)
 {
 	return;
@@ -157,11 +181,21 @@ void sound_change_emulation_speed()
         sound.frame_multiplier = 4;
     else
         sound.frame_multiplier = 1; 
+
+    /* push one frame of samples every 2 or 4 when going faster */
+    if (global_emulation_speed == GLOBAL_EMULATION_SPEED_DOUBLE)
+        sound_frame_skip_mask = 0x0001;
+    else if (global_emulation_speed == GLOBAL_EMULATION_SPEED_4X)
+        sound_frame_skip_mask = 0x0003;
+    else
+        sound_frame_skip_mask = 0x0000;
 }
 
 /* update sound internal state given CPU T-states */
 void sound_step_fs()
 {
+    STATS_SCOPE(STATS_SCOPE_SOUND_FS);
+
     /* rotate from 0 to 7 */
     sound.fs_cycles_idx = (sound.fs_cycles_idx + 1) & 0x07;
 
@@ -185,6 +219,8 @@ void sound_step_fs()
 /* update all channels */
 void sound_step_ch1()
 {    
+    STATS_SCOPE(STATS_SCOPE_SOUND_CH1);
+
     /* recalc current samples */
     if ((sound.channel_one.duty >> sound.channel_one.duty_idx) & 0x01)
         sound.channel_one.sample = sound.channel_one.volume;
@@ -201,6 +237,8 @@ void sound_step_ch1()
 
 void sound_step_ch2()
 {    
+    STATS_SCOPE(STATS_SCOPE_SOUND_CH2);
+
     /* recalc current samples */
     if ((sound.channel_two.duty >> sound.channel_two.duty_idx) & 0x01)
         sound.channel_two.sample = sound.channel_two.volume;
@@ -217,6 +255,8 @@ void sound_step_ch2()
 
 void sound_step_ch3()
 {
+    STATS_SCOPE(STATS_SCOPE_SOUND_CH3);
+
     /* switch to the next wave sample */
     sound.channel_three.index = (sound.channel_three.index + 1) & 0x1F;
 
@@ -235,6 +275,8 @@ void sound_step_ch3()
    
 void sound_step_ch4()
 {
+    STATS_SCOPE(STATS_SCOPE_SOUND_CH4);
+
     /* update LSFR */
     if (sound.nr43->shift < 14)
     {
@@ -266,6 +308,8 @@ void sound_step_ch4()
 
 void sound_step_sample()
 {
+    STATS_SCOPE(STATS_SCOPE_SOUND_SAMPLE);
+
     uint_fast32_t zum = sound.sample_cycles + sound.sample_cycles_remainder;
 
     sound.sample_cycles_next += ((zum / 1000) << global_cpu_double_speed);
@@ -277,10 +321,8 @@ void sound_step_sample()
     sound.frame_counter++;
 
     /* is it the case to push samples? */
-    if (((global_emulation_speed == GLOBAL_EMULATION_SPEED_DOUBLE &&
-        (sound.frame_counter & 0x0001) != 0) ||
-        (global_emulation_speed == GLOBAL_EMULATION_SPEED_4X &&
-        (sound.frame_counter & 0x0003) != 0)))
+    if ((sound.frame_counter & sound_frame_skip_mask) != 0 || 
+        global_skip_audio)
         return;
 
     /* DAC turned off? */
@@ -423,6 +465,9 @@ void sound_read_buffer(void *userdata, uint8_t *stream, int snd_len)
 
 void sound_push_samples(int16_t l, int16_t r)
 {
+    if (checkpoint_on)
+        checkpoint_audio(l, r);
+
     /* store them in tmp buffer */	
     sound.buf_tmp[sound.buf_tmp_wr++] = l;
     sound.buf_tmp[sound.buf_tmp_wr++] = r;
@@ -1471,14 +1516,71 @@ void sound_term()
     }
 }
 
-void sound_save_stat(FILE *fp)
+/* host audio buffers are not part of the state, just the APU */
+void sound_serialize_stat_square(utils_stat_t *s, channel_square_t *c)
 {
-    fwrite(&sound, 1, sizeof(sound_t), fp);
+    UTILS_STAT(s, c->active);
+    UTILS_STAT(s, c->duty);
+    UTILS_STAT(s, c->duty_idx);
+    UTILS_STAT(s, c->envelope_cnt);
+    UTILS_STAT64(s, c->duty_cycles);
+    UTILS_STAT64(s, c->duty_cycles_next);
+    UTILS_STAT64(s, c->length);
+    UTILS_STAT64(s, c->frequency);
+    UTILS_STAT16(s, c->sample);
+    UTILS_STAT64(s, c->sweep_active);
+    UTILS_STAT64(s, c->sweep_cnt);
+    UTILS_STAT64(s, c->sweep_neg);
+    UTILS_STAT64(s, c->sweep_next);
+    UTILS_STAT16(s, c->volume);
+    UTILS_STAT32(s, c->sweep_shadow_frequency);
 }
 
-void sound_restore_stat(FILE *fp)
+void sound_serialize_stat(utils_stat_t *s)
 {
-    fread(&sound, 1, sizeof(sound_t), fp);
-
-    sound_init_pointers();
+    channel_wave_t  *w = &sound.channel_three;
+    channel_noise_t *n = &sound.channel_four;
+
+    sound_serialize_stat_square(s, &sound.channel_one);
+    sound_serialize_stat_square(s, &sound.channel_two);
+
+    UTILS_STAT(s, w->active);
+    UTILS_STAT(s, w->index);
+    UTILS_STAT16(s, w->ram_access);
+    UTILS_STAT16(s, w->sample);
+    UTILS_STAT_ARRAY16(s, w->wave);
+    UTILS_STAT64(s, w->cycles);
+    UTILS_STAT64(s, w->cycles_next);
+    UTILS_STAT64(s, w->ram_access_next);
+    UTILS_STAT64(s, w->length);
+
+    UTILS_STAT(s, n->active);
+    UTILS_STAT(s, n->envelope_cnt);
+    UTILS_STAT64(s, n->length);
+    UTILS_STAT64(s, n->period_lfsr);
+    UTILS_STAT64(s, n->cycles_next);
+    UTILS_STAT16(s, n->volume);
+    UTILS_STAT16(s, n->sample);
+    UTILS_STAT16(s, n->reg);
+
+    UTILS_STAT64(s, sound.frame_counter);
+    UTILS_STAT64(s, sound.fs_cycles);
+    UTILS_STAT64(s, sound.fs_cycles_idx);
+    UTILS_STAT64(s, sound.fs_cycles_next);
+    UTILS_STAT64(s, sound.sample_cycles);
+    UTILS_STAT64(s, sound.sample_cycles_remainder);
+    UTILS_STAT64(s, sound.sample_cycles_next);
+    UTILS_STAT64(s, sound.sample_cycles_next_rounded);
+    UTILS_STAT64(s, sound.step_int);
+    UTILS_STAT64(s, sound.step_int1000);
+
+    /* samples not yet pushed, a restored run pushes them as the original */
+    UTILS_STAT_ARRAY16(s, sound.buf_tmp);
+    UTILS_STAT64(s, sound.buf_tmp_wr);
+
+    if (s->restore)
+    {
+        sound_init_pointers();
+        sound_change_emulation_speed();
+    }
 }
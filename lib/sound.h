@@ -20,6 +20,8 @@
 #ifndef __SOUND_HDR__
 #define __SOUND_HDR__
 
+#include "utils.h"
+
 #define SOUND_FREQ_MAX 48000
 #define SOUND_SAMPLES 4096
 #define SOUND_BUF_SZ (SOUND_SAMPLES * 3)
@@ -317,9 +319,9 @@ void     sound_change_emulation_speed();
 int      sound_get_samples();
 void     sound_init();
 void     sound_read_buffer(void *userdata, uint8_t *stream, int snd_len);
+void     sound_reset();
 uint8_t  sound_read_reg(uint16_t a, uint8_t v);
-void     sound_restore_stat(FILE *fp);
-void     sound_save_stat(FILE *fp);
+void     sound_serialize_stat(utils_stat_t *s);
 void     sound_set_speed(char dbl);
 void     sound_set_output_rate(int freq);
 void     sound_step_fs();
@@ -0,0 +1,170 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifdef PIZZA_STATS
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* main variable */
+stats_t stats;
+
+/* event counters when speculative frames started */
+uint64_t stats_cnt_mark[STATS_CNT_MAX];
+
+/* periodic dump */
+unsigned int stats_dump_frames = STATS_DUMP_FRAMES;
+
+char *stats_scope_names[STATS_SCOPE_MAX] = {
+    "z80_execute", "mmu_read", "mmu_write", "gpu_draw_line",
+    "sound_step_fs", "sound_step_ch1", "sound_step_ch2", "sound_step_ch3",
+    "sound_step_ch4", "sound_step_sample", "cycles_step"
+};
+
+char *stats_cnt_names[STATS_CNT_MAX] = {
+    "rom bank switch", "ram bank switch", "wram bank switch", 
+    "vram bank select", "dma", "hdma", "hdma bytes", "int vblank",
+    "int lcd", "int timer", "int serial", "idle skips", "idle cycles"
+};
+
+uint64_t stats_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* zero everything and restart the wall clock */
+void stats_reset()
+{
+    uint64_t t, overhead = UINT64_MAX;
+    int i;
+
+    memset(&stats, 0, sizeof(stats));
+
+    /* measure cost of an empty sampled scope */
+    for (i = 0; i < 1000; i++)
+    {
+        t = stats_tsc();
+        t = stats_tsc() - t;
+
+        if (t < overhead)
+            overhead = t;
+    }
+
+    stats.overhead = overhead;
+
+    stats.rand = 0x6D2B79F5;
+
+    for (i = 0; i < STATS_SCOPE_MAX; i++)
+        stats.scope[i].countdown = 1;
+
+    stats.tsc = stats_tsc();
+    stats.ns = stats_ns();
+}
+
+/* copy of current values, with tsc/ns turned into elapsed ones */
+void stats_get(stats_t *out)
+{
+    memcpy(out, &stats, sizeof(stats_t));
+
+    out->tsc = stats_tsc() - stats.tsc;
+    out->ns = stats_ns() - stats.ns;
+}
+
+/* events of frames about to be rolled back (run-ahead) don't count, */
+/* their times do - the host spent them anyway                       */
+void stats_mark()
+{
+    memcpy(stats_cnt_mark, stats.cnt, sizeof(stats.cnt));
+}
+
+void stats_rollback()
+{
+    memcpy(stats.cnt, stats_cnt_mark, sizeof(stats.cnt));
+}
+
+void stats_dump(FILE *fp)
+{
+    stats_t s;
+    double tpns;
+    int i;
+
+    stats_get(&s);
+
+    if (s.ns == 0 || s.tsc == 0)
+        return;
+
+    /* timestamp ticks per nanosecond, measured on the elapsed period */
+    tpns = (double) s.tsc / s.ns;
+
+    fprintf(fp, "stats: %.3f s, %lu frames (%.1f fps)\n", 
+                s.ns / 1e9, (unsigned long) s.frames, 
+                s.frames * 1e9 / s.ns);
+
+    fprintf(fp, "%-18s %12s %10s %8s\n", "scope (inclusive)", 
+                "calls", "ns/call", "% time");
+
+    for (i = 0; i < STATS_SCOPE_MAX; i++)
+    {
+        stats_scope_t *sc = &s.scope[i];
+        double per_call;
+
+        if (sc->samples == 0)
+            continue;
+
+        per_call = (double) sc->ticks / sc->samples;
+
+        /* timestamps cost */
+        per_call = (per_call > s.overhead ? per_call - s.overhead : 0) / tpns;
+
+        fprintf(fp, "%-18s %12lu %10.1f %8.2f\n", stats_scope_names[i], 
+                    (unsigned long) sc->calls, per_call,
+                    per_call * sc->calls * 100 / s.ns);
+    }
+
+    for (i = 0; i < STATS_CNT_MAX; i++)
+        fprintf(fp, "%-18s %12lu\n", stats_cnt_names[i], 
+                    (unsigned long) s.cnt[i]);
+}
+
+/* called at the end of every frame */
+void stats_frame()
+{
+    stats.frames++;
+
+    if (stats_dump_frames && stats.frames >= stats_dump_frames)
+    {
+        stats_dump(stdout);
+        stats_reset();
+    }
+}
+
+void stats_set_dump_interval(unsigned int frames)
+{
+    stats_dump_frames = frames;
+}
+
+#endif
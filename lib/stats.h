@@ -0,0 +1,201 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __STATS_HDR__
+#define __STATS_HDR__
+
+/* instrumentation is compiled in only with PIZZA_STATS (make STATS=1) */
+
+#ifdef PIZZA_STATS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* take timestamps once every 2^STATS_SAMPLE_SHIFT calls (on average) of  */
+/* a scope. distance between samples is random, a fixed one would always */
+/* hit the same phase of periodic stuff (sound samples, lines and so on)  */
+#define STATS_SAMPLE_SHIFT 6
+#define STATS_SAMPLE_MASK  ((2 << STATS_SAMPLE_SHIFT) - 1)
+
+/* dump stats (and start over) every N frames, 0 = never */
+#define STATS_DUMP_FRAMES  600
+
+/* timed scopes - times are inclusive of nested scopes */
+enum {
+    STATS_SCOPE_Z80_EXECUTE,
+    STATS_SCOPE_MMU_READ,
+    STATS_SCOPE_MMU_WRITE,
+    STATS_SCOPE_GPU_DRAW_LINE,
+    STATS_SCOPE_SOUND_FS,
+    STATS_SCOPE_SOUND_CH1,
+    STATS_SCOPE_SOUND_CH2,
+    STATS_SCOPE_SOUND_CH3,
+    STATS_SCOPE_SOUND_CH4,
+    STATS_SCOPE_SOUND_SAMPLE,
+    STATS_SCOPE_CYCLES_STEP,
+    STATS_SCOPE_MAX
+};
+
+/* event counters */
+enum {
+    STATS_CNT_ROM_BANK,
+    STATS_CNT_RAM_BANK,
+    STATS_CNT_WRAM_BANK,
+    STATS_CNT_VRAM_BANK,
+    STATS_CNT_DMA,
+    STATS_CNT_HDMA,
+    STATS_CNT_HDMA_BYTES,
+    STATS_CNT_INT_VBLANK,
+    STATS_CNT_INT_LCD,
+    STATS_CNT_INT_TIMER,
+    STATS_CNT_INT_SERIAL,
+    STATS_CNT_IDLE_SKIPS,
+    STATS_CNT_IDLE_CYCLES,
+    STATS_CNT_MAX
+};
+
+typedef struct stats_scope_s
+{
+    /* every call, only sampled ones */
+    uint64_t calls;
+    uint64_t samples;
+
+    /* calls left till next sample */
+    uint32_t countdown;
+
+    /* timestamp ticks spent into sampled calls */
+    uint64_t ticks;
+
+} stats_scope_t;
+
+typedef struct stats_s
+{
+    stats_scope_t scope[STATS_SCOPE_MAX];
+    uint64_t      cnt[STATS_CNT_MAX];
+
+    /* emulated frames, timestamp and wall clock since last reset */
+    uint64_t      frames;
+    uint64_t      tsc;
+    uint64_t      ns;
+
+    /* xorshift state for sampling distances */
+    uint32_t      rand;
+
+    /* ticks taken by a couple of timestamps, removed from every sample */
+    uint64_t      overhead;
+
+} stats_t;
+
+/* a running scope, closed when it goes out of scope */
+typedef struct stats_probe_s
+{
+    uint64_t t0;
+    uint8_t  id;
+    uint8_t  on;
+
+} stats_probe_t;
+
+extern stats_t stats;
+
+/* cheapest timestamp available */
+static inline uint64_t stats_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline stats_probe_t stats_scope_enter(uint8_t id)
+{
+    stats_probe_t p = { 0, id, 0 };
+    stats_scope_t *sc = &stats.scope[id];
+
+    sc->calls++;
+
+    if (--sc->countdown == 0)
+    {
+        stats.rand ^= stats.rand << 13;
+        stats.rand ^= stats.rand >> 17;
+        stats.rand ^= stats.rand << 5;
+
+        sc->countdown = (stats.rand & STATS_SAMPLE_MASK) + 1;
+
+        p.on = 1;
+        p.t0 = stats_tsc();
+    }
+
+    return p;
+}
+
+static inline void stats_scope_exit(stats_probe_t *p)
+{
+    if (p->on)
+    {
+        stats.scope[p->id].ticks += stats_tsc() - p->t0;
+        stats.scope[p->id].samples++;
+    }
+}
+
+/* time the rest of the enclosing block */
+#define STATS_SCOPE(id) \
+    stats_probe_t __stats_probe __attribute__ ((cleanup (stats_scope_exit))) \
+        = stats_scope_enter(id)
+
+#define STATS_INC(id)    (stats.cnt[id]++)
+#define STATS_ADD(id, n) (stats.cnt[id] += (n))
+#define STATS_FRAME()    stats_frame()
+#define STATS_RESET()    stats_reset()
+#define STATS_MARK()     stats_mark()
+#define STATS_ROLLBACK() stats_rollback()
+
+/* prototypes */
+void stats_dump(FILE *fp);
+void stats_frame();
+void stats_get(stats_t *out);
+void stats_mark();
+void stats_reset();
+void stats_rollback();
+void stats_set_dump_interval(unsigned int frames);
+
+#else
+
+/* compiled out - no code at all */
+#define STATS_SCOPE(id)
+#define STATS_INC(id)
+#define STATS_ADD(id, n)
+#define STATS_FRAME()
+#define STATS_RESET()
+#define STATS_MARK()
+#define STATS_ROLLBACK()
+
+#endif
+
+#endif
@@ -17,11 +17,16 @@
 
 */
 
+#include <strings.h>
+
 #include "cycles.h"
 #include "interrupt.h"
 #include "mmu.h"
 #include "timer.h"
 
+/* global status of timer */
+timer_gb_t timer;
+
 /* pointer to interrupt flags (handy) */
 interrupts_flags_t *timer_if;
 
@@ -36,6 +41,13 @@ void timer_init()
     timer_if   = mmu_addr(0xFF0F);
 }
 
+void timer_reset()
+{
+    bzero(&timer, sizeof(timer_gb_t));
+
+    timer_init();
+}
+
 void timer_write_reg(uint16_t a, uint8_t v)
 {
     switch (a)
@@ -63,6 +75,19 @@ void timer_write_reg(uint16_t a, uint8_t v)
         timer.sub_next = cycles.cnt + timer.threshold;
 }
 
+void timer_serialize_stat(utils_stat_t *s)
+{
+    UTILS_STAT(s, timer.active);
+    UTILS_STAT(s, timer.div);
+    UTILS_STAT(s, timer.mod);
+    UTILS_STAT(s, timer.ctrl);
+    UTILS_STAT64(s, timer.cnt);
+    UTILS_STAT32(s, timer.threshold);
+    UTILS_STAT64(s, timer.sub);
+    UTILS_STAT64(s, timer.next);
+    UTILS_STAT64(s, timer.sub_next);
+}
+
 uint8_t timer_read_reg(uint16_t a)
 {
     switch (a)
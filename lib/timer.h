@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#include "utils.h"
+
 /* timer status */
 typedef struct timer_gb_s
 {
@@ -54,10 +56,12 @@ typedef struct timer_gb_s
 } timer_gb_t;
 
 /* global status of timer */
-timer_gb_t timer;
+extern timer_gb_t timer;
 
 /* prototypes */
 void    timer_init();
+void    timer_reset();
+void    timer_serialize_stat(utils_stat_t *s);
 void    timer_step();
 void    timer_write_reg(uint16_t a, uint8_t v);
 uint8_t timer_read_reg(uint16_t a);
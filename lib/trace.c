@@ -0,0 +1,313 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cycles.h"
+#include "trace.h"
+#include "utils.h"
+
+/* trace is being recorded */
+char trace_on = 0;
+
+/* events on their way to the file */
+utils_queue_t   trace_queue;
+
+/* events lost because queue was full */
+uint64_t        trace_dropped = 0;
+
+/* writer thread and output */
+pthread_t       trace_thread;
+char            trace_running = 0;
+FILE           *trace_fp = NULL;
+
+/* host time of trace start, JSON timestamps are relative to it */
+uint64_t        trace_t0;
+
+/* comma needed before next JSON event */
+char            trace_comma = 0;
+
+/* last LCD mode change, written when the next one tells its length */
+trace_event_t   trace_gpu_pending;
+char            trace_gpu_pending_set = 0;
+
+/* lanes of the timeline */
+enum {
+    TRACE_TID_LCD = 1,
+    TRACE_TID_CPU,
+    TRACE_TID_DMA,
+    TRACE_TID_MMU,
+    TRACE_TID_SERIAL,
+    TRACE_TID_HOST
+};
+
+char *trace_tid_names[] = {
+    "", "lcd", "cpu", "dma", "mmu", "serial", "host pacing"
+};
+
+char *trace_gpu_modes[] = { "hblank", "vblank", "oam", "vram" };
+
+/* queue an event, never blocks */
+void trace_event(uint8_t type, uint32_t arg)
+{
+    trace_event_t ev;
+
+    ev.ns = trace_ns();
+    ev.cycles = cycles.cnt;
+    ev.arg = arg;
+    ev.dur = 0;
+    ev.type = type;
+
+    if (utils_queue_push(&trace_queue, &ev, NULL))
+        __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* queue an event lasted from start till now */
+void trace_span(uint8_t type, uint64_t start, uint32_t arg)
+{
+    trace_event_t ev;
+
+    ev.ns = start;
+    ev.cycles = cycles.cnt;
+    ev.arg = arg;
+    ev.dur = trace_ns() - start;
+    ev.type = type;
+
+    if (utils_queue_push(&trace_queue, &ev, NULL))
+        __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* write a single JSON event */
+void trace_write(const char *name, char ph, int tid, uint64_t ns, 
+                 uint64_t dur, uint64_t cycles, const char *arg_name, 
+                 uint32_t arg)
+{
+    double ts = (ns - trace_t0) / 1000.0;
+
+    fprintf(trace_fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,"
+                      "\"tid\":%d,\"ts\":%.3f,", 
+                      trace_comma ? "," : "", name, ph, tid, ts);
+
+    if (ph == 'X')
+        fprintf(trace_fp, "\"dur\":%.3f,", dur / 1000.0);
+    else if (ph == 'i')
+        fprintf(trace_fp, "\"s\":\"t\",");
+
+    fprintf(trace_fp, "\"args\":{\"cycles\":%lu", (unsigned long) cycles);
+
+    if (arg_name)
+        fprintf(trace_fp, ",\"%s\":%u", arg_name, arg);
+
+    fprintf(trace_fp, "}}");
+
+    trace_comma = 1;
+}
+
+/* LCD modes become spans, closed by the following change */
+void trace_write_gpu(trace_event_t *ev)
+{
+    trace_event_t *p = &trace_gpu_pending;
+
+    if (trace_gpu_pending_set)
+        trace_write(trace_gpu_modes[p->arg & 0x03], 'X', TRACE_TID_LCD, 
+                    p->ns, ev->ns - p->ns, p->cycles, "ly", p->arg >> 8);
+
+    trace_gpu_pending = *ev;
+    trace_gpu_pending_set = 1;
+}
+
+void trace_write_event(trace_event_t *ev)
+{
+    char name[32];
+
+    switch (ev->type)
+    {
+        case TRACE_GPU_MODE:
+            trace_write_gpu(ev);
+            break;
+
+        case TRACE_INT:
+
+            switch (ev->arg)
+            {
+                case 0x40: snprintf(name, sizeof(name), "int vblank"); break;
+                case 0x48: snprintf(name, sizeof(name), "int lcd"); break;
+                case 0x50: snprintf(name, sizeof(name), "int timer"); break;
+                case 0x58: snprintf(name, sizeof(name), "int serial"); break;
+                default: snprintf(name, sizeof(name), "int %02x", ev->arg);
+            }
+
+            trace_write(name, 'i', TRACE_TID_CPU, ev->ns, 0, ev->cycles, 
+                        "vector", ev->arg);
+            break;
+
+        case TRACE_DMA:
+            trace_write("oam dma", 'i', TRACE_TID_DMA, ev->ns, 0, 
+                        ev->cycles, "src", ev->arg);
+            break;
+
+        case TRACE_HDMA:
+            trace_write(ev->arg & TRACE_HDMA_HBLANK ? "hdma hblank" : "hdma general", 
+                        'i', TRACE_TID_DMA, ev->ns, 0, ev->cycles, 
+                        "bytes", ev->arg & 0xFFFF);
+            break;
+
+        case TRACE_ROM_BANK:
+            trace_write("rom bank", 'i', TRACE_TID_MMU, ev->ns, 0, 
+                        ev->cycles, "bank", ev->arg);
+            break;
+
+        case TRACE_RAM_BANK:
+            trace_write("ram bank", 'i', TRACE_TID_MMU, ev->ns, 0, 
+                        ev->cycles, "bank", ev->arg);
+            break;
+
+        case TRACE_SERIAL_START:
+            trace_write("serial start", 'i', TRACE_TID_SERIAL, ev->ns, 0, 
+                        ev->cycles, "data", ev->arg);
+            break;
+
+        case TRACE_SERIAL_SEND:
+            trace_write("serial send", 'i', TRACE_TID_SERIAL, ev->ns, 0, 
+                        ev->cycles, "data", ev->arg);
+            break;
+
+        case TRACE_SLEEP:
+            trace_write("sleep", 'X', TRACE_TID_HOST, ev->ns, ev->dur, 
+                        ev->cycles, NULL, 0);
+            break;
+    }
+}
+
+/* write everything queued so far, return qty of written events */
+int trace_drain()
+{
+    trace_event_t ev;
+    int n = 0;
+
+    while (utils_queue_pop(&trace_queue, &ev) == 0)
+    {
+        trace_write_event(&ev);
+        n++;
+    }
+
+    return n;
+}
+
+void *trace_writer(void *args)
+{
+    while (trace_running)
+    {
+        /* nothing to do? don't spin */
+        if (trace_drain() == 0)
+            usleep(5000);
+    }
+
+    return NULL;
+}
+
+/* start tracing into a Chrome JSON file (chrome://tracing, Perfetto) */
+char trace_start(char *fn)
+{
+    int i;
+
+    if (trace_on)
+        return 1;
+
+    trace_fp = fopen(fn, "w");
+
+    if (trace_fp == NULL)
+    {
+        utils_log_error("Cannot open trace file %s\n", fn);
+        return 1;
+    }
+
+    if (utils_queue_init(&trace_queue, sizeof(trace_event_t), 
+                         TRACE_QUEUE_SZ))
+    {
+        fclose(trace_fp);
+        return 1;
+    }
+
+    trace_t0 = trace_ns();
+    trace_dropped = 0;
+    trace_comma = 0;
+    trace_gpu_pending_set = 0;
+
+    fprintf(trace_fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    /* name the lanes */
+    for (i = TRACE_TID_LCD; i <= TRACE_TID_HOST; i++)
+    {
+        fprintf(trace_fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                          "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                          trace_comma ? "," : "", i, trace_tid_names[i]);
+
+        trace_comma = 1;
+    }
+
+    trace_running = 1;
+
+    if (pthread_create(&trace_thread, NULL, trace_writer, NULL))
+    {
+        trace_running = 0;
+        utils_queue_term(&trace_queue);
+        fclose(trace_fp);
+        return 1;
+    }
+
+    trace_on = 1;
+
+    return 0;
+}
+
+/* stop tracing, write what's left and close the file */
+void trace_stop()
+{
+    if (!trace_on)
+        return;
+
+    trace_on = 0;
+
+    /* writer stops, remaining events are written from here */
+    trace_running = 0;
+
+    pthread_join(trace_thread, NULL);
+
+    trace_drain();
+
+    /* close last LCD mode at the last known time */
+    if (trace_gpu_pending_set)
+        trace_write(trace_gpu_modes[trace_gpu_pending.arg & 0x03], 'X',
+                    TRACE_TID_LCD, trace_gpu_pending.ns, 0, 
+                    trace_gpu_pending.cycles, "ly", 
+                    trace_gpu_pending.arg >> 8);
+
+    fprintf(trace_fp, "\n]}\n");
+    fclose(trace_fp);
+
+    utils_queue_term(&trace_queue);
+
+    if (trace_dropped)
+        utils_log("Trace: %lu events dropped\n", 
+                  (unsigned long) trace_dropped);
+}
@@ -0,0 +1,87 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __TRACE_HDR__
+#define __TRACE_HDR__
+
+#include <stdint.h>
+#include <time.h>
+
+/* events queued and not yet written, must be a power of 2 */
+#define TRACE_QUEUE_SZ (1 << 16)
+
+/* event types */
+enum {
+    TRACE_GPU_MODE,
+    TRACE_INT,
+    TRACE_DMA,
+    TRACE_HDMA,
+    TRACE_ROM_BANK,
+    TRACE_RAM_BANK,
+    TRACE_SERIAL_START,
+    TRACE_SERIAL_SEND,
+    TRACE_SLEEP
+};
+
+/* HDMA event arg is bytes qty, this bit tells it's an HBLANK block */
+#define TRACE_HDMA_HBLANK 0x10000
+
+/* a single event, as queued by the emulation thread */
+typedef struct trace_event_s
+{
+    /* host monotonic clock and emulated cycles */
+    uint64_t ns;
+    uint64_t cycles;
+
+    /* event specific value */
+    uint32_t arg;
+
+    /* duration in ns, span events only */
+    uint32_t dur;
+
+    uint8_t  type;
+    uint8_t  spare[7];
+
+} trace_event_t;
+
+/* trace is being recorded - cheap check on hot paths */
+extern char trace_on;
+
+/* host timestamp used by events */
+static inline uint64_t trace_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* record an event, if tracing */
+#define TRACE(type, arg) \
+    do { if (__builtin_expect(trace_on, 0)) trace_event(type, arg); } while (0)
+
+/* prototypes */
+void trace_event(uint8_t type, uint32_t arg);
+void trace_span(uint8_t type, uint64_t start, uint32_t arg);
+char trace_start(char *fn);
+void trace_stop();
+
+#endif
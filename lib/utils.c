@@ -25,83 +25,588 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "cycles.h"
+#include "global.h"
 #include "gpu.h"
 #include "utils.h"
 
 uint32_t prev_cycles = 0;
 
-void utils_log(const char *format, ...)
+/* xorshift state, never 0 */
+uint32_t utils_rand_state = 0x6D2B79F5;
+
+/* asynchronous logging. messages are not formatted by the caller:       */
+/* format pointer and raw arguments are queued, a thread does the rest   */
+
+/* max qty of arguments and bytes of strings captured by a message.    */
+/* bigger messages are formatted and written by the caller              */
+#define UTILS_LOG_ARGS   10
+#define UTILS_LOG_STR_SZ 64
+
+/* queued messages, must be a power of 2 */
+#define UTILS_LOG_QUEUE_SZ 1024
+
+/* captured argument types */
+enum {
+    UTILS_LOG_ARG_INT,
+    UTILS_LOG_ARG_LONG,
+    UTILS_LOG_ARG_LLONG,
+    UTILS_LOG_ARG_SIZE,
+    UTILS_LOG_ARG_INTMAX,
+    UTILS_LOG_ARG_PTRDIFF,
+    UTILS_LOG_ARG_DOUBLE,
+    UTILS_LOG_ARG_LDOUBLE,
+    UTILS_LOG_ARG_PTR,
+    UTILS_LOG_ARG_STR,
+    UTILS_LOG_ARG_NONE
+};
+
+/* long doubles are kept as doubles, it's just a log */
+typedef union utils_log_arg_u
 {
-    char buf[256];
+    long long   i;
+    double      d;
+    void       *p;
 
-    va_list args;
-    va_start(args, format);
+    /* offset of a string into message strings buffer */
+    size_t      s;
 
-#ifdef __ANDROID__
+} utils_log_arg_t;
 
-    vsnprintf(buf, 256, format, args);
-    __android_log_write(ANDROID_LOG_INFO, "Pizza", buf);
+/* keep it small, it's copied twice by every queued message */
+typedef struct utils_log_rec_s
+{
+    const char     *fmt;
+    uint8_t         level;
+    uint8_t         ts;
+    uint8_t         nargs;
+
+    /* utils_ts_log stuff */
+    uint8_t         ly;
+    uint32_t        cycles;
+    uint32_t        diff;
+    uint32_t        sec;
+    uint32_t        usec;
+
+    uint8_t         types[UTILS_LOG_ARGS];
+    utils_log_arg_t args[UTILS_LOG_ARGS];
+    char            str[UTILS_LOG_STR_SZ];
+
+} utils_log_rec_t;
+
+/* a parsed conversion specification */
+typedef struct utils_log_spec_s
+{
+    /* stars for width and precision */
+    uint8_t stars;
+    uint8_t type;
+    char    conv;
 
-#else
+} utils_log_spec_t;
 
-    vsnprintf(buf, 256, format, args);
-    printf(buf);
+/* queue and drain thread */
+utils_queue_t utils_log_queue;
+pthread_t     utils_log_thread;
+char          utils_log_running = 0;
 
-#endif
+/* drain thread sleeps on the cond when the queue is empty. the mutex */
+/* also keeps the order of queued and synchronous messages            */
+pthread_mutex_t utils_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  utils_log_cond = PTHREAD_COND_INITIALIZER;
+char            utils_log_sleeping = 0;
 
-    va_end(args);
+/* messages lost because queue was full */
+uint64_t      utils_log_dropped = 0;
+
+char *utils_log_prefix[] = { "error: ", "warning: ", "", "" };
+
+/* parse a conversion spec starting after '%'. return its end (or NULL) */
+const char *utils_log_parse(const char *p, utils_log_spec_t *spec)
+{
+    char len = 0;
+
+    spec->stars = 0;
+
+    /* flags */
+    while (*p && strchr("-+ #0", *p))
+        p++;
+
+    /* width */
+    if (*p == '*')
+    {
+        spec->stars++;
+        p++;
+    }
+    else
+        while (*p >= '0' && *p <= '9')
+            p++;
+
+    /* precision */
+    if (*p == '.')
+    {
+        p++;
+
+        if (*p == '*')
+        {
+            spec->stars++;
+            p++;
+        }
+        else
+            while (*p >= '0' && *p <= '9')
+                p++;
+    }
+
+    /* length - ll becomes 'q', hh is the same as h */
+    while (*p && strchr("hlzjtL", *p))
+    {
+        len = (len == 'l' && *p == 'l') ? 'q' : *p;
+        p++;
+    }
+
+    spec->conv = *p;
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+
+            switch (len)
+            {
+                case 'l': spec->type = UTILS_LOG_ARG_LONG; break;
+                case 'q': spec->type = UTILS_LOG_ARG_LLONG; break;
+                case 'z': spec->type = UTILS_LOG_ARG_SIZE; break;
+                case 'j': spec->type = UTILS_LOG_ARG_INTMAX; break;
+                case 't': spec->type = UTILS_LOG_ARG_PTRDIFF; break;
+                default:  spec->type = UTILS_LOG_ARG_INT;
+            }
+
+            break;
+
+        case 'c': spec->type = UTILS_LOG_ARG_INT; break;
+        case 's': spec->type = UTILS_LOG_ARG_STR; break;
+        case 'p': spec->type = UTILS_LOG_ARG_PTR; break;
+
+        /* nothing to print, pointer is consumed */
+        case 'n': spec->type = UTILS_LOG_ARG_NONE; break;
+
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            spec->type = (len == 'L') ? UTILS_LOG_ARG_LDOUBLE :
+                                        UTILS_LOG_ARG_DOUBLE;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    return p + 1;
 }
 
+/* grab arguments as described by the format. return 1 if they don't */
+/* fit into the record                                                */
+char utils_log_capture(utils_log_rec_t *rec, va_list args)
+{
+    const char *p = rec->fmt;
+    utils_log_spec_t spec;
+    size_t str_pos = 0;
+    int i;
+
+    rec->nargs = 0;
+
+    while ((p = strchr(p, '%')))
+    {
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+
+        p = utils_log_parse(p + 1, &spec);
+
+        if (p == NULL || rec->nargs + spec.stars + 1 > UTILS_LOG_ARGS)
+            return 1;
+
+        for (i = 0; i < spec.stars; i++)
+        {
+            rec->types[rec->nargs] = UTILS_LOG_ARG_INT;
+            rec->args[rec->nargs++].i = va_arg(args, int);
+        }
+
+        utils_log_arg_t *a = &rec->args[rec->nargs];
+
+        rec->types[rec->nargs++] = spec.type;
+
+        switch (spec.type)
+        {
+            case UTILS_LOG_ARG_INT:     a->i = va_arg(args, int); break;
+            case UTILS_LOG_ARG_LONG:    a->i = va_arg(args, long); break;
+            case UTILS_LOG_ARG_LLONG:   a->i = va_arg(args, long long); break;
+            case UTILS_LOG_ARG_SIZE:    a->i = va_arg(args, size_t); break;
+            case UTILS_LOG_ARG_INTMAX:  a->i = va_arg(args, intmax_t); break;
+            case UTILS_LOG_ARG_PTRDIFF: a->i = va_arg(args, ptrdiff_t); break;
+            case UTILS_LOG_ARG_DOUBLE:  a->d = va_arg(args, double); break;
+            case UTILS_LOG_ARG_LDOUBLE:
+                a->d = va_arg(args, long double);
+                break;
+            case UTILS_LOG_ARG_PTR:
+            case UTILS_LOG_ARG_NONE:    a->p = va_arg(args, void *); break;
+
+            case UTILS_LOG_ARG_STR:
+            {
+                /* caller's string could be gone at print time, copy it */
+                const char *s = va_arg(args, const char *);
+                size_t l;
+
+                if (s == NULL)
+                    s = "(null)";
+
+                l = strlen(s);
+
+                if (str_pos + l + 1 > UTILS_LOG_STR_SZ)
+                    return 1;
+
+                memcpy(&rec->str[str_pos], s, l + 1);
+
+                a->s = str_pos;
+                str_pos += l + 1;
+
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
 
-void utils_log_urgent(const char *format, ...)
+/* format a captured message, one conversion at a time */
+void utils_log_format(utils_log_rec_t *rec, char *out, size_t sz)
 {
-    char buf[256];
+    const char *p = rec->fmt, *end;
+    utils_log_spec_t spec;
+    size_t pos = 0;
+    int arg = 0, n, v;
+    char fmt[64];
+
+#define OUT_LEFT (pos < sz ? sz - pos : 0)
+#define OUT_POS  (out + (pos < sz ? pos : sz - 1))
+
+    while (*p && pos < sz - 1)
+    {
+        if (*p != '%')
+        {
+            out[pos++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%')
+        {
+            out[pos++] = '%';
+            p += 2;
+            continue;
+        }
+
+        end = utils_log_parse(p + 1, &spec);
+
+        /* unknown stuff or lost arguments, give up */
+        if (end == NULL || arg + spec.stars + 1 > rec->nargs)
+            break;
 
-    va_list args;
-    va_start(args, format);
+        /* rebuild the spec with stars replaced by their values */
+        n = 0;
+
+        for (; p < end && n < sizeof(fmt) - 16; p++)
+        {
+            if (*p != '*')
+            {
+                fmt[n++] = *p;
+                continue;
+            }
+
+            v = rec->args[arg++].i;
+
+            /* negative precision means no precision at all */
+            if (fmt[n - 1] == '.' && v < 0)
+                n--;
+            else
+                n += sprintf(&fmt[n], "%d", v);
+        }
+
+        fmt[n] = '\0';
+        p = end;
+
+        utils_log_arg_t *a = &rec->args[arg];
+
+        switch (rec->types[arg++])
+        {
+            case UTILS_LOG_ARG_INT:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (int) a->i); break;
+            case UTILS_LOG_ARG_LONG:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (long) a->i); break;
+            case UTILS_LOG_ARG_LLONG:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, a->i); break;
+            case UTILS_LOG_ARG_SIZE:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (size_t) a->i); break;
+            case UTILS_LOG_ARG_INTMAX:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (intmax_t) a->i); break;
+            case UTILS_LOG_ARG_PTRDIFF:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (ptrdiff_t) a->i);
+                break;
+            case UTILS_LOG_ARG_DOUBLE:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, a->d); break;
+            case UTILS_LOG_ARG_LDOUBLE:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, (long double) a->d);
+                break;
+            case UTILS_LOG_ARG_PTR:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, a->p); break;
+            case UTILS_LOG_ARG_STR:
+                n = snprintf(OUT_POS, OUT_LEFT, fmt, &rec->str[a->s]); 
+                break;
+            default:
+                n = 0;
+        }
+
+        if (n > 0)
+            pos += n;
+    }
+
+    out[pos < sz ? pos : sz - 1] = '\0';
+
+#undef OUT_LEFT
+#undef OUT_POS
+}
 
+/* finally put a message out */
+void utils_log_write(const char *buf)
+{
 #ifdef __ANDROID__
-
-    vsnprintf(buf, 256, format, args);
     __android_log_write(ANDROID_LOG_INFO, "Pizza", buf);
-
 #else
+    fputs(buf, stdout);
+#endif
+}
 
-    vsnprintf(buf, 256, format, args);
-    printf(buf);
+/* put level prefix and utils_ts_log stuff in front of a message */
+void utils_log_line(utils_log_rec_t *rec, const char *buf)
+{
+    char line[640];
+
+    if (rec->ts)
+        snprintf(line, sizeof(line), "%sLINE %u - CYCLES %u - DIFF %u - "
+                                     "%lu:%06lu - %s", 
+                                     utils_log_prefix[rec->level],
+                                     rec->ly, rec->cycles, rec->diff, 
+                                     (unsigned long) rec->sec, 
+                                     (unsigned long) rec->usec, buf);
+    else
+        snprintf(line, sizeof(line), "%s%s", 
+                                     utils_log_prefix[rec->level], buf);
+
+    utils_log_write(line);
+}
 
-#endif
+void utils_log_print(utils_log_rec_t *rec)
+{
+    char buf[512];
 
-    va_end(args);
+    utils_log_format(rec, buf, sizeof(buf));
+    utils_log_line(rec, buf);
 }
 
-void utils_ts_log(const char *format, ...)
+void *utils_log_drain(void *args)
 {
-    va_list args;
-    va_start(args, format);
+    utils_log_rec_t rec;
+    uint64_t dropped = 0, d;
+    char buf[64];
+    char empty;
+
+    pthread_mutex_lock(&utils_log_mutex);
+
+    while (1)
+    {
+        empty = 1;
+
+        while (utils_queue_pop(&utils_log_queue, &rec) == 0)
+        {
+            utils_log_print(&rec);
+            empty = 0;
+        }
+
+        d = __atomic_load_n(&utils_log_dropped, __ATOMIC_RELAXED);
+
+        if (d != dropped)
+        {
+            snprintf(buf, sizeof(buf), "(%lu log messages lost)\n", 
+                     (unsigned long) (d - dropped));
+            utils_log_write(buf);
+            dropped = d;
+        }
+
+        if (!empty)
+            fflush(stdout);
+
+        /* quit only when everything has been written */
+        if (!utils_log_running && utils_queue_empty(&utils_log_queue))
+            break;
 
-    char buf[256];
+        if (!empty)
+            continue;
+
+        /* a push seeing the flag wakes us up. check the queue again */
+        /* after setting it, a message could be in already           */
+        __atomic_store_n(&utils_log_sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (utils_queue_empty(&utils_log_queue) && 
+            __atomic_load_n(&utils_log_running, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&utils_log_cond, &utils_log_mutex);
+
+        __atomic_store_n(&utils_log_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&utils_log_mutex);
+
+    return NULL;
+}
+
+/* wake the drain thread up if it's waiting for messages */
+void utils_log_wake()
+{
+    if (!__atomic_load_n(&utils_log_sleeping, __ATOMIC_SEQ_CST))
+        return;
+
+    pthread_mutex_lock(&utils_log_mutex);
+    pthread_cond_signal(&utils_log_cond);
+    pthread_mutex_unlock(&utils_log_mutex);
+}
+
+/* write a formatted message now, after the queued ones */
+void utils_log_sync(utils_log_rec_t *rec, const char *buf)
+{
+    utils_log_rec_t queued;
+
+    pthread_mutex_lock(&utils_log_mutex);
+
+    if (utils_log_running)
+        while (utils_queue_pop(&utils_log_queue, &queued) == 0)
+            utils_log_print(&queued);
+
+    utils_log_line(rec, buf);
+
+    pthread_mutex_unlock(&utils_log_mutex);
+}
+
+/* move logging to a background thread */
+char utils_log_start()
+{
+    if (utils_log_running)
+        return 0;
+
+    if (utils_queue_init(&utils_log_queue, sizeof(utils_log_rec_t), 
+                         UTILS_LOG_QUEUE_SZ))
+        return 1;
+
+    utils_log_running = 1;
+
+    if (pthread_create(&utils_log_thread, NULL, utils_log_drain, NULL))
+    {
+        utils_log_running = 0;
+        utils_queue_term(&utils_log_queue);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* write pending messages and go back to synchronous logging */
+void utils_log_stop()
+{
+    if (!utils_log_running)
+        return;
+
+    __atomic_store_n(&utils_log_running, 0, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&utils_log_mutex);
+    pthread_cond_signal(&utils_log_cond);
+    pthread_mutex_unlock(&utils_log_mutex);
+
+    pthread_join(utils_log_thread, NULL);
+
+    pthread_mutex_lock(&utils_log_mutex);
+    utils_queue_term(&utils_log_queue);
+    pthread_mutex_unlock(&utils_log_mutex);
+}
+
+/* use utils_log_[error|warn|info|debug] and utils_log */
+void utils_log_msg(char level, char ts, const char *format, ...)
+{
+    utils_log_rec_t rec;
     struct timeval tv;
+    char buf[512];
+    char full;
+    va_list args;
 
-#ifdef __ANDROID__
+    rec.fmt = format;
+    rec.level = level;
+    rec.ts = ts;
+
+    if (ts)
+    {
+        gettimeofday(&tv, NULL);
+
+        rec.sec = tv.tv_sec;
+        rec.usec = tv.tv_usec;
+        rec.ly = *(gpu.ly);
+        rec.cycles = cycles.cnt;
+        rec.diff = cycles.cnt - prev_cycles;
+
+        prev_cycles = cycles.cnt;
+    }
+
+    /* debug messages (CPU state dump too) must not get lost, */
+    /* they skip the queue                                    */
+    if (__atomic_load_n(&utils_log_running, __ATOMIC_SEQ_CST) &&
+        level != UTILS_LOG_DEBUG && !global_debug)
+    {
+        va_start(args, format);
+        full = utils_log_capture(&rec, args);
+        va_end(args);
+
+        if (!full)
+        {
+            /* never wait for room */
+            if (utils_queue_push(&utils_log_queue, &rec, NULL))
+                __atomic_fetch_add(&utils_log_dropped, 1, __ATOMIC_RELAXED);
+            else
+                utils_log_wake();
+
+            return;
+        }
+    }
+
+    /* synchronous or too big to be queued, do it right now */
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
 
-    vsnprintf(buf, 256, format, args);
-    __android_log_write(ANDROID_LOG_INFO, "Pizza", buf);
+    utils_log_sync(&rec, buf);
+}
 
-#else
+/* skip the queue - printed immediately */
+void utils_log_urgent(const char *format, ...)
+{
+    char buf[256];
 
-    vsprintf(buf, format, args);
-    gettimeofday(&tv, NULL);
-//    printf("%ld - %s\n", tv.tv_sec, buf);
-    printf("LINE %u - CYCLES %u - DIFF %u - %ld:%06ld - %s", 
-            *(gpu.ly), cycles.cnt, cycles.cnt - prev_cycles, 
-            tv.tv_sec, tv.tv_usec, buf);
+    va_list args;
+    va_start(args, format);
 
-    prev_cycles = cycles.cnt;
+    vsnprintf(buf, 256, format, args);
+    utils_log_write(buf);
 
+#ifndef __ANDROID__
+    fflush(stdout);
 #endif
 
     va_end(args);
@@ -137,3 +642,226 @@ void utils_binary_sem_wait(utils_binary_sem_t *p, unsigned int nanosecs)
     pthread_mutex_unlock(&p->mutex);
 }
 
+/* n must be a power of 2 */
+char utils_queue_init(utils_queue_t *q, size_t elem_sz, size_t n)
+{
+    size_t i;
+
+    if (n == 0 || (n & (n - 1)))
+        return 1;
+
+    q->buf = malloc(elem_sz * n);
+    q->seq = malloc(sizeof(size_t) * n);
+
+    if (q->buf == NULL || q->seq == NULL)
+    {
+        utils_queue_term(q);
+        return 1;
+    }
+
+    /* every slot is free for the lap starting at its own index */
+    for (i=0; i<n; i++)
+        q->seq[i] = i;
+
+    q->elem_sz = elem_sz;
+    q->mask = n - 1;
+    q->head = 0;
+    q->tail = 0;
+
+    return 0;
+}
+
+void utils_queue_term(utils_queue_t *q)
+{
+    free(q->buf);
+    free(q->seq);
+
+    q->buf = NULL;
+    q->seq = NULL;
+}
+
+/* return 1 if full. pos (if not NULL) receives the element position */
+char utils_queue_push(utils_queue_t *q, void *elem, size_t *pos)
+{
+    size_t p = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t s;
+    intptr_t diff;
+
+    for (;;)
+    {
+        s = __atomic_load_n(&q->seq[p & q->mask], __ATOMIC_ACQUIRE);
+        diff = (intptr_t) s - (intptr_t) p;
+
+        /* slot is free, try to reserve it */
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->head, &p, p + 1, 1,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return 1;
+        else
+            p = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+
+    memcpy(&q->buf[(p & q->mask) * q->elem_sz], elem, q->elem_sz);
+
+    /* publish it to consumers */
+    __atomic_store_n(&q->seq[p & q->mask], p + 1, __ATOMIC_RELEASE);
+
+    if (pos)
+        *pos = p;
+
+    return 0;
+}
+
+/* return 1 if empty */
+char utils_queue_pop(utils_queue_t *q, void *elem)
+{
+    size_t p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t s;
+    intptr_t diff;
+
+    for (;;)
+    {
+        s = __atomic_load_n(&q->seq[p & q->mask], __ATOMIC_ACQUIRE);
+        diff = (intptr_t) s - (intptr_t) (p + 1);
+
+        /* slot is filled, try to grab it */
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->tail, &p, p + 1, 1,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return 1;
+        else
+            p = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+
+    memcpy(elem, &q->buf[(p & q->mask) * q->elem_sz], q->elem_sz);
+
+    /* give the slot back to producers for the next lap */
+    __atomic_store_n(&q->seq[p & q->mask], p + q->mask + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* cheap check, good enough to poll it every instruction */
+char utils_queue_empty(utils_queue_t *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
+
+/* prepare a cursor to dump into (or load from) buf. buf NULL = count only */
+void utils_stat_init(utils_stat_t *s, void *buf, size_t sz, char restore)
+{
+    s->buf = buf;
+    s->sz = sz;
+    s->pos = 0;
+    s->restore = restore;
+    s->err = 0;
+}
+
+/* move sz bytes between p and the buffer, depending on cursor mode */
+void utils_stat_bytes(utils_stat_t *s, void *p, size_t sz)
+{
+    if (s->buf)
+    {
+        if (s->pos + sz > s->sz)
+        {
+            s->err = 1;
+            return;
+        }
+
+        if (s->restore)
+            memcpy(p, &s->buf[s->pos], sz);
+        else
+            memcpy(&s->buf[s->pos], p, sz);
+    }
+
+    s->pos += sz;
+}
+
+/* move an integer as sz little endian bytes - v is left untouched */
+/* when the buffer is too short                                    */
+void utils_stat_int(utils_stat_t *s, uint64_t *v, size_t sz)
+{
+    uint8_t b[8];
+    size_t pos = s->pos;
+    size_t i;
+
+    if (!s->restore)
+        for (i = 0; i < sz; i++)
+            b[i] = *v >> (i * 8);
+
+    utils_stat_bytes(s, b, sz);
+
+    /* nothing has been read */
+    if (!s->restore || s->buf == NULL || pos + sz > s->sz)
+        return;
+
+    *v = 0;
+
+    for (i = sz; i--;)
+        *v = (*v << 8) | b[i];
+}
+
+/* move n 16 bit values as little endian pairs of bytes */
+void utils_stat_array16(utils_stat_t *s, void *p, size_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    utils_stat_bytes(s, p, n * 2);
+#else
+    uint16_t *a = p;
+    uint64_t v;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        v = a[i];
+
+        utils_stat_int(s, &v, 2);
+
+        a[i] = v;
+    }
+#endif
+}
+
+/* FNV-1a 64 bit, h is UTILS_HASH64_INIT or the result of a previous call */
+uint64_t utils_hash64(const void *buf, size_t sz, uint64_t h)
+{
+    const uint8_t *p = buf;
+
+    while (sz--)
+        h = (h ^ *p++) * 0x100000001B3ULL;
+
+    return h;
+}
+
+/* seed the internal PRNG - same seed, same sequence on every host */
+void utils_srand(uint32_t seed)
+{
+    /* spread the seed and avoid the stuck at zero state */
+    utils_rand_state = seed * 2654435761u ^ 0x6D2B79F5;
+
+    if (utils_rand_state == 0)
+        utils_rand_state = 0x6D2B79F5;
+}
+
+/* xorshift32 */
+uint32_t utils_rand()
+{
+    uint32_t x = utils_rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return (utils_rand_state = x);
+}
@@ -21,6 +21,8 @@
 #define __UTILS_HDR__
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* binary semaphore */
 typedef struct utils_binary_sem_s 
@@ -31,12 +33,117 @@ typedef struct utils_binary_sem_s
 
 } utils_binary_sem_t;
 
+/* bounded lock-free queue of fixed size elements (multi producer/consumer) */
+typedef struct utils_queue_s
+{
+    /* slots and their sequence numbers */
+    uint8_t *buf;
+    size_t  *seq;
+
+    /* size of a single element and slots qty - 1 (power of 2) */
+    size_t   elem_sz;
+    size_t   mask;
+
+    /* producers and consumers positions, on different cache lines */
+    size_t   head __attribute__ ((aligned (64)));
+    size_t   tail __attribute__ ((aligned (64)));
+
+} utils_queue_t;
+
+/* cursor to serialize/deserialize emulator state into a memory buffer */
+typedef struct utils_stat_s
+{
+    /* buffer - NULL to just count needed bytes */
+    uint8_t *buf;
+    size_t   sz;
+    size_t   pos;
+
+    /* 0 = buffer <- state, 1 = state <- buffer */
+    char     restore;
+
+    /* buffer too small */
+    char     err;
+
+} utils_stat_t;
+
+/* handy macro to (de)serialize a single byte or an array of bytes */
+#define UTILS_STAT(s, f) utils_stat_bytes((s), &(f), sizeof(f))
+
+/* integers go through a 64 bit temporary and are stored as sz little   */
+/* endian bytes, so the layout does not depend on host type widths      */
+#define UTILS_STAT_INT(s, f, sz) do {                                   \
+    uint64_t __v = (uint64_t) (f);                                      \
+    utils_stat_int((s), &__v, (sz));                                    \
+    if ((s)->restore) (f) = __v;                                        \
+} while (0)
+
+#define UTILS_STAT16(s, f) UTILS_STAT_INT(s, f, 2)
+#define UTILS_STAT32(s, f) UTILS_STAT_INT(s, f, 4)
+#define UTILS_STAT64(s, f) UTILS_STAT_INT(s, f, 8)
+
+/* arrays of 16 bit values (signed or not) */
+#define UTILS_STAT_ARRAY16(s, a) \
+    utils_stat_array16((s), (a), sizeof(a) / sizeof((a)[0]))
+
+/* log levels */
+#define UTILS_LOG_ERROR 0
+#define UTILS_LOG_WARN  1
+#define UTILS_LOG_INFO  2
+#define UTILS_LOG_DEBUG 3
+
+/* messages of higher levels are not even compiled (make LOG_LEVEL=n) */
+#ifndef UTILS_LOG_LEVEL
+#define UTILS_LOG_LEVEL UTILS_LOG_INFO
+#endif
+
+#define utils_log_error(...) utils_log_msg(UTILS_LOG_ERROR, 0, __VA_ARGS__)
+
+#if UTILS_LOG_LEVEL >= UTILS_LOG_WARN
+#define utils_log_warn(...)  utils_log_msg(UTILS_LOG_WARN, 0, __VA_ARGS__)
+#else
+#define utils_log_warn(...)  ((void) 0)
+#endif
+
+#if UTILS_LOG_LEVEL >= UTILS_LOG_INFO
+#define utils_log_info(...)  utils_log_msg(UTILS_LOG_INFO, 0, __VA_ARGS__)
+#define utils_ts_log(...)    utils_log_msg(UTILS_LOG_INFO, 1, __VA_ARGS__)
+#else
+#define utils_log_info(...)  ((void) 0)
+#define utils_ts_log(...)    ((void) 0)
+#endif
+
+#if UTILS_LOG_LEVEL >= UTILS_LOG_DEBUG
+#define utils_log_debug(...) utils_log_msg(UTILS_LOG_DEBUG, 0, __VA_ARGS__)
+#else
+#define utils_log_debug(...) ((void) 0)
+#endif
+
+/* plain log is an info one */
+#define utils_log(...)       utils_log_info(__VA_ARGS__)
+
+/* initial value of a utils_hash64 chain */
+#define UTILS_HASH64_INIT 0xCBF29CE484222325ULL
+
 /* prototypes */
 void    utils_binary_sem_init(utils_binary_sem_t *p);
 void    utils_binary_sem_post(utils_binary_sem_t *p);
 void    utils_binary_sem_wait(utils_binary_sem_t *p, unsigned int nanosecs);
-void    utils_log(const char *format, ...);
+uint64_t utils_hash64(const void *buf, size_t sz, uint64_t h);
+void    utils_log_msg(char level, char ts, const char *format, ...)
+            __attribute__ ((format (printf, 3, 4)));
+char    utils_log_start();
+void    utils_log_stop();
+char    utils_queue_empty(utils_queue_t *q);
+char    utils_queue_init(utils_queue_t *q, size_t elem_sz, size_t n);
+char    utils_queue_pop(utils_queue_t *q, void *elem);
+char    utils_queue_push(utils_queue_t *q, void *elem, size_t *pos);
+void    utils_queue_term(utils_queue_t *q);
+uint32_t utils_rand();
+void    utils_srand(uint32_t seed);
+void    utils_stat_array16(utils_stat_t *s, void *p, size_t n);
+void    utils_stat_bytes(utils_stat_t *s, void *p, size_t sz);
+void    utils_stat_init(utils_stat_t *s, void *buf, size_t sz, char restore);
+void    utils_stat_int(utils_stat_t *s, uint64_t *v, size_t sz);
 void    utils_log_urgent(const char *format, ...);
-void    utils_ts_log(const char *format, ...);
 
 #endif
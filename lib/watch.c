@@ -0,0 +1,519 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmu.h"
+#include "utils.h"
+#include "watch.h"
+
+/* expressions are compiled to a stack machine bytecode */
+enum {
+    WATCH_OP_END,
+    WATCH_OP_PUSH,      /* int32 value                       */
+    WATCH_OP_READ,      /* kind, uint16 bank, uint16 address */
+    WATCH_OP_DELTA,     /* slot                              */
+    WATCH_OP_NEG,
+    WATCH_OP_NOT,
+    WATCH_OP_INV,
+    WATCH_OP_ADD,
+    WATCH_OP_SUB,
+    WATCH_OP_MUL,
+    WATCH_OP_DIV,
+    WATCH_OP_MOD,
+    WATCH_OP_AND,
+    WATCH_OP_OR,
+    WATCH_OP_XOR,
+    WATCH_OP_SHL,
+    WATCH_OP_SHR,
+    WATCH_OP_EQ,
+    WATCH_OP_NE,
+    WATCH_OP_LT,
+    WATCH_OP_LE,
+    WATCH_OP_GT,
+    WATCH_OP_GE,
+    WATCH_OP_LAND,
+    WATCH_OP_LOR
+};
+
+/* kind of reads, BCD ones carry the byte count in the low nibble */
+#define WATCH_RD_BYTE   0x00
+#define WATCH_RD_WORD   0x10
+#define WATCH_RD_BCD    0x20
+
+/* bank of reads on currently mapped memory */
+#define WATCH_NO_BANK   0xFFFF
+
+typedef struct watch_binop_s
+{
+    char    *str;
+    uint8_t  prec;
+    uint8_t  op;
+
+} watch_binop_t;
+
+/* longest first, higher precedence binds tighter */
+watch_binop_t watch_binops[] = {
+    { "||", 1, WATCH_OP_LOR },
+    { "&&", 2, WATCH_OP_LAND },
+    { "==", 6, WATCH_OP_EQ },
+    { "!=", 6, WATCH_OP_NE },
+    { "<=", 7, WATCH_OP_LE },
+    { ">=", 7, WATCH_OP_GE },
+    { "<<", 8, WATCH_OP_SHL },
+    { ">>", 8, WATCH_OP_SHR },
+    { "|",  3, WATCH_OP_OR },
+    { "^",  4, WATCH_OP_XOR },
+    { "&",  5, WATCH_OP_AND },
+    { "<",  7, WATCH_OP_LT },
+    { ">",  7, WATCH_OP_GT },
+    { "+",  9, WATCH_OP_ADD },
+    { "-",  9, WATCH_OP_SUB },
+    { "*", 10, WATCH_OP_MUL },
+    { "/", 10, WATCH_OP_DIV },
+    { "%", 10, WATCH_OP_MOD },
+    { NULL, 0, 0 }
+};
+
+typedef struct watch_parser_s
+{
+    char    *s;
+    watch_t *w;
+    uint8_t  depth;
+    char     err;
+
+} watch_parser_t;
+
+/* expressions evaluated at every frame */
+watch_t  watch_list[WATCH_MAX];
+uint8_t  watch_count = 0;
+int32_t  watch_values[WATCH_MAX];
+char     watch_on = 0;
+
+/* internal prototypes */
+void watch_parse_expr(watch_parser_t *p, uint8_t min_prec);
+
+
+void watch_emit(watch_parser_t *p, void *data, size_t sz)
+{
+    if (p->w->len + sz > WATCH_CODE_SZ)
+    {
+        p->err = 1;
+        return;
+    }
+
+    memcpy(&p->w->code[p->w->len], data, sz);
+    p->w->len += sz;
+}
+
+void watch_emit_op(watch_parser_t *p, uint8_t op)
+{
+    watch_emit(p, &op, 1);
+}
+
+/* one more value on the evaluation stack */
+void watch_push(watch_parser_t *p)
+{
+    if (++p->depth > WATCH_STACK_SZ)
+        p->err = 1;
+}
+
+void watch_skip(watch_parser_t *p)
+{
+    while (isspace((unsigned char) *p->s))
+        p->s++;
+}
+
+char watch_expect(watch_parser_t *p, char c)
+{
+    watch_skip(p);
+
+    if (*p->s != c)
+    {
+        p->err = 1;
+        return 1;
+    }
+
+    p->s++;
+
+    return 0;
+}
+
+uint32_t watch_parse_number(watch_parser_t *p)
+{
+    int base = 10;
+
+    watch_skip(p);
+
+    if (*p->s == '$')
+    {
+        p->s++;
+        base = 16;
+    }
+    else if (p->s[0] == '0' && (p->s[1] == 'x' || p->s[1] == 'X'))
+    {
+        p->s += 2;
+        base = 16;
+    }
+
+    /* strtoul would take spaces and signs */
+    if (!isxdigit((unsigned char) *p->s) || 
+        (base == 10 && !isdigit((unsigned char) *p->s)))
+    {
+        p->err = 1;
+        return 0;
+    }
+
+    return (uint32_t) strtoul(p->s, &p->s, base);
+}
+
+/* [addr] or [bank:addr] after a read keyword */
+void watch_parse_read(watch_parser_t *p, uint8_t kind)
+{
+    uint16_t bank = WATCH_NO_BANK;
+    uint16_t a;
+    uint32_t addr;
+
+    if (watch_expect(p, '['))
+        return;
+
+    addr = watch_parse_number(p);
+
+    watch_skip(p);
+
+    if (*p->s == ':')
+    {
+        p->s++;
+
+        /* bank numbers go up to 0x1FF */
+        if (addr > 0x1FF)
+            p->err = 1;
+
+        bank = addr;
+        addr = watch_parse_number(p);
+    }
+
+    if (watch_expect(p, ']') || addr > 0xFFFF)
+    {
+        p->err = 1;
+        return;
+    }
+
+    a = addr;
+
+    watch_emit_op(p, WATCH_OP_READ);
+    watch_emit(p, &kind, 1);
+    watch_emit(p, &bank, 2);
+    watch_emit(p, &a, 2);
+    watch_push(p);
+}
+
+void watch_parse_unary(watch_parser_t *p)
+{
+    uint32_t v;
+    uint8_t slot;
+    char c;
+
+    watch_skip(p);
+
+    c = *p->s;
+
+    if (c == '-' || c == '!' || c == '~')
+    {
+        p->s++;
+
+        watch_parse_unary(p);
+        watch_emit_op(p, c == '-' ? WATCH_OP_NEG : 
+                         c == '!' ? WATCH_OP_NOT : WATCH_OP_INV);
+    }
+    else if (c == '(')
+    {
+        p->s++;
+
+        watch_parse_expr(p, 1);
+        watch_expect(p, ')');
+    }
+    else if (c == '$' || isdigit((unsigned char) c))
+    {
+        v = watch_parse_number(p);
+
+        watch_emit_op(p, WATCH_OP_PUSH);
+        watch_emit(p, &v, 4);
+        watch_push(p);
+    }
+    else if (strncmp(p->s, "bcd", 3) == 0)
+    {
+        p->s += 3;
+
+        /* byte count, 1 if omitted */
+        v = 1;
+
+        if (isdigit((unsigned char) *p->s))
+            v = *p->s++ - '0';
+
+        if (v < 1 || v > 4)
+            p->err = 1;
+        else
+            watch_parse_read(p, WATCH_RD_BCD | v);
+    }
+    else if (c == 'b' || c == 'w')
+    {
+        p->s++;
+
+        watch_parse_read(p, c == 'b' ? WATCH_RD_BYTE : WATCH_RD_WORD);
+    }
+    else if (c == 'd')
+    {
+        p->s++;
+
+        if (p->w->deltas == WATCH_DELTA_MAX || watch_expect(p, '('))
+        {
+            p->err = 1;
+            return;
+        }
+
+        slot = p->w->deltas++;
+
+        watch_parse_expr(p, 1);
+        watch_expect(p, ')');
+
+        watch_emit_op(p, WATCH_OP_DELTA);
+        watch_emit(p, &slot, 1);
+    }
+    else
+        p->err = 1;
+}
+
+/* precedence climbing on binary operators */
+void watch_parse_expr(watch_parser_t *p, uint8_t min_prec)
+{
+    watch_binop_t *b;
+
+    watch_parse_unary(p);
+
+    while (!p->err)
+    {
+        watch_skip(p);
+
+        for (b = watch_binops; b->str; b++)
+            if (strncmp(p->s, b->str, strlen(b->str)) == 0)
+                break;
+
+        if (b->str == NULL || b->prec < min_prec)
+            return;
+
+        p->s += strlen(b->str);
+
+        watch_parse_expr(p, b->prec + 1);
+        watch_emit_op(p, b->op);
+
+        /* two operands, one result */
+        p->depth--;
+    }
+}
+
+/* compile expr into w, 0 if it's fine */
+char watch_compile(watch_t *w, char *expr)
+{
+    watch_parser_t p;
+
+    bzero(w, sizeof(watch_t));
+
+    p.s = expr;
+    p.w = w;
+    p.depth = 0;
+    p.err = 0;
+
+    watch_parse_expr(&p, 1);
+    watch_skip(&p);
+
+    if (*p.s != '\0')
+        p.err = 1;
+
+    watch_emit_op(&p, WATCH_OP_END);
+
+    if (p.err)
+    {
+        utils_log_error("Watch expression error at column %d: %s\n",
+                        (int) (p.s - expr) + 1, expr);
+        return 1;
+    }
+
+    return 0;
+}
+
+static inline uint8_t watch_read8(uint16_t bank, uint16_t a)
+{
+    if (bank == WATCH_NO_BANK)
+        return mmu_read_no_cyc(a);
+
+    return mmu_read_bank(bank, a);
+}
+
+int32_t watch_read(uint8_t kind, uint16_t bank, uint16_t a)
+{
+    int32_t v = 0;
+    uint8_t i, b;
+
+    switch (kind & 0xF0)
+    {
+        case WATCH_RD_BYTE:
+            return watch_read8(bank, a);
+
+        case WATCH_RD_WORD:
+            return watch_read8(bank, a) | (watch_read8(bank, a + 1) << 8);
+
+        case WATCH_RD_BCD:
+
+            for (i = 0; i < (kind & 0x0F); i++)
+            {
+                b = watch_read8(bank, a + i);
+                v = (uint32_t) v * 100 + (b >> 4) * 10 + (b & 0x0F);
+            }
+
+            break;
+    }
+
+    return v;
+}
+
+/* evaluate on the current machine state */
+int32_t watch_eval(watch_t *w)
+{
+    int32_t stack[WATCH_STACK_SZ];
+    uint8_t *pc = w->code;
+    uint16_t bank, addr;
+    int32_t a, b, v;
+    int sp = 0;
+
+    while (1)
+    {
+        uint8_t op = *pc++;
+
+        switch (op)
+        {
+            case WATCH_OP_END:
+
+                w->primed = 1;
+
+                return sp ? stack[0] : 0;
+
+            case WATCH_OP_PUSH:
+
+                memcpy(&v, pc, 4);
+                pc += 4;
+
+                stack[sp++] = v;
+                continue;
+
+            case WATCH_OP_READ:
+
+                memcpy(&bank, pc + 1, 2);
+                memcpy(&addr, pc + 3, 2);
+
+                stack[sp++] = watch_read(pc[0], bank, addr);
+                pc += 5;
+                continue;
+
+            case WATCH_OP_DELTA:
+
+                v = stack[sp - 1];
+
+                /* nothing changed before the first evaluation */
+                stack[sp - 1] = w->primed ?
+                                (uint32_t) v - (uint32_t) w->prev[*pc] : 0;
+                w->prev[*pc++] = v;
+                continue;
+
+            case WATCH_OP_NEG: stack[sp - 1] = -(uint32_t) stack[sp - 1];
+                               continue;
+            case WATCH_OP_NOT: stack[sp - 1] = !stack[sp - 1]; continue;
+            case WATCH_OP_INV: stack[sp - 1] = ~stack[sp - 1]; continue;
+        }
+
+        /* binary operators */
+        b = stack[--sp];
+        a = stack[sp - 1];
+
+        /* wrap around on overflow like the CPU does, INT32_MIN / -1 */
+        /* would trap otherwise                                     */
+        switch (op)
+        {
+            case WATCH_OP_ADD:  v = (uint32_t) a + (uint32_t) b; break;
+            case WATCH_OP_SUB:  v = (uint32_t) a - (uint32_t) b; break;
+            case WATCH_OP_MUL:  v = (uint32_t) a * (uint32_t) b; break;
+            case WATCH_OP_DIV:  v = b == -1 ? -(uint32_t) a :
+                                    b ? a / b : 0; break;
+            case WATCH_OP_MOD:  v = b == -1 || b == 0 ? 0 : a % b; break;
+            case WATCH_OP_AND:  v = a & b; break;
+            case WATCH_OP_OR:   v = a | b; break;
+            case WATCH_OP_XOR:  v = a ^ b; break;
+            case WATCH_OP_SHL:  v = (uint32_t) a << (b & 31); break;
+            case WATCH_OP_SHR:  v = (uint32_t) a >> (b & 31); break;
+            case WATCH_OP_EQ:   v = a == b; break;
+            case WATCH_OP_NE:   v = a != b; break;
+            case WATCH_OP_LT:   v = a < b; break;
+            case WATCH_OP_LE:   v = a <= b; break;
+            case WATCH_OP_GT:   v = a > b; break;
+            case WATCH_OP_GE:   v = a >= b; break;
+            case WATCH_OP_LAND: v = a && b; break;
+            case WATCH_OP_LOR:  v = a || b; break;
+            default:            v = 0;
+        }
+
+        stack[sp - 1] = v;
+    }
+}
+
+/* forget previous values, next d() are 0 */
+void watch_reset(watch_t *w)
+{
+    w->primed = 0;
+}
+
+/* evaluate expr at every frame into watch_values[], returns its index */
+int watch_add(char *expr)
+{
+    if (watch_count == WATCH_MAX || 
+        watch_compile(&watch_list[watch_count], expr))
+        return -1;
+
+    watch_values[watch_count] = 0;
+    watch_on = 1;
+
+    return watch_count++;
+}
+
+void watch_clear()
+{
+    watch_count = 0;
+    watch_on = 0;
+}
+
+/* called once a frame is completed */
+void watch_frame()
+{
+    uint8_t i;
+
+    for (i = 0; i < watch_count; i++)
+        watch_values[i] = watch_eval(&watch_list[i]);
+}
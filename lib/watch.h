@@ -0,0 +1,71 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef __WATCH_HDR__
+#define __WATCH_HDR__
+
+#include <stdint.h>
+
+/* RAM watch expressions, C-like integer syntax:                       */
+/*                                                                     */
+/*   b[addr]       byte                                                */
+/*   w[addr]       16 bit little endian word                           */
+/*   bcdN[addr]    N (1-4) bytes of BCD, most significant first        */
+/*   x[bank:addr]  any of the above read from a bank, even if unmapped */
+/*   d(expr)       change of expr since the previous evaluation        */
+/*                                                                     */
+/* numbers are decimal, 0x or $ hex. operators are + - * / % & | ^ << */
+/* >> == != < <= > >= && || ! ~ and parentheses                        */
+/*                                                                     */
+/* e.g. "d(bcd3[0xC0A0])" for a score delta, "b[$DA15] == 0" for done */
+
+#define WATCH_CODE_SZ  256
+#define WATCH_DELTA_MAX 8
+#define WATCH_STACK_SZ 16
+
+/* expressions evaluated by watch_frame() */
+#define WATCH_MAX      16
+
+/* compiled expression */
+typedef struct watch_s
+{
+    uint8_t  code[WATCH_CODE_SZ];
+    uint16_t len;
+
+    /* previous values of every d() */
+    uint8_t  deltas;
+    uint8_t  primed;
+    int32_t  prev[WATCH_DELTA_MAX];
+
+} watch_t;
+
+/* values of the expressions added by watch_add(), updated every frame */
+extern int32_t watch_values[WATCH_MAX];
+extern char    watch_on;
+
+/* prototypes */
+int     watch_add(char *expr);
+void    watch_clear();
+char    watch_compile(watch_t *w, char *expr);
+int32_t watch_eval(watch_t *w);
+void    watch_frame();
+void    watch_reset(watch_t *w);
+
+#endif
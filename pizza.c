@@ -21,18 +21,28 @@
 #include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "bootcache.h"
 #include "cartridge.h"
+#include "checkpoint.h"
+#include "cputrace.h"
 #include "cycles.h"
 #include "gameboy.h"
 #include "global.h"
 #include "gpu.h"
+#include "idle.h"
 #include "input.h"
+#include "movie.h"
 #include "network.h"
+#include "profile.h"
+#include "rewind.h"
 #include "sound.h"
 #include "serial.h"
+#include "trace.h"
 
 /* proto */
 void cb();
@@ -40,8 +50,10 @@ void connected_cb();
 void disconnected_cb();
 void rumble_cb(uint8_t rumble);
 void network_send_data(uint8_t v);
+void push_key(SDL_Keycode k, char state);
 void *start_thread(void *args);
 void *start_thread_network(void *args);
+void usage(char *prog);
 
 /* frame buffer pointer */
 uint16_t *fb;
@@ -60,6 +72,16 @@ SDL_Surface *windowSurface;
 /* cartridge name */
 char cart_name[64];
 
+/* frames of run-ahead */
+int runahead = 0;
+
+
+void usage(char *prog)
+{
+    printf("Usage: %s [-r movie] [-p movie] [-b frames] [-s seed] "
+           "[-t trace] [-P profile] [-T cputrace] [-c hashes] [-C hashes] "
+           "[-I] [-R MB[:frames]] rom\n", prog);
+}
 
 int main(int argc, char **argv)
 {
@@ -68,15 +90,62 @@ int main(int argc, char **argv)
     SDL_AudioSpec desired;
     SDL_AudioSpec obtained;
 
+    /* command line options */
+    char *movie_rec = NULL;
+    char *movie_in = NULL;
+    char *trace_fn = NULL;
+    char *profile_fn = NULL;
+    char *cputrace_fn = NULL;
+    char *checkpoint_fn = NULL;
+    char checkpoint_cmp = 0;
+    uint32_t boot_frames = 0;
+    size_t rewind_mb = 0;
+    uint16_t rewind_interval = 1;
+    char *p;
+    int opt;
+
     /* init global variables */
     global_init();
 
+    while ((opt = getopt(argc, argv, "r:p:b:s:t:P:T:c:C:IR:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': movie_rec = optarg; break;
+            case 'p': movie_in = optarg; break;
+            case 'b': boot_frames = strtoul(optarg, NULL, 0); break;
+            case 't': trace_fn = optarg; break;
+            case 'P': profile_fn = optarg; break;
+            case 'T': cputrace_fn = optarg; break;
+            case 'C': checkpoint_cmp = 1;
+                      /* fall through */
+            case 'c': checkpoint_fn = optarg; break;
+            case 's': global_deterministic = 1;
+                      global_seed = strtoul(optarg, NULL, 0);
+                      break;
+            case 'I': idle_on = 1; break;
+            case 'R': rewind_mb = strtoul(optarg, &p, 0);
+                      if (*p == ':')
+                          rewind_interval = strtoul(p + 1, NULL, 0);
+                      break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
     /* set global folder */
     snprintf(global_save_folder, sizeof(global_save_folder), "/tmp/str/save/");
     __mkdirp(global_save_folder, S_IRWXU);
 
     /* first, load cartridge */
-    char ret = cartridge_load(argv[1]);
+    char ret = cartridge_load(argv[optind]);
 
     if (ret != 0)
         return 1;
@@ -123,6 +192,10 @@ int main(int argc, char **argv)
 
     gameboy_init();
 
+    /* rewind is off unless asked, it saves a state every interval */
+    if (rewind_mb && rewind_init(rewind_mb << 20, rewind_interval))
+        return 1;
+
     /* initialize SDL audio */
     SDL_Init(SDL_INIT_AUDIO);
     desired.freq = 44100;
@@ -153,6 +226,42 @@ int main(int argc, char **argv)
     /* get frame buffer reference */
     fb = gpu_get_frame_buffer();    
 
+    /* start after the first frames (of movie), cached from the */
+    /* previous runs - the boot path runs at full speed anyway   */
+    if (boot_frames)
+    {
+        global_uncapped = 1;
+        ret = bootcache_reach(movie_in, boot_frames);
+        global_uncapped = 0;
+
+        if (ret)
+            return 1;
+    }
+
+    /* movies start from power on */
+    else if (movie_in && movie_play(movie_in))
+        return 1;
+
+    if (movie_rec)
+        movie_record(movie_rec);
+
+    if (trace_fn)
+        trace_start(trace_fn);
+
+    if (profile_fn)
+        profile_start(profile_fn);
+
+    if (cputrace_fn)
+        cputrace_start(cputrace_fn, 0);
+
+    if (checkpoint_fn && checkpoint_start(checkpoint_fn, checkpoint_cmp))
+        return 1;
+
+    /* a run resumed by -b goes on from there into a cold run reference */
+    if (checkpoint_fn && checkpoint_cmp && boot_frames &&
+        checkpoint_seek(gpu.frame_counter))
+        return 1;
+
     /* start thread! */
     pthread_create(&thread, NULL, start_thread, NULL);
 
@@ -181,14 +290,20 @@ int main(int argc, char **argv)
             case SDL_KEYDOWN:
                 switch (e.key.keysym.sym)
                 {
-                    case (SDLK_1): gameboy_set_pause(1);
-                                   gameboy_save_stat(0);
-                                   gameboy_set_pause(0);
+                    case (SDLK_1): gameboy_cmd(GAMEBOY_CMD_SAVE_STAT, 0, 0);
+                                   break;
+                    case (SDLK_2): gameboy_cmd(GAMEBOY_CMD_RESTORE_STAT, 0, 0);
                                    break;
-                    case (SDLK_2): gameboy_set_pause(1);
-                                   gameboy_restore_stat(0); 
-                                   gameboy_set_pause(0);
+                    case (SDLK_r): gameboy_cmd_push(GAMEBOY_CMD_RESET, 0, 0);
                                    break;
+                    case (SDLK_BACKSPACE): 
+                        gameboy_cmd_push(GAMEBOY_CMD_REWIND, 1, 0);
+                        break;
+                    case (SDLK_a):
+                        runahead = (runahead + 1) % 4;
+                        gameboy_cmd_push(GAMEBOY_CMD_RUNAHEAD, runahead, 0);
+                        utils_log("Run-ahead %d frames\n", runahead);
+                        break;
                     case (SDLK_9): network_start(&connected_cb, 
                                                  &disconnected_cb,
                                                  "192.168.100.255"); break;
@@ -202,48 +317,31 @@ int main(int argc, char **argv)
                     case (SDLK_PLUS): 
                         if (global_emulation_speed != 
                             GLOBAL_EMULATION_SPEED_4X) 
-                        {
-                            global_emulation_speed++; 
-                            cycles_change_emulation_speed();
-                            sound_change_emulation_speed();
-                        }
+                            gameboy_cmd_push(GAMEBOY_CMD_SPEED,
+                                             global_emulation_speed + 1, 0);
 
                         break;
                     case (SDLK_MINUS):
                         if (global_emulation_speed !=
                             GLOBAL_EMULATION_SPEED_QUARTER)
-                        {
-                            global_emulation_speed--;
-                            cycles_change_emulation_speed();
-                            sound_change_emulation_speed();
-                        }
+                            gameboy_cmd_push(GAMEBOY_CMD_SPEED,
+                                             global_emulation_speed - 1, 0);
 
                         break;
                     case (SDLK_p): gameboy_set_pause(global_pause ^ 0x01); 
                                    break;
                     case (SDLK_m): mmu_dump_all(); break;
-                    case (SDLK_SPACE):  input_set_key_select(1); break;
-                    case (SDLK_RETURN): input_set_key_start(1); break;
-                    case (SDLK_UP):     input_set_key_up(1);    break;
-                    case (SDLK_DOWN):   input_set_key_down(1);  break;
-                    case (SDLK_RIGHT):  input_set_key_right(1); break;
-                    case (SDLK_LEFT):   input_set_key_left(1);  break;
-                    case (SDLK_z):      input_set_key_b(1);     break;
-                    case (SDLK_x):      input_set_key_a(1);     break;
+                    default: push_key(e.key.keysym.sym, 1); break;
                 }
                 break;
 
             case SDL_KEYUP:
                 switch (e.key.keysym.sym)
                 {
-                    case (SDLK_SPACE):  input_set_key_select(0); break;
-                    case (SDLK_RETURN): input_set_key_start(0);  break;
-                    case (SDLK_UP):     input_set_key_up(0);     break;
-                    case (SDLK_DOWN):   input_set_key_down(0);   break;
-                    case (SDLK_RIGHT):  input_set_key_right(0);  break;
-                    case (SDLK_LEFT):   input_set_key_left(0);   break;
-                    case (SDLK_z):      input_set_key_b(0);      break;
-                    case (SDLK_x):      input_set_key_a(0);      break;
+                    case (SDLK_BACKSPACE): 
+                        gameboy_cmd_push(GAMEBOY_CMD_REWIND, 0, 0);
+                        break;
+                    default: push_key(e.key.keysym.sym, 0); break;
                 }
                 break;
         }
@@ -255,8 +353,8 @@ int main(int argc, char **argv)
     /* stop network thread! */
     network_stop();
 
-    utils_log("Total cycles %d\n", cycles.cnt);
-    utils_log("Total running seconds %d\n", cycles.seconds);
+    utils_log("Total cycles %lu\n", (unsigned long) cycles.cnt);
+    utils_log("Total running seconds %lu\n", (unsigned long) cycles.seconds);
 
     return 0;
 }
@@ -321,6 +419,27 @@ void cb()
     SDL_UpdateWindowSurface(window);
 }
 
+/* send joypad changes to emulation thread */
+void push_key(SDL_Keycode k, char state)
+{
+    uint8_t key;
+
+    switch (k)
+    {
+        case (SDLK_SPACE):  key = INPUT_KEY_SELECT; break;
+        case (SDLK_RETURN): key = INPUT_KEY_START;  break;
+        case (SDLK_UP):     key = INPUT_KEY_UP;     break;
+        case (SDLK_DOWN):   key = INPUT_KEY_DOWN;   break;
+        case (SDLK_RIGHT):  key = INPUT_KEY_RIGHT;  break;
+        case (SDLK_LEFT):   key = INPUT_KEY_LEFT;   break;
+        case (SDLK_z):      key = INPUT_KEY_B;      break;
+        case (SDLK_x):      key = INPUT_KEY_A;      break;
+        default: return;
+    }
+
+    gameboy_cmd_push(GAMEBOY_CMD_INPUT, key, state);
+}
+
 void connected_cb()
 {
     utils_log("Connected\n");
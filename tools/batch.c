@@ -0,0 +1,286 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+/* run many headless sessions on all the cores                       */
+/*                                                                   */
+/* pizza-batch [-w workers] [-o dir] [-t secs] [-b frames [-c dir]] */
+/*             jobs results.json                                     */
+/*                                                                   */
+/* every line of jobs is "rom movie|- frames [hash,ram,time]" (see   */
+/* lib/job.h). the machine state is global, so workers are processes */
+/* taking the next job from a shared counter, each job is run into a */
+/* child of its own (a crashing or hanging ROM takes down just that) */
+/* -b starts every job after its first frames, cached into dir       */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "global.h"
+#include "job.h"
+
+/* shared among workers */
+typedef struct shared_s
+{
+    /* next job to take */
+    uint32_t     next;
+
+    job_result_t results[];
+
+} shared_t;
+
+job_t    *jobs = NULL;
+uint32_t  jobs_n = 0;
+shared_t *shared;
+
+/* where RAM dumps and job logs go (NULL = no logs, RAM dumps in cwd) */
+char     *out_dir = NULL;
+
+/* seconds before killing a job, 0 = never */
+unsigned int timeout = 0;
+
+/* frames of every job taken from the boot cache */
+uint32_t boot = 0;
+char    *cache_dir = ".";
+
+char load(char *fn)
+{
+    char line[4096];
+    uint32_t max = 0, n = 0;
+    FILE *fp = fopen(fn, "r");
+    job_t *tmp;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", fn);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        n++;
+
+        if (jobs_n == max)
+        {
+            max = max ? max * 2 : 64;
+            tmp = realloc(jobs, max * sizeof(job_t));
+
+            if (tmp == NULL)
+            {
+                fclose(fp);
+                return 1;
+            }
+
+            jobs = tmp;
+        }
+
+        switch (job_parse(line, &jobs[jobs_n]))
+        {
+            case 0: jobs[jobs_n++].boot = boot; break;
+            case 1: fprintf(stderr, "%s:%u: malformed job\n", fn, n);
+                    fclose(fp);
+                    return 1;
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+void job_path(char *buf, size_t sz, uint32_t i, char *ext)
+{
+    snprintf(buf, sz, "%s/%u.%s", out_dir ? out_dir : ".", i, ext);
+}
+
+/* run job i into a child and wait for it */
+void run(uint32_t i)
+{
+    job_result_t *r = &shared->results[i];
+    char fn[1024];
+    int status, fd;
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        /* messages of the emulator go to the job log or nowhere */
+        if (out_dir)
+            job_path(fn, sizeof(fn), i, "log");
+        else
+            snprintf(fn, sizeof(fn), "/dev/null");
+
+        fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        if (timeout)
+            alarm(timeout);
+
+        job_path(fn, sizeof(fn), i, "ram");
+        job_run(&jobs[i], r, fn);
+
+        fflush(stdout);
+        _exit(0);
+    }
+
+    if (pid < 0)
+    {
+        r->status = JOB_ERROR;
+        return;
+    }
+
+    waitpid(pid, &status, 0);
+
+    if (WIFSIGNALED(status))
+        r->status = (WTERMSIG(status) == SIGALRM) ? JOB_TIMEOUT : JOB_CRASHED;
+}
+
+void worker()
+{
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&shared->next, 1, __ATOMIC_RELAXED)) 
+           < jobs_n)
+        run(i);
+
+    _exit(0);
+}
+
+void write_results(FILE *fp)
+{
+    char fn[1024];
+    char buf[4096];
+    uint32_t i;
+
+    fprintf(fp, "{\n  \"jobs\": [");
+
+    for (i = 0; i < jobs_n; i++)
+    {
+        job_path(fn, sizeof(fn), i, "ram");
+        job_result_json(&jobs[i], &shared->results[i], fn, buf, sizeof(buf));
+
+        fprintf(fp, "%s\n    {\"job\": %u, %s}", i ? "," : "", i, buf);
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec t0, t1;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i, ok = 0;
+    size_t sz;
+    double secs;
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:o:t:b:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w': workers = atol(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 't': timeout = atoi(optarg); break;
+            case 'b': boot = atol(optarg); break;
+            case 'c': cache_dir = optarg; break;
+            default:
+                optind = argc;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, "Usage: %s [-w workers] [-o dir] [-t secs] "
+                        "[-b frames [-c dir]] jobs results.json\n", argv[0]);
+        return 1;
+    }
+
+    /* boot cache lives there, jobs don't touch real saves */
+    snprintf(global_save_folder, sizeof(global_save_folder), "%s", cache_dir);
+
+    if (load(argv[optind]))
+        return 1;
+
+    if (out_dir)
+        mkdir(out_dir, 0755);
+
+    /* results are written by the jobs straight into shared memory */
+    sz = sizeof(shared_t) + jobs_n * sizeof(job_result_t);
+    shared = mmap(NULL, sz, PROT_READ | PROT_WRITE, 
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map results\n");
+        return 1;
+    }
+
+    if (workers < 1)
+        workers = 1;
+
+    if (workers > jobs_n)
+        workers = jobs_n;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < workers; i++)
+        if (fork() == 0)
+            worker();
+
+    while (wait(NULL) > 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fp = fopen(argv[optind + 1], "w");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    write_results(fp);
+    fclose(fp);
+
+    for (i = 0; i < jobs_n; i++)
+        if (shared->results[i].status == JOB_OK)
+            ok++;
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%u jobs, %u ok, %u failed, %ld workers, %.2f s (%.1f jobs/s)\n",
+           jobs_n, ok, jobs_n - ok, workers, secs, jobs_n / secs);
+
+    return ok == jobs_n ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+/* offline decoder of binary CPU traces (see lib/cputrace.h)         */
+/*                                                                   */
+/* pizza-cputrace dump trace [-v]        print Gameboy Doctor lines  */
+/* pizza-cputrace diff trace reference   compare against a Gameboy   */
+/*                                       Doctor log of another emu   */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cputrace.h"
+
+/* lines of context printed before a divergence */
+#define CONTEXT 8
+
+cputrace_header_t  hdr;
+cputrace_record_t *ring;
+
+/* first and last + 1 record still in the ring */
+uint64_t first;
+uint64_t last;
+
+char load(char *fn)
+{
+    FILE *fp = fopen(fn, "r");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", fn);
+        return 1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, CPUTRACE_MAGIC, 8) ||
+        hdr.record_sz != sizeof(cputrace_record_t))
+    {
+        fprintf(stderr, "%s is not a CPU trace\n", fn);
+        fclose(fp);
+        return 1;
+    }
+
+    ring = malloc((size_t) hdr.records * sizeof(cputrace_record_t));
+
+    if (ring == NULL ||
+        fread(ring, sizeof(cputrace_record_t), hdr.records, fp) != 
+        hdr.records)
+    {
+        fprintf(stderr, "Cannot read %s\n", fn);
+        fclose(fp);
+        return 1;
+    }
+
+    fclose(fp);
+
+    last = hdr.head;
+    first = (last > hdr.records) ? last - hdr.records : 0;
+
+    return 0;
+}
+
+cputrace_record_t *get(uint64_t i)
+{
+    return &ring[i & (hdr.records - 1)];
+}
+
+/* Gameboy Doctor format */
+void format(cputrace_record_t *r, char *buf, size_t sz)
+{
+    snprintf(buf, sz, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X "
+                      "L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+                      r->a, r->f, r->b, r->c, r->d, r->e, r->h, r->l,
+                      r->sp, r->pc, r->mem[0], r->mem[1], r->mem[2], 
+                      r->mem[3]);
+}
+
+/* extra stuff not part of Doctor format */
+void format_extra(cputrace_record_t *r, char *buf, size_t sz)
+{
+    snprintf(buf, sz, " CY:%lu BANK:%02X IME:%d IE:%02X IF:%02X",
+                      (unsigned long) r->cycles, r->bank, r->ime, 
+                      r->ie, r->iflag);
+}
+
+int dump(int verbose)
+{
+    char line[128], extra[64];
+    uint64_t i;
+
+    for (i = first; i < last; i++)
+    {
+        format(get(i), line, sizeof(line));
+
+        if (verbose)
+        {
+            format_extra(get(i), extra, sizeof(extra));
+            printf("%s%s\n", line, extra);
+        }
+        else
+            printf("%s\n", line);
+    }
+
+    return 0;
+}
+
+int diff(char *ref_fn)
+{
+    char line[128], ref[256], extra[64];
+    uint64_t i = first, n = 0, j;
+    FILE *fp = fopen(ref_fn, "r");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", ref_fn);
+        return 2;
+    }
+
+    if (first == last)
+    {
+        fprintf(stderr, "Empty trace\n");
+        fclose(fp);
+        return 2;
+    }
+
+    /* trace could start later than reference (ring wrapped) */
+    format(get(first), line, sizeof(line));
+
+    while (fgets(ref, sizeof(ref), fp))
+    {
+        ref[strcspn(ref, "\r\n")] = '\0';
+
+        if (strcmp(ref, line) == 0)
+            break;
+
+        n++;
+    }
+
+    if (feof(fp))
+    {
+        printf("First traced instruction not found into reference\n");
+        fclose(fp);
+        return 1;
+    }
+
+    if (n)
+        printf("Skipped %lu reference lines to sync\n", (unsigned long) n);
+
+    for (i = first + 1; i < last; i++)
+    {
+        if (fgets(ref, sizeof(ref), fp) == NULL)
+        {
+            printf("Reference ended, %lu instructions matched\n",
+                   (unsigned long) (i - first));
+            fclose(fp);
+            return 0;
+        }
+
+        ref[strcspn(ref, "\r\n")] = '\0';
+
+        format(get(i), line, sizeof(line));
+
+        if (strcmp(ref, line) == 0)
+            continue;
+
+        printf("Divergence at instruction %lu\n\n", (unsigned long) i);
+
+        for (j = (i - first > CONTEXT) ? i - CONTEXT : first; j < i; j++)
+        {
+            format(get(j), line, sizeof(line));
+            format_extra(get(j), extra, sizeof(extra));
+            printf("  %s%s\n", line, extra);
+        }
+
+        format(get(i), line, sizeof(line));
+        format_extra(get(i), extra, sizeof(extra));
+
+        printf("- %s%s\n+ %s\n", line, extra, ref);
+
+        fclose(fp);
+        return 1;
+    }
+
+    printf("Trace ended, %lu instructions matched\n", 
+           (unsigned long) (last - first));
+
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "dump") == 0)
+    {
+        if (load(argv[2]))
+            return 2;
+
+        return dump(argc > 3 && strcmp(argv[3], "-v") == 0);
+    }
+
+    if (argc == 4 && strcmp(argv[1], "diff") == 0)
+    {
+        if (load(argv[2]))
+            return 2;
+
+        return diff(argv[3]);
+    }
+
+    fprintf(stderr, "Usage: %s dump trace [-v]\n"
+                    "       %s diff trace reference.log\n", argv[0], argv[0]);
+
+    return 2;
+}
@@ -0,0 +1,349 @@
+/*
+
+    This file is part of Emu-Pizza
+
+    Emu-Pizza is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Emu-Pizza is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Emu-Pizza.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+/* serve headless jobs of a single ROM from a warm process            */
+/*                                                                    */
+/* pizza-forkserver [-f frames] [-l state] [-o dir] [-t secs]         */
+/*                  [-c dir] rom sock                                 */
+/*                                                                    */
+/* the ROM is loaded once and run up to a chosen point (-f frames of  */
+/* no input, or save state -l). with -c the -f frames come from the   */
+/* boot cache in dir. every connection on the Unix socket             */
+/* sock sends a line "movie|- frames [hash,ram,time]" (see lib/job.h) */
+/* and gets back a JSON line, the job is run into a copy-on-write     */
+/* child forked from the warm machine                                 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "bootcache.h"
+#include "gameboy.h"
+#include "global.h"
+#include "job.h"
+#include "persist.h"
+#include "utils.h"
+
+char *rom_fn;
+
+/* where RAM dumps and job logs go (NULL = no logs, RAM dumps in cwd) */
+char *out_dir = NULL;
+
+/* seconds before killing a job, 0 = never */
+unsigned int timeout = 0;
+
+/* boot cache folder, NULL = always run the warm up frames */
+char *cache_dir = NULL;
+
+/* served so far, names RAM dumps and logs */
+uint32_t served = 0;
+
+/* connection of the child and the reply if it dies */
+int  conn;
+char reply_timeout[2048];
+char reply_crashed[2048];
+
+volatile sig_atomic_t quit = 0;
+
+void job_path(char *buf, size_t sz, uint32_t i, char *ext)
+{
+    snprintf(buf, sz, "%s/%u.%s", out_dir ? out_dir : ".", i, ext);
+}
+
+/* async signal safe, replies are formatted before the job starts */
+void on_signal(int sig)
+{
+    char *reply = (sig == SIGALRM) ? reply_timeout : reply_crashed;
+    ssize_t n = write(conn, reply, strlen(reply));
+
+    (void) n;
+
+    _exit(1);
+}
+
+void on_term(int sig)
+{
+    quit = 1;
+}
+
+/* read a request line, the only one of the connection */
+char read_line(char *buf, size_t sz)
+{
+    size_t n = 0;
+    ssize_t r;
+
+    while (n < sz - 1)
+    {
+        r = read(conn, &buf[n], 1);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0 || buf[n] == '\n')
+            break;
+
+        n++;
+    }
+
+    buf[n] = '\0';
+
+    return n == 0;
+}
+
+void format_reply(char *buf, size_t sz, job_t *j, job_result_t *r, 
+                  char *ram_fn, double fork_us)
+{
+    char fields[1536];
+
+    job_result_json(j, r, ram_fn, fields, sizeof(fields));
+
+    snprintf(buf, sz, "{\"job\": %u, %s, \"fork_us\": %.1f}\n", 
+             served, fields, fork_us);
+}
+
+/* child side of a connection */
+void serve(struct timespec *t0)
+{
+    struct timespec t1;
+    job_result_t r;
+    char line[2048], req[4096], fn[1024], buf[2048];
+    double fork_us;
+    job_t j;
+    int fd;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fork_us = (t1.tv_sec - t0->tv_sec) * 1e6 + 
+              (t1.tv_nsec - t0->tv_nsec) / 1e3;
+
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    if (read_line(line, sizeof(line)))
+        _exit(1);
+
+    /* same syntax as pizza-batch, ROM is the served one */
+    snprintf(req, sizeof(req), "%s %s", rom_fn, line);
+
+    memset(&r, 0, sizeof(r));
+    job_path(fn, sizeof(fn), served, "ram");
+
+    if (job_parse(req, &j))
+    {
+        snprintf(buf, sizeof(buf), "{\"job\": %u, \"status\": \"error\", "
+                                   "\"message\": \"malformed job\"}\n", 
+                                   served);
+        goto reply;
+    }
+
+    r.status = JOB_TIMEOUT;
+    format_reply(reply_timeout, sizeof(reply_timeout), &j, &r, fn, fork_us);
+    r.status = JOB_CRASHED;
+    format_reply(reply_crashed, sizeof(reply_crashed), &j, &r, fn, fork_us);
+
+    signal(SIGALRM, on_signal);
+    signal(SIGSEGV, on_signal);
+    signal(SIGBUS, on_signal);
+    signal(SIGFPE, on_signal);
+    signal(SIGILL, on_signal);
+    signal(SIGABRT, on_signal);
+
+    /* messages of the emulator go to the job log or nowhere */
+    if (out_dir)
+    {
+        job_path(buf, sizeof(buf), served, "log");
+        fd = open(buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    else
+        fd = open("/dev/null", O_WRONLY);
+
+    if (fd >= 0)
+    {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+
+    if (timeout)
+        alarm(timeout);
+
+    job_exec(&j, &r, fn);
+
+    alarm(0);
+    fflush(stdout);
+
+    format_reply(buf, sizeof(buf), &j, &r, fn, fork_us);
+
+reply:
+
+    if (write(conn, buf, strlen(buf)) < 0)
+        _exit(1);
+
+    _exit(0);
+}
+
+/* run the machine up to the point every job starts from */
+char warm_up(uint32_t frames, int state)
+{
+    uint32_t i;
+
+    if (job_load(rom_fn))
+        return 1;
+
+    if (state >= 0 && gameboy_restore_stat(state))
+    {
+        fprintf(stderr, "Cannot restore state %d\n", state);
+        return 1;
+    }
+
+    if (cache_dir && state < 0)
+    {
+        snprintf(global_save_folder, sizeof(global_save_folder), "%s", 
+                 cache_dir);
+
+        if (frames && bootcache_reach(NULL, frames))
+            return 1;
+    }
+    else
+        for (i = 0; i < frames; i++)
+            gameboy_run_frame();
+
+    /* children are single threaded copies, no background threads */
+    persist_term();
+    utils_log_stop();
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct timespec t0;
+    uint32_t frames = 0;
+    int state = -1;
+    int sock, opt;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "f:l:o:t:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': frames = atol(optarg); break;
+            case 'l': state = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 't': timeout = atoi(optarg); break;
+            case 'c': cache_dir = optarg; break;
+            default:
+                optind = argc;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, "Usage: %s [-f frames] [-l state] [-o dir] "
+                        "[-t secs] [-c dir] rom socket\n", argv[0]);
+        return 1;
+    }
+
+    rom_fn = argv[optind];
+
+    if (strlen(argv[optind + 1]) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long\n");
+        return 1;
+    }
+
+    if (out_dir)
+        mkdir(out_dir, 0755);
+
+    if (warm_up(frames, state))
+        return 1;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[optind + 1]);
+
+    unlink(addr.sun_path);
+
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) || 
+        listen(sock, 64))
+    {
+        fprintf(stderr, "Cannot listen on %s\n", addr.sun_path);
+        return 1;
+    }
+
+    /* children are not waited, replies go straight to the clients */
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* no SA_RESTART, so accept() returns on them */
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_term;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    printf("Serving %s on %s\n", rom_fn, addr.sun_path);
+    fflush(stdout);
+
+    while (!quit)
+    {
+        conn = accept(sock, NULL, NULL);
+
+        if (conn < 0)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        pid = fork();
+
+        if (pid == 0)
+        {
+            close(sock);
+            serve(&t0);
+        }
+
+        if (pid < 0)
+            fprintf(stderr, "Cannot fork: %s\n", strerror(errno));
+
+        close(conn);
+        served++;
+    }
+
+    close(sock);
+    unlink(addr.sun_path);
+
+    printf("Served %u jobs\n", served);
+
+    return 0;
+}